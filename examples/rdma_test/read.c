@@ -261,6 +261,10 @@ int main(int argc, char *argv[])
    */  
   fprintf(stderr, "Info: Creating rn_dev\n");
   rn_dev = create_rn_dev(pcie_resource, &pcie_resource_fd, preallocated_hugepages, num_qp);
+  if(rn_dev == NULL) {
+    fprintf(stderr, "Error: failed to create RecoNIC device\n");
+    exit(EXIT_FAILURE);
+  }
 
   /* 
    * 2. Create an RDMA device instance
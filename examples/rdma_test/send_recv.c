@@ -186,6 +186,10 @@ int main(int argc, char **argv) {
   fprintf(stderr, "Info: CREATE RecoNIC DEVICE\n");
   // Pre-allocate preallocated_hugepages * 2MB hugepage memory
   rn_dev = create_rn_dev(pcie_resource, &pcie_resource_fd, preallocated_hugepages, num_qp);
+  if(rn_dev == NULL) {
+    fprintf(stderr, "Error: failed to create RecoNIC device\n");
+    exit(EXIT_FAILURE);
+  }
   
   /* 
    * 2. Create an RDMA device instance
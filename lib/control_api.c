@@ -13,6 +13,7 @@
  */
 
 #include "control_api.h"
+#include <sys/eventfd.h>
 
 void write32_data(uint32_t* pcie_axil_base, off_t offset, uint32_t value) {
   uint32_t* config_addr;
@@ -62,4 +63,65 @@ uint32_t wait_compute(void* axil_base, uint32_t offset) {
 			compute_done = read32_data((uint32_t*) axil_base, offset);
 	}
   return compute_done;
-}
\ No newline at end of file
+}
+
+int open_event_fd(int fd, uint32_t source) {
+  struct onic_ioc_eventfd uev;
+  int event_fd;
+
+  event_fd = eventfd(0, EFD_CLOEXEC);
+  if(event_fd < 0) {
+    perror("eventfd");
+    return -1;
+  }
+
+  uev.source = source;
+  uev.fd = event_fd;
+  if(ioctl(fd, ONIC_IOC_SET_EVENTFD, &uev) < 0) {
+    fprintf(stderr, "Error: failed to attach an eventfd to interrupt source %u: %s\n", source,
+            strerror(errno));
+    close(event_fd);
+    return -1;
+  }
+
+  return event_fd;
+}
+
+void close_event_fd(int fd, uint32_t source, int event_fd) {
+  struct onic_ioc_eventfd uev;
+
+  uev.source = source;
+  uev.fd = -1;
+  if(ioctl(fd, ONIC_IOC_SET_EVENTFD, &uev) < 0) {
+    fprintf(stderr, "Warning: failed to detach the eventfd of interrupt source %u: %s\n", source,
+            strerror(errno));
+  }
+  close(event_fd);
+}
+
+uint64_t wait_event_fd(int event_fd) {
+  uint64_t count = 0;
+
+  while(read(event_fd, &count, sizeof(count)) != sizeof(count)) {
+    if(errno != EINTR) {
+      perror("read eventfd");
+      return 0;
+    }
+  }
+  return count;
+}
+
+uint32_t wait_compute_event(void* axil_base, uint32_t offset, int event_fd) {
+  uint32_t compute_done;
+
+  // An interrupt raised between the register read and the eventfd read stays
+  // counted in the eventfd, so no completion is missed
+  compute_done = read32_data((uint32_t*) axil_base, offset);
+  while(compute_done == 0) {
+    if(wait_event_fd(event_fd) == 0) {
+      return 0;
+    }
+    compute_done = read32_data((uint32_t*) axil_base, offset);
+  }
+  return compute_done;
+}
@@ -17,6 +17,7 @@
 
 #include "auxiliary.h"
 #include "reconic_reg.h"
+#include "onic_ioctl.h"
 
 /*! \struct ctl_cmd_t
     \brief Compute control command structure.
@@ -86,4 +87,36 @@ void issue_ctl_cmd(void* axil_base, uint32_t offset, ctl_cmd_t* ctl_cmd);
  */
 uint32_t wait_compute(void* axil_base, uint32_t offset);
 
+/** @brief Interrupt control API: A function used to attach an eventfd to an interrupt source
+ *         of the RecoNIC user logic.
+ *  @param fd file descriptor of the character device, e.g., fpga_fd.
+ *  @param source interrupt source: ONIC_EVENT_CQ, ONIC_EVENT_RQ, ONIC_EVENT_ERROR or
+ *                ONIC_EVENT_COMPUTE.
+ *  @return an eventfd, readable and pollable with epoll, or -1 on failure.
+ */
+int open_event_fd(int fd, uint32_t source);
+
+/** @brief Interrupt control API: A function used to detach and close an eventfd.
+ *  @param fd file descriptor of the character device.
+ *  @param source interrupt source the eventfd is attached to.
+ *  @param event_fd eventfd returned by open_event_fd.
+ *  @return void.
+ */
+void close_event_fd(int fd, uint32_t source, int event_fd);
+
+/** @brief Interrupt control API: A function used to block until an interrupt is delivered.
+ *  @param event_fd eventfd returned by open_event_fd.
+ *  @return number of interrupts since the last call, or 0 on failure.
+ */
+uint64_t wait_event_fd(int event_fd);
+
+/** @brief Compute control API: Same as wait_compute, but sleeps on the compute interrupt
+ *         instead of polling.
+ *  @param axil_base AXIL base address of a PCIe device.
+ *  @param offset address offset of a status FIFO associated to the target accelerator.
+ *  @param event_fd eventfd attached to ONIC_EVENT_COMPUTE.
+ *  @return the work ID, or 0 on failure.
+ */
+uint32_t wait_compute_event(void* axil_base, uint32_t offset, int event_fd);
+
 #endif /* __CONTROL_API_H__ */
\ No newline at end of file
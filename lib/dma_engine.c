@@ -0,0 +1,335 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file dma_engine.c
+ *  @brief Parallel striped DMA engine for device memory access.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include "dma_engine.h"
+#include "onic_ioctl.h"
+
+struct dma_worker_arg_t {
+  struct dma_engine_t* engine;
+  uint32_t idx;
+};
+
+/* Drain stripes of the current job on the worker's own file until none is left. */
+static void dma_engine_do_job(struct dma_engine_t* engine, int fd) {
+  uint64_t chunk;
+  uint64_t offset;
+  uint64_t bytes;
+  ssize_t rc;
+  ssize_t no_error = 0;
+
+  while ((chunk = __atomic_fetch_add(&engine->next_chunk, 1, __ATOMIC_RELAXED)) < engine->num_chunks) {
+    offset = chunk * engine->chunk_size;
+    bytes = engine->size - offset;
+    if (bytes > engine->chunk_size)
+      bytes = engine->chunk_size;
+
+    if (engine->write)
+      rc = write_from_buffer(engine->char_device, fd, engine->buffer + offset,
+                             bytes, engine->dev_offset + offset);
+    else
+      rc = read_to_buffer(engine->char_device, fd, engine->buffer + offset,
+                          bytes, engine->dev_offset + offset);
+
+    if (rc < 0) {
+      __atomic_compare_exchange_n(&engine->error, &no_error, rc, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+      /* Stop handing out the remaining stripes */
+      __atomic_store_n(&engine->next_chunk, engine->num_chunks, __ATOMIC_RELAXED);
+      break;
+    }
+  }
+}
+
+static void* dma_engine_worker(void* arg) {
+  struct dma_worker_arg_t* worker = (struct dma_worker_arg_t*) arg;
+  struct dma_engine_t* engine = worker->engine;
+  uint32_t idx = worker->idx;
+  uint64_t seen = 0;
+  cpu_set_t cpuset;
+  int ret;
+
+  free(worker);
+
+  CPU_ZERO(&cpuset);
+  CPU_SET(engine->cpus[idx], &cpuset);
+  ret = pthread_setaffinity_np(pthread_self(), sizeof(cpu_set_t), &cpuset);
+  if (ret != 0) {
+    fprintf(stderr, "Warning: failed to pin DMA worker %d to CPU %d: %s\n", idx,
+            engine->cpus[idx], strerror(ret));
+  } else {
+    Debug("DMA worker %d pinned to CPU %d\n", idx, engine->cpus[idx]);
+  }
+
+  pthread_mutex_lock(&engine->lock);
+  while (1) {
+    while (!engine->stop && engine->generation == seen)
+      pthread_cond_wait(&engine->start_cond, &engine->lock);
+    if (engine->stop)
+      break;
+    seen = engine->generation;
+    pthread_mutex_unlock(&engine->lock);
+
+    dma_engine_do_job(engine, engine->fds[idx]);
+
+    pthread_mutex_lock(&engine->lock);
+    engine->active--;
+    if (engine->active == 0)
+      pthread_cond_signal(&engine->done_cond);
+  }
+  pthread_mutex_unlock(&engine->lock);
+
+  return NULL;
+}
+
+/* Spread workers over the CPUs of the device's NUMA node, or over the CPUs the
+ * calling thread is allowed to run on if the node is unknown. */
+static int dma_engine_default_cpus(struct dma_engine_t* engine) {
+  int node_cpus[CPU_SETSIZE];
+  cpu_set_t cpuset;
+  int num_cpus;
+  int cpu = -1;
+  uint32_t i;
+
+  num_cpus = get_numa_node_cpus(engine->numa_node, node_cpus, CPU_SETSIZE);
+  if (num_cpus > 0) {
+    for (i = 0; i < engine->num_threads; i++)
+      engine->cpus[i] = node_cpus[i % num_cpus];
+    return 0;
+  }
+
+  if (sched_getaffinity(0, sizeof(cpu_set_t), &cpuset) != 0) {
+    perror("sched_getaffinity");
+    return -1;
+  }
+  num_cpus = CPU_COUNT(&cpuset);
+  if (num_cpus == 0)
+    return -1;
+
+  for (i = 0; i < engine->num_threads; i++) {
+    do {
+      cpu = (cpu + 1) % CPU_SETSIZE;
+    } while (!CPU_ISSET(cpu, &cpuset));
+    engine->cpus[i] = cpu;
+  }
+
+  return 0;
+}
+
+/* Give every worker its own file bound to its own MM queue. */
+static int dma_engine_open_queues(struct dma_engine_t* engine) {
+  int32_t queue;
+  uint32_t i;
+
+  for (i = 0; i < engine->num_threads; i++) {
+    engine->fds[i] = open(engine->char_device, O_RDWR);
+    if (engine->fds[i] < 0) {
+      fprintf(stderr, "Error: failed to open %s for dma_engine worker %d: %s\n",
+              engine->char_device, i, strerror(errno));
+      return -1;
+    }
+
+    queue = i;
+    if (ioctl(engine->fds[i], ONIC_IOC_SET_QUEUE, &queue) < 0 && errno == EINVAL) {
+      /* More workers than MM queues */
+      queue = ONIC_QUEUE_AUTO;
+      ioctl(engine->fds[i], ONIC_IOC_SET_QUEUE, &queue);
+    }
+    if (ioctl(engine->fds[i], ONIC_IOC_GET_QUEUE, &queue) < 0 || queue < 0) {
+      fprintf(stderr, "Error: failed to bind dma_engine worker %d to an MM queue\n", i);
+      return -1;
+    }
+    Debug("DMA worker %d bound to MM queue %d\n", i, queue);
+  }
+
+  return 0;
+}
+
+static void dma_engine_close_queues(struct dma_engine_t* engine) {
+  uint32_t i;
+
+  if (engine->fds == NULL)
+    return;
+
+  for (i = 0; i < engine->num_threads; i++) {
+    if (engine->fds[i] >= 0)
+      close(engine->fds[i]);
+  }
+  free(engine->fds);
+}
+
+struct dma_engine_t* create_dma_engine(char* char_device, int numa_node, uint32_t num_threads,
+                                       uint64_t chunk_size, const int* cpus) {
+  struct dma_engine_t* engine;
+  struct dma_worker_arg_t* worker;
+  uint32_t i;
+  int ret;
+
+  engine = (struct dma_engine_t*) calloc(1, sizeof(struct dma_engine_t));
+  if (engine == NULL) {
+    fprintf(stderr, "Error: failed to allocate dma_engine\n");
+    return NULL;
+  }
+
+  if (num_threads == 0)
+    num_threads = DMA_ENGINE_DEFAULT_THREADS;
+  if (chunk_size == 0)
+    chunk_size = DMA_ENGINE_DEFAULT_CHUNK_SIZE;
+  chunk_size = (chunk_size + DMA_ENGINE_CHUNK_ALIGNMENT - 1) & ~((uint64_t) DMA_ENGINE_CHUNK_ALIGNMENT - 1);
+  if (chunk_size > RW_MAX_SIZE)
+    chunk_size = RW_MAX_SIZE & ~((uint64_t) DMA_ENGINE_CHUNK_ALIGNMENT - 1);
+
+  engine->char_device = char_device;
+  engine->numa_node = numa_node;
+  engine->num_threads = num_threads;
+  engine->chunk_size = chunk_size;
+  pthread_mutex_init(&engine->job_lock, NULL);
+  pthread_mutex_init(&engine->lock, NULL);
+  pthread_cond_init(&engine->start_cond, NULL);
+  pthread_cond_init(&engine->done_cond, NULL);
+
+  engine->threads = (pthread_t*) calloc(num_threads, sizeof(pthread_t));
+  engine->cpus = (int*) calloc(num_threads, sizeof(int));
+  engine->fds = (int*) malloc(num_threads * sizeof(int));
+  if (engine->threads == NULL || engine->cpus == NULL || engine->fds == NULL) {
+    fprintf(stderr, "Error: failed to allocate dma_engine worker pool\n");
+    goto err_free;
+  }
+  for (i = 0; i < num_threads; i++)
+    engine->fds[i] = -1;
+
+  if (dma_engine_open_queues(engine) < 0)
+    goto err_free;
+
+  if (cpus != NULL) {
+    memcpy(engine->cpus, cpus, num_threads * sizeof(int));
+  } else if (dma_engine_default_cpus(engine) < 0) {
+    fprintf(stderr, "Error: failed to select CPUs for dma_engine workers\n");
+    goto err_free;
+  }
+
+  for (i = 0; i < num_threads; i++) {
+    worker = (struct dma_worker_arg_t*) malloc(sizeof(struct dma_worker_arg_t));
+    if (worker == NULL) {
+      fprintf(stderr, "Error: failed to allocate dma_engine worker %d\n", i);
+      goto err_stop;
+    }
+    worker->engine = engine;
+    worker->idx = i;
+    ret = pthread_create(&engine->threads[i], NULL, dma_engine_worker, worker);
+    if (ret != 0) {
+      fprintf(stderr, "Error: failed to create dma_engine worker %d: %s\n", i, strerror(ret));
+      free(worker);
+      goto err_stop;
+    }
+  }
+
+  Debug("Created dma_engine with %d workers, chunk size 0x%lx\n", num_threads, chunk_size);
+  return engine;
+
+err_stop:
+  engine->num_threads = i;
+  for (; i < num_threads; i++)
+    close(engine->fds[i]);
+  destroy_dma_engine(engine);
+  return NULL;
+
+err_free:
+  dma_engine_close_queues(engine);
+  free(engine->threads);
+  free(engine->cpus);
+  pthread_cond_destroy(&engine->done_cond);
+  pthread_cond_destroy(&engine->start_cond);
+  pthread_mutex_destroy(&engine->lock);
+  pthread_mutex_destroy(&engine->job_lock);
+  free(engine);
+  return NULL;
+}
+
+static ssize_t dma_engine_run(struct dma_engine_t* engine, int write, char* buffer, uint64_t size,
+                              uint64_t dev_offset, struct dma_engine_stats_t* stats) {
+  struct timespec ts_start;
+  struct timespec ts_end;
+  uint64_t num_chunks;
+  ssize_t ret;
+
+  num_chunks = (size + engine->chunk_size - 1) / engine->chunk_size;
+  if (num_chunks == 0)
+    num_chunks = 1;
+
+  pthread_mutex_lock(&engine->job_lock);
+  clock_gettime(CLOCK_MONOTONIC, &ts_start);
+
+  pthread_mutex_lock(&engine->lock);
+  engine->write = write;
+  engine->buffer = buffer;
+  engine->size = size;
+  engine->dev_offset = dev_offset;
+  engine->num_chunks = num_chunks;
+  engine->next_chunk = 0;
+  engine->error = 0;
+  engine->active = engine->num_threads;
+  engine->generation++;
+  pthread_cond_broadcast(&engine->start_cond);
+  while (engine->active != 0)
+    pthread_cond_wait(&engine->done_cond, &engine->lock);
+  ret = engine->error;
+  pthread_mutex_unlock(&engine->lock);
+
+  clock_gettime(CLOCK_MONOTONIC, &ts_end);
+  pthread_mutex_unlock(&engine->job_lock);
+
+  timespec_sub(&ts_end, &ts_start);
+  if (stats != NULL) {
+    stats->bytes = (ret < 0) ? 0 : size;
+    stats->num_chunks = num_chunks;
+    stats->elapsed_sec = ts_end.tv_sec + ((double) ts_end.tv_nsec / NSEC_DIV);
+    stats->throughput_gbps = (stats->elapsed_sec > 0) ? (stats->bytes / stats->elapsed_sec) / 1e9 : 0;
+  }
+  Debug("dma_engine %s 0x%lx bytes @ 0x%lx in %ld stripes: %ld.%09ld sec\n", write ? "write" : "read",
+        size, dev_offset, num_chunks, ts_end.tv_sec, ts_end.tv_nsec);
+
+  return (ret < 0) ? ret : (ssize_t) size;
+}
+
+ssize_t dma_engine_read(struct dma_engine_t* engine, char* buffer, uint64_t size,
+                        uint64_t dev_offset, struct dma_engine_stats_t* stats) {
+  return dma_engine_run(engine, 0, buffer, size, dev_offset, stats);
+}
+
+ssize_t dma_engine_write(struct dma_engine_t* engine, char* buffer, uint64_t size,
+                         uint64_t dev_offset, struct dma_engine_stats_t* stats) {
+  return dma_engine_run(engine, 1, buffer, size, dev_offset, stats);
+}
+
+void destroy_dma_engine(struct dma_engine_t* engine) {
+  uint32_t i;
+
+  if (engine == NULL)
+    return;
+
+  pthread_mutex_lock(&engine->lock);
+  engine->stop = 1;
+  pthread_cond_broadcast(&engine->start_cond);
+  pthread_mutex_unlock(&engine->lock);
+
+  for (i = 0; i < engine->num_threads; i++)
+    pthread_join(engine->threads[i], NULL);
+
+  dma_engine_close_queues(engine);
+  free(engine->threads);
+  free(engine->cpus);
+  pthread_cond_destroy(&engine->done_cond);
+  pthread_cond_destroy(&engine->start_cond);
+  pthread_mutex_destroy(&engine->lock);
+  pthread_mutex_destroy(&engine->job_lock);
+  free(engine);
+}
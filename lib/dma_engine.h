@@ -0,0 +1,129 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file dma_engine.h
+ *  @brief Parallel striped DMA engine for device memory access.
+ *
+ *  The character device serves each read/write with one of its memory-mapped
+ *  QDMA queues. The DMA engine splits a large host<->card transfer into chunks
+ *  and drives them concurrently from a small pool of pinned worker threads, so
+ *  that all memory-mapped queues are kept busy by a single caller.
+ *
+ *  Every worker opens its own file of the character device and binds it to
+ *  one MM queue with ONIC_IOC_SET_QUEUE (worker i to queue i, round-robin via
+ *  ONIC_QUEUE_AUTO beyond the number of queues). A bound file is never striped
+ *  by the driver, so chunks at or above its stripe_threshold module parameter
+ *  are submitted as is instead of being split again across all queues, and
+ *  the driver's bind_queue_on_open setting does not make the workers collapse
+ *  onto a single queue.
+ */
+
+#ifndef __DMA_ENGINE_H__
+#define __DMA_ENGINE_H__
+
+#include <pthread.h>
+#include "auxiliary.h"
+#include "memory_api.h"
+#include "numa_api.h"
+
+/*! \def DMA_ENGINE_DEFAULT_THREADS
+    \brief Default number of worker threads.
+
+    Matches QDMA_MM_QUEUE, the number of memory-mapped queues exposed by the onic driver.
+*/
+#define DMA_ENGINE_DEFAULT_THREADS 4
+
+/*! \def DMA_ENGINE_DEFAULT_CHUNK_SIZE
+    \brief Default stripe size in bytes (4MB).
+*/
+#define DMA_ENGINE_DEFAULT_CHUNK_SIZE 0x400000
+
+/*! \def DMA_ENGINE_CHUNK_ALIGNMENT
+    \brief Stripes are rounded up to a multiple of this size (4KB).
+*/
+#define DMA_ENGINE_CHUNK_ALIGNMENT 4096
+
+/*! \struct dma_engine_stats_t
+    \brief Statistics of a striped transfer.
+*/
+struct dma_engine_stats_t {
+  uint64_t bytes;         /*!< bytes Number of bytes transferred. */
+  uint64_t num_chunks;    /*!< num_chunks Number of stripes the transfer was split into. */
+  double elapsed_sec;     /*!< elapsed_sec Wall-clock time of the transfer in seconds. */
+  double throughput_gbps; /*!< throughput_gbps Aggregate throughput in GB/s. */
+};
+
+/*! \struct dma_engine_t
+    \brief Striped DMA engine with its worker thread pool.
+*/
+struct dma_engine_t {
+  char* char_device;          /*!< char_device Name of the character device for memory access. */
+  int numa_node;              /*!< numa_node NUMA node of the device, -1 if unknown. */
+  uint32_t num_threads;       /*!< num_threads Number of worker threads. */
+  uint64_t chunk_size;        /*!< chunk_size Stripe size in bytes. */
+  pthread_t* threads;         /*!< threads Worker threads. */
+  int* cpus;                  /*!< cpus CPU each worker thread is pinned to. */
+  int* fds;                   /*!< fds File of the character device each worker is bound to. */
+  pthread_mutex_t job_lock;   /*!< job_lock Serializes callers sharing the engine. */
+  pthread_mutex_t lock;       /*!< lock Protects the job state below. */
+  pthread_cond_t start_cond;  /*!< start_cond Signalled when a new job is posted. */
+  pthread_cond_t done_cond;   /*!< done_cond Signalled when the last worker finishes a job. */
+  uint64_t generation;        /*!< generation Incremented for every posted job. */
+  uint32_t active;            /*!< active Number of workers still busy with the current job. */
+  int stop;                   /*!< stop Set when the engine is destroyed. */
+  int write;                  /*!< write Direction of the current job: 1 - host to card. */
+  char* buffer;               /*!< buffer Host buffer of the current job. */
+  uint64_t size;              /*!< size Size of the current job in bytes. */
+  uint64_t dev_offset;        /*!< dev_offset Device memory offset of the current job. */
+  uint64_t num_chunks;        /*!< num_chunks Number of stripes in the current job. */
+  uint64_t next_chunk;        /*!< next_chunk Next stripe to be claimed by a worker. */
+  ssize_t error;              /*!< error First error reported by a worker, 0 if none. */
+};
+
+/** @brief Create a striped DMA engine.
+ *  @param char_device Name of the character device used to interact with the FPGA
+ *                     for memory access.
+ *  @param numa_node NUMA node the device is attached to (see get_pcie_numa_node()),
+ *                   or -1 if unknown.
+ *  @param num_threads Number of worker threads, 0 selects DMA_ENGINE_DEFAULT_THREADS.
+ *  @param chunk_size Stripe size in bytes, 0 selects DMA_ENGINE_DEFAULT_CHUNK_SIZE.
+ *  @param cpus CPUs to pin the worker threads to (num_threads entries), or NULL to
+ *              spread them over the CPUs of numa_node, falling back to the CPUs the
+ *              calling thread may run on if the node is unknown.
+ *  @return a pointer to the DMA engine, or NULL on failure.
+ */
+struct dma_engine_t* create_dma_engine(char* char_device, int numa_node, uint32_t num_threads,
+                                       uint64_t chunk_size, const int* cpus);
+
+/** @brief Read device memory into a host buffer using all worker threads.
+ *  @param engine A striped DMA engine.
+ *  @param buffer a destination host buffer used to store data.
+ *  @param size size of data.
+ *  @param dev_offset a source address offset of the device memory.
+ *  @param stats Transfer statistics, filled in if not NULL.
+ *  @return Return size of data read successfully, or a negative errno.
+ */
+ssize_t dma_engine_read(struct dma_engine_t* engine, char* buffer, uint64_t size,
+                        uint64_t dev_offset, struct dma_engine_stats_t* stats);
+
+/** @brief Write a host buffer to device memory using all worker threads.
+ *  @param engine A striped DMA engine.
+ *  @param buffer a source buffer located at the host side.
+ *  @param size size of data.
+ *  @param dev_offset a destination address offset of the device memory.
+ *  @param stats Transfer statistics, filled in if not NULL.
+ *  @return Return size of data written successfully, or a negative errno.
+ */
+ssize_t dma_engine_write(struct dma_engine_t* engine, char* buffer, uint64_t size,
+                         uint64_t dev_offset, struct dma_engine_stats_t* stats);
+
+/** @brief Stop the worker threads and free a striped DMA engine.
+ *  @param engine A striped DMA engine.
+ *  @return void.
+ */
+void destroy_dma_engine(struct dma_engine_t* engine);
+
+#endif /* __DMA_ENGINE_H__ */
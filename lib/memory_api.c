@@ -14,6 +14,10 @@
  */
 
 #include "memory_api.h"
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <sys/ioctl.h>
+#include "onic_ioctl.h"
 
 ssize_t read_to_buffer(char *char_device, int fd, char *buffer, uint64_t size,
 			uint64_t dev_offset)
@@ -29,24 +33,8 @@ ssize_t read_to_buffer(char *char_device, int fd, char *buffer, uint64_t size,
 		if (bytes > RW_MAX_SIZE)
 			bytes = RW_MAX_SIZE;
 
-    rc = lseek(fd, offset, SEEK_SET);
-    if (rc < 0) {
-      fprintf(stderr,
-        "%s, seek off 0x%lx failed %zd.\n",
-        char_device, offset, rc);
-      perror("seek file");
-      return -EIO;
-    }
-    if (rc != offset) {
-      fprintf(stderr,
-        "%s, seek off 0x%lx != 0x%lx.\n",
-        char_device, rc, offset);
-      return -EIO;
-    }
-		
-
-		/* read data from file into memory buffer */
-		rc = read(fd, buf, bytes);
+		/* read data from file into memory buffer at the given offset */
+		rc = pread(fd, buf, bytes, offset);
 		if (rc < 0) {
 			fprintf(stderr,
 				"%s, read off 0x%lx + 0x%lx failed %zd.\n",
@@ -88,23 +76,8 @@ ssize_t write_from_buffer(char *char_device, int fd, char *buffer, uint64_t size
 		if (bytes > RW_MAX_SIZE)
 			bytes = RW_MAX_SIZE;
 
-    rc = lseek(fd, offset, SEEK_SET);
-    if (rc < 0) {
-      fprintf(stderr,
-        "%s, seek off 0x%lx failed %zd.\n",
-        char_device, offset, rc);
-      perror("seek file");
-      return -EIO;
-    }
-    if (rc != offset) {
-      fprintf(stderr,
-        "%s, seek off 0x%lx != 0x%lx.\n",
-        char_device, rc, offset);
-      return -EIO;
-    }
-
-		/* write data to file from memory buffer */
-		rc = write(fd, buf, bytes);
+		/* write data to file from memory buffer at the given offset */
+		rc = pwrite(fd, buf, bytes, offset);
 		if (rc < 0) {
 			fprintf(stderr, "%s, W off 0x%lx, 0x%lx failed %zd.\n",
 				char_device, offset, bytes, rc);
@@ -128,4 +101,550 @@ ssize_t write_from_buffer(char *char_device, int fd, char *buffer, uint64_t size
 		return -EIO;
 	}
 	return count;
-}
\ No newline at end of file
+}
+
+static ssize_t rw_iovec(char *char_device, int fd, const struct iovec *iov,
+			int iovcnt, uint64_t dev_offset, int write)
+{
+	ssize_t rc;
+	uint64_t size = 0;
+	uint64_t count = 0;
+	int idx = 0;
+	int i;
+	struct iovec *vec;
+	off_t offset = dev_offset & DEVICE_MEMORY_ADDRESS_MASK;
+
+	if (iovcnt <= 0)
+		return 0;
+
+	/* Work on a copy so that partially completed entries can be trimmed */
+	vec = (struct iovec *) malloc(iovcnt * sizeof(struct iovec));
+	if (vec == NULL) {
+		fprintf(stderr, "%s, failed to allocate %d iovec entries.\n",
+			char_device, iovcnt);
+		return -ENOMEM;
+	}
+	memcpy(vec, iov, iovcnt * sizeof(struct iovec));
+
+	for (i = 0; i < iovcnt; i++)
+		size += vec[i].iov_len;
+
+	while (idx < iovcnt) {
+		int cnt = iovcnt - idx;
+
+		if (cnt > UIO_MAXIOV)
+			cnt = UIO_MAXIOV;
+
+		if (write)
+			rc = pwritev(fd, &vec[idx], cnt, offset);
+		else
+			rc = preadv(fd, &vec[idx], cnt, offset);
+		if (rc < 0) {
+			fprintf(stderr, "%s, %c off 0x%lx, %d segments failed %zd.\n",
+				char_device, write ? 'W' : 'R', offset, cnt, rc);
+			perror(write ? "pwritev file" : "preadv file");
+			free(vec);
+			return -EIO;
+		}
+		if (rc == 0 && count < size) {
+			fprintf(stderr, "%s, %c off 0x%lx, no progress at 0x%lx/0x%lx.\n",
+				char_device, write ? 'W' : 'R', offset, count, size);
+			free(vec);
+			return -EIO;
+		}
+
+		count += rc;
+		offset += rc;
+
+		/* Skip fully transferred segments and trim a partial one */
+		while (idx < iovcnt && (size_t) rc >= vec[idx].iov_len) {
+			rc -= vec[idx].iov_len;
+			idx++;
+		}
+		if (rc > 0) {
+			vec[idx].iov_base = (char *) vec[idx].iov_base + rc;
+			vec[idx].iov_len -= rc;
+		}
+	}
+
+	free(vec);
+
+	if (count != size) {
+		fprintf(stderr, "%s, %c failed 0x%lx != 0x%lx.\n",
+				char_device, write ? 'W' : 'R', count, size);
+		return -EIO;
+	}
+	return count;
+}
+
+ssize_t read_to_iovec(char *char_device, int fd, const struct iovec *iov,
+			int iovcnt, uint64_t dev_offset)
+{
+	return rw_iovec(char_device, fd, iov, iovcnt, dev_offset, 0);
+}
+
+ssize_t write_from_iovec(char *char_device, int fd, const struct iovec *iov,
+			int iovcnt, uint64_t dev_offset)
+{
+	return rw_iovec(char_device, fd, iov, iovcnt, dev_offset, 1);
+}
+
+static int sys_io_uring_setup(uint32_t entries, struct io_uring_params *p)
+{
+	return (int) syscall(__NR_io_uring_setup, entries, p);
+}
+
+static int sys_io_uring_enter(int ring_fd, uint32_t to_submit,
+			uint32_t min_complete, uint32_t flags)
+{
+	return (int) syscall(__NR_io_uring_enter, ring_fd, to_submit,
+			min_complete, flags, NULL, 0);
+}
+
+struct mem_async_ctx_t* create_mem_async_ctx(int fd, uint32_t depth)
+{
+	struct mem_async_ctx_t *ctx;
+	struct io_uring_params params;
+
+	if (depth == 0) {
+		fprintf(stderr, "Error: mem_async depth must be non-zero\n");
+		return NULL;
+	}
+
+	ctx = (struct mem_async_ctx_t *) calloc(1, sizeof(struct mem_async_ctx_t));
+	if (ctx == NULL) {
+		fprintf(stderr, "Error: failed to allocate mem_async_ctx\n");
+		return NULL;
+	}
+	ctx->fd = fd;
+	ctx->ring_fd = -1;
+	ctx->sq_ring = MAP_FAILED;
+	ctx->cq_ring = MAP_FAILED;
+	ctx->sqes = MAP_FAILED;
+
+	memset(&params, 0, sizeof(params));
+	ctx->ring_fd = sys_io_uring_setup(depth, &params);
+	if (ctx->ring_fd < 0) {
+		perror("io_uring_setup");
+		goto err_out;
+	}
+
+	ctx->depth = params.sq_entries;
+	ctx->sq_ring_size = params.sq_off.array + params.sq_entries * sizeof(uint32_t);
+	ctx->cq_ring_size = params.cq_off.cqes +
+			params.cq_entries * sizeof(struct io_uring_cqe);
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		if (ctx->cq_ring_size > ctx->sq_ring_size)
+			ctx->sq_ring_size = ctx->cq_ring_size;
+		ctx->cq_ring_size = ctx->sq_ring_size;
+	}
+
+	ctx->sq_ring = mmap(NULL, ctx->sq_ring_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_SQ_RING);
+	if (ctx->sq_ring == MAP_FAILED) {
+		perror("mmap io_uring sq ring");
+		goto err_out;
+	}
+
+	if (params.features & IORING_FEAT_SINGLE_MMAP) {
+		ctx->cq_ring = ctx->sq_ring;
+	} else {
+		ctx->cq_ring = mmap(NULL, ctx->cq_ring_size, PROT_READ | PROT_WRITE,
+				MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_CQ_RING);
+		if (ctx->cq_ring == MAP_FAILED) {
+			perror("mmap io_uring cq ring");
+			goto err_out;
+		}
+	}
+
+	ctx->sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+	ctx->sqes = mmap(NULL, ctx->sqes_size, PROT_READ | PROT_WRITE,
+			MAP_SHARED | MAP_POPULATE, ctx->ring_fd, IORING_OFF_SQES);
+	if (ctx->sqes == MAP_FAILED) {
+		perror("mmap io_uring sqes");
+		goto err_out;
+	}
+
+	ctx->sq_head  = (uint32_t *) ((char *) ctx->sq_ring + params.sq_off.head);
+	ctx->sq_tail  = (uint32_t *) ((char *) ctx->sq_ring + params.sq_off.tail);
+	ctx->sq_mask  = (uint32_t *) ((char *) ctx->sq_ring + params.sq_off.ring_mask);
+	ctx->sq_array = (uint32_t *) ((char *) ctx->sq_ring + params.sq_off.array);
+	ctx->cq_head  = (uint32_t *) ((char *) ctx->cq_ring + params.cq_off.head);
+	ctx->cq_tail  = (uint32_t *) ((char *) ctx->cq_ring + params.cq_off.tail);
+	ctx->cq_mask  = (uint32_t *) ((char *) ctx->cq_ring + params.cq_off.ring_mask);
+	ctx->cqes     = (char *) ctx->cq_ring + params.cq_off.cqes;
+
+	Debug("Info: mem_async ring created, fd=%d, sq_entries=%u, cq_entries=%u\n",
+		ctx->ring_fd, params.sq_entries, params.cq_entries);
+	return ctx;
+
+err_out:
+	destroy_mem_async_ctx(ctx);
+	return NULL;
+}
+
+static int mem_async_prep(struct mem_async_ctx_t *ctx, uint8_t opcode, char *buffer,
+			uint64_t size, uint64_t dev_offset, uint64_t user_data)
+{
+	uint32_t tail;
+	uint32_t idx;
+	struct io_uring_sqe *sqe;
+
+	if (size > RW_MAX_SIZE) {
+		fprintf(stderr, "Error: async transfer 0x%lx exceeds RW_MAX_SIZE\n", size);
+		return -EINVAL;
+	}
+
+	/* Keep completions bounded by the ring depth so the CQ never overflows */
+	if (ctx->inflight >= ctx->depth)
+		return -EAGAIN;
+
+	tail = *ctx->sq_tail;
+	idx = tail & *ctx->sq_mask;
+	sqe = &((struct io_uring_sqe *) ctx->sqes)[idx];
+
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqe->opcode = opcode;
+	sqe->fd = ctx->fd;
+	sqe->addr = (uint64_t) (uintptr_t) buffer;
+	sqe->len = (uint32_t) size;
+	sqe->off = dev_offset & DEVICE_MEMORY_ADDRESS_MASK;
+	sqe->user_data = user_data;
+
+	ctx->sq_array[idx] = idx;
+	__atomic_store_n(ctx->sq_tail, tail + 1, __ATOMIC_RELEASE);
+
+	ctx->queued++;
+	ctx->inflight++;
+	return 0;
+}
+
+int async_read_to_buffer(struct mem_async_ctx_t *ctx, char *buffer, uint64_t size,
+			uint64_t dev_offset, uint64_t user_data)
+{
+	return mem_async_prep(ctx, IORING_OP_READ, buffer, size, dev_offset, user_data);
+}
+
+int async_write_from_buffer(struct mem_async_ctx_t *ctx, char *buffer, uint64_t size,
+			uint64_t dev_offset, uint64_t user_data)
+{
+	return mem_async_prep(ctx, IORING_OP_WRITE, buffer, size, dev_offset, user_data);
+}
+
+int submit_mem_async(struct mem_async_ctx_t *ctx)
+{
+	int rc;
+	int submitted = 0;
+
+	while (ctx->queued) {
+		rc = sys_io_uring_enter(ctx->ring_fd, ctx->queued, 0, 0);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("io_uring_enter submit");
+			return -errno;
+		}
+		ctx->queued -= rc;
+		submitted += rc;
+	}
+
+	return submitted;
+}
+
+int reap_mem_async(struct mem_async_ctx_t *ctx, struct mem_async_cmpl_t *cmpl,
+			uint32_t max_cmpl, uint32_t min_cmpl)
+{
+	int rc;
+	uint32_t head;
+	uint32_t tail;
+	uint32_t reaped = 0;
+	struct io_uring_cqe *cqe;
+
+	if (min_cmpl > ctx->inflight)
+		min_cmpl = ctx->inflight;
+	if (min_cmpl > max_cmpl)
+		min_cmpl = max_cmpl;
+
+	while (reaped < max_cmpl) {
+		head = *ctx->cq_head;
+		tail = __atomic_load_n(ctx->cq_tail, __ATOMIC_ACQUIRE);
+		while (head != tail && reaped < max_cmpl) {
+			cqe = &((struct io_uring_cqe *) ctx->cqes)[head & *ctx->cq_mask];
+			cmpl[reaped].user_data = cqe->user_data;
+			cmpl[reaped].res = cqe->res;
+			reaped++;
+			head++;
+		}
+		__atomic_store_n(ctx->cq_head, head, __ATOMIC_RELEASE);
+
+		if (reaped >= min_cmpl)
+			break;
+
+		/* Flush anything still queued and wait for the remainder */
+		rc = sys_io_uring_enter(ctx->ring_fd, ctx->queued, min_cmpl - reaped,
+				IORING_ENTER_GETEVENTS);
+		if (rc < 0) {
+			if (errno == EINTR)
+				continue;
+			perror("io_uring_enter wait");
+			ctx->inflight -= reaped;
+			return reaped ? (int) reaped : -errno;
+		}
+		ctx->queued -= rc;
+	}
+
+	ctx->inflight -= reaped;
+	return reaped;
+}
+
+void destroy_mem_async_ctx(struct mem_async_ctx_t *ctx)
+{
+	if (ctx == NULL)
+		return;
+
+	if (ctx->sqes != MAP_FAILED)
+		munmap(ctx->sqes, ctx->sqes_size);
+	if (ctx->cq_ring != MAP_FAILED && ctx->cq_ring != ctx->sq_ring)
+		munmap(ctx->cq_ring, ctx->cq_ring_size);
+	if (ctx->sq_ring != MAP_FAILED)
+		munmap(ctx->sq_ring, ctx->sq_ring_size);
+	if (ctx->ring_fd >= 0)
+		close(ctx->ring_fd);
+	free(ctx);
+}
+
+static ssize_t rw_sg_list(char *char_device, int fd, const struct mem_sg_entry_t *sg,
+			  int count, int write)
+{
+	struct onic_ioc_sg_entry *entries;
+	struct onic_ioc_sg_rw req;
+	uint64_t size;
+	ssize_t total = 0;
+	int rc;
+	int idx = 0;
+	int i;
+
+	if (count <= 0)
+		return 0;
+
+	entries = (struct onic_ioc_sg_entry *) malloc(ONIC_SG_RW_MAX_ENTRIES *
+						      sizeof(struct onic_ioc_sg_entry));
+	if (entries == NULL) {
+		fprintf(stderr, "%s, failed to allocate scatter list.\n", char_device);
+		return -ENOMEM;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.entries = (uint64_t) (uintptr_t) entries;
+	req.write = write;
+	while (idx < count) {
+		int cnt = count - idx;
+
+		if (cnt > ONIC_SG_RW_MAX_ENTRIES)
+			cnt = ONIC_SG_RW_MAX_ENTRIES;
+
+		/* The ioctl returns the byte count of a batch as an int */
+		size = 0;
+		for (i = 0; i < cnt; i++) {
+			if (i && size + sg[idx + i].size > RW_MAX_SIZE) {
+				cnt = i;
+				break;
+			}
+			entries[i].addr = (uint64_t) (uintptr_t) sg[idx + i].buffer;
+			entries[i].dev_addr = sg[idx + i].dev_offset & DEVICE_MEMORY_ADDRESS_MASK;
+			entries[i].len = sg[idx + i].size;
+			size += sg[idx + i].size;
+		}
+		req.count = cnt;
+
+		rc = ioctl(fd, ONIC_IOC_SG_RW, &req);
+		if (rc < 0) {
+			fprintf(stderr, "%s, %c %d entries failed: %s\n", char_device,
+				write ? 'W' : 'R', cnt, strerror(errno));
+			free(entries);
+			return -errno;
+		}
+		if (rc != size) {
+			fprintf(stderr, "%s, %c %d entries, 0x%x != 0x%lx.\n", char_device,
+				write ? 'W' : 'R', cnt, rc, size);
+			free(entries);
+			return -EIO;
+		}
+
+		total += size;
+		idx += cnt;
+	}
+
+	free(entries);
+	return total;
+}
+
+ssize_t read_to_sg_list(char *char_device, int fd, const struct mem_sg_entry_t *sg, int count)
+{
+	return rw_sg_list(char_device, fd, sg, count, 0);
+}
+
+ssize_t write_from_sg_list(char *char_device, int fd, const struct mem_sg_entry_t *sg, int count)
+{
+	return rw_sg_list(char_device, fd, sg, count, 1);
+}
+
+int set_mem_aperture(int fd, uint32_t aperture_size)
+{
+	if (ioctl(fd, ONIC_IOC_SET_APERTURE, &aperture_size) < 0) {
+		perror("ioctl ONIC_IOC_SET_APERTURE");
+		return -1;
+	}
+	return 0;
+}
+
+ssize_t write_to_keyhole(char *char_device, int fd, char *buffer, uint64_t size,
+			 uint64_t dev_offset, uint32_t aperture_size)
+{
+	ssize_t rc;
+	ssize_t ret = 0;
+	uint64_t count = 0;
+	uint64_t max_bytes;
+	char *buf = buffer;
+	off_t offset = dev_offset & DEVICE_MEMORY_ADDRESS_MASK;
+
+	if (aperture_size == 0 || aperture_size > RW_MAX_SIZE)
+		return -EINVAL;
+	if (set_mem_aperture(fd, aperture_size) < 0)
+		return -EINVAL;
+
+	/*
+	 * Every chunk restarts at the beginning of the aperture, so split the
+	 * buffer at multiples of the aperture only
+	 */
+	max_bytes = RW_MAX_SIZE - (RW_MAX_SIZE % aperture_size);
+
+	do {
+		uint64_t bytes = size - count;
+
+		if (bytes > max_bytes)
+			bytes = max_bytes;
+
+		rc = pwrite(fd, buf, bytes, offset);
+		if (rc != bytes) {
+			fprintf(stderr, "%s, keyhole W off 0x%lx, 0x%lx failed %zd.\n",
+				char_device, offset, bytes, rc);
+			if (rc < 0)
+				perror("write file");
+			ret = -EIO;
+			break;
+		}
+
+		count += bytes;
+		buf += bytes;
+	} while (count < size);
+
+	set_mem_aperture(fd, 0);
+	return ret < 0 ? ret : count;
+}
+
+struct mem_dma_buf_t *alloc_mem_dma_buf(int fd, uint64_t size)
+{
+	struct mem_dma_buf_t *dma_buf;
+	struct onic_ioc_dma_buf req;
+
+	dma_buf = (struct mem_dma_buf_t *) calloc(1, sizeof(struct mem_dma_buf_t));
+	if (dma_buf == NULL) {
+		fprintf(stderr, "Error: failed to allocate mem_dma_buf\n");
+		return NULL;
+	}
+
+	memset(&req, 0, sizeof(req));
+	req.size = size;
+	if (ioctl(fd, ONIC_IOC_ALLOC_DMA_BUF, &req) < 0) {
+		perror("ioctl ONIC_IOC_ALLOC_DMA_BUF");
+		free(dma_buf);
+		return NULL;
+	}
+
+	/* The driver rounds the buffer up to whole pages */
+	size = (size + getpagesize() - 1) & ~((uint64_t) getpagesize() - 1);
+	dma_buf->buffer = (char *) mmap(NULL, size, PROT_READ | PROT_WRITE,
+					MAP_SHARED, fd, req.mmap_offset);
+	if (dma_buf->buffer == MAP_FAILED) {
+		perror("mmap DMA buffer");
+		ioctl(fd, ONIC_IOC_UNREG_BUF, &req.handle);
+		free(dma_buf);
+		return NULL;
+	}
+
+	dma_buf->fd = fd;
+	dma_buf->handle = req.handle;
+	dma_buf->size = size;
+	dma_buf->bus_addr = req.bus_addr;
+	Debug("DMA buffer %u: %p, 0x%lx bytes, bus address 0x%lx\n", dma_buf->handle,
+	      dma_buf->buffer, dma_buf->size, dma_buf->bus_addr);
+
+	return dma_buf;
+}
+
+static ssize_t mem_dma_buf_rw(struct mem_dma_buf_t *dma_buf, uint64_t buf_offset,
+			      uint64_t size, uint64_t dev_offset, int write)
+{
+	struct onic_ioc_buf_rw req;
+	uint64_t count = 0;
+	int rc;
+
+	if (buf_offset > dma_buf->size || size > dma_buf->size - buf_offset)
+		return -EINVAL;
+
+	memset(&req, 0, sizeof(req));
+	req.handle = dma_buf->handle;
+	req.write = write;
+	do { /* Support zero byte transfer */
+		uint64_t bytes = size - count;
+
+		if (bytes > RW_MAX_SIZE)
+			bytes = RW_MAX_SIZE;
+
+		req.offset = buf_offset + count;
+		req.len = bytes;
+		req.dev_addr = (dev_offset + count) & DEVICE_MEMORY_ADDRESS_MASK;
+		rc = ioctl(dma_buf->fd, ONIC_IOC_BUF_RW, &req);
+		if (rc < 0) {
+			fprintf(stderr, "DMA buffer %u, %c off 0x%llx, 0x%lx failed: %s\n",
+				dma_buf->handle, write ? 'W' : 'R', req.dev_addr,
+				bytes, strerror(errno));
+			return -errno;
+		}
+		if (rc != bytes) {
+			fprintf(stderr, "DMA buffer %u, %c off 0x%llx, 0x%x != 0x%lx.\n",
+				dma_buf->handle, write ? 'W' : 'R', req.dev_addr,
+				rc, bytes);
+			return -EIO;
+		}
+
+		count += bytes;
+	} while (count < size);
+
+	return count;
+}
+
+ssize_t read_to_mem_dma_buf(struct mem_dma_buf_t *dma_buf, uint64_t buf_offset,
+			    uint64_t size, uint64_t dev_offset)
+{
+	return mem_dma_buf_rw(dma_buf, buf_offset, size, dev_offset, 0);
+}
+
+ssize_t write_from_mem_dma_buf(struct mem_dma_buf_t *dma_buf, uint64_t buf_offset,
+			       uint64_t size, uint64_t dev_offset)
+{
+	return mem_dma_buf_rw(dma_buf, buf_offset, size, dev_offset, 1);
+}
+
+void free_mem_dma_buf(struct mem_dma_buf_t *dma_buf)
+{
+	if (dma_buf == NULL)
+		return;
+
+	/* The mapping keeps the driver buffer alive until it is unmapped */
+	munmap(dma_buf->buffer, dma_buf->size);
+	if (ioctl(dma_buf->fd, ONIC_IOC_UNREG_BUF, &dma_buf->handle) < 0)
+		perror("ioctl ONIC_IOC_UNREG_BUF");
+	free(dma_buf);
+}
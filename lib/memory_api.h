@@ -16,6 +16,7 @@
 #define __MEMORY_API_H__
 
 #include "auxiliary.h"
+#include <sys/uio.h>
 
 /*! \def DEVICE_MEMORY_ADDRESS_MASK
     \brief Device memory address mask.
@@ -31,6 +32,66 @@
 */
 #define RW_MAX_SIZE	0x7ffff000
 
+/*! \struct mem_async_ctx_t
+    \brief Asynchronous device memory access context backed by an io_uring instance.
+
+    Requests are queued with async_read_to_buffer()/async_write_from_buffer(), pushed to
+    the kernel in one syscall by submit_mem_async() and reaped in batches by
+    reap_mem_async(). At most depth requests can be outstanding at a time.
+*/
+struct mem_async_ctx_t {
+  int fd;                /*!< fd File descriptor of the character device for memory access. */
+  int ring_fd;           /*!< ring_fd File descriptor of the io_uring instance. */
+  uint32_t depth;        /*!< depth Maximum number of outstanding requests. */
+  uint32_t queued;       /*!< queued Requests prepared but not yet submitted. */
+  uint32_t inflight;     /*!< inflight Requests prepared or submitted but not yet reaped. */
+  uint32_t* sq_head;     /*!< sq_head Submission queue head index. */
+  uint32_t* sq_tail;     /*!< sq_tail Submission queue tail index. */
+  uint32_t* sq_mask;     /*!< sq_mask Submission queue ring mask. */
+  uint32_t* sq_array;    /*!< sq_array Submission queue index array. */
+  void* sqes;            /*!< sqes Submission queue entries. */
+  uint32_t* cq_head;     /*!< cq_head Completion queue head index. */
+  uint32_t* cq_tail;     /*!< cq_tail Completion queue tail index. */
+  uint32_t* cq_mask;     /*!< cq_mask Completion queue ring mask. */
+  void* cqes;            /*!< cqes Completion queue entries. */
+  void* sq_ring;         /*!< sq_ring Mapped submission queue ring. */
+  void* cq_ring;         /*!< cq_ring Mapped completion queue ring. */
+  size_t sq_ring_size;   /*!< sq_ring_size Size of the mapped submission queue ring. */
+  size_t cq_ring_size;   /*!< cq_ring_size Size of the mapped completion queue ring. */
+  size_t sqes_size;      /*!< sqes_size Size of the mapped submission queue entries. */
+};
+
+/*! \struct mem_sg_entry_t
+    \brief Entry of a scatter list moved between host buffers and device memory.
+*/
+struct mem_sg_entry_t {
+  char* buffer;        /*!< buffer Host buffer. */
+  uint64_t dev_offset; /*!< dev_offset Address offset of the device memory. */
+  uint64_t size;       /*!< size Size of data, at most RW_MAX_SIZE. */
+};
+
+/*! \struct mem_dma_buf_t
+    \brief DMA buffer allocated by the reconic-mm driver and mapped into user space.
+
+    The buffer is contiguous on the bus, so bus_addr can be handed to the card directly,
+    without pinning the buffer or reading /proc/self/pagemap.
+*/
+struct mem_dma_buf_t {
+  int fd;            /*!< fd File descriptor of the character device the buffer belongs to. */
+  uint32_t handle;   /*!< handle Driver handle of the buffer. */
+  char* buffer;      /*!< buffer Virtual address of the buffer. */
+  uint64_t size;     /*!< size Size of the buffer in bytes. */
+  uint64_t bus_addr; /*!< bus_addr Bus address of the buffer. */
+};
+
+/*! \struct mem_async_cmpl_t
+    \brief Completion of an asynchronous device memory request.
+*/
+struct mem_async_cmpl_t {
+  uint64_t user_data; /*!< user_data Tag given when the request was queued. */
+  int32_t res;        /*!< res Bytes transferred, or a negative errno on failure. */
+};
+
 /** @brief A function used to read data from the device memory to the host buffer.
  *  @param char_device Name of the character device used to interact with the FPGA 
  *                     for memory access.
@@ -53,4 +114,173 @@ ssize_t read_to_buffer(char *char_device, int fd, char *buffer, uint64_t size, u
  */
 ssize_t write_from_buffer(char *char_device, int fd, char *buffer, uint64_t size, uint64_t base);
 
-#endif /* __MEMORY_API_H__ */
\ No newline at end of file
+/** @brief A function used to read a contiguous device memory region into a gather list
+ *         of host buffers.
+ *  @param char_device Name of the character device used to interact with the FPGA 
+ *                     for memory access.
+ *  @param fd File descriptor of the char_device.
+ *  @param iov host buffers filled in order.
+ *  @param iovcnt number of entries in iov.
+ *  @param dev_offset a source address offset of the device memory.
+ *  @return Return size of data read successfully.
+ */
+ssize_t read_to_iovec(char *char_device, int fd, const struct iovec *iov, int iovcnt,
+                      uint64_t dev_offset);
+
+/** @brief A function used to write a gather list of host buffers to a contiguous device
+ *         memory region.
+ *  @param char_device Name of the character device used to interact with the FPGA 
+ *                     for memory access.
+ *  @param fd File descriptor of the char_device.
+ *  @param iov host buffers written in order.
+ *  @param iovcnt number of entries in iov.
+ *  @param dev_offset a destination address offset of the device memory.
+ *  @return Return size of data written successfully.
+ */
+ssize_t write_from_iovec(char *char_device, int fd, const struct iovec *iov, int iovcnt,
+                         uint64_t dev_offset);
+
+/** @brief A function used to read scattered device memory regions into host buffers.
+ *
+ *  Each batch of entries is moved with one ioctl and one queue submission.
+ *  @param char_device Name of the character device used to interact with the FPGA 
+ *                     for memory access.
+ *  @param fd File descriptor of the char_device.
+ *  @param sg scatter list of {host buffer, device offset, size} entries.
+ *  @param count number of entries in sg.
+ *  @return Return size of data read successfully, or a negative errno.
+ */
+ssize_t read_to_sg_list(char *char_device, int fd, const struct mem_sg_entry_t *sg, int count);
+
+/** @brief A function used to write host buffers to scattered device memory regions.
+ *
+ *  Each batch of entries is moved with one ioctl and one queue submission.
+ *  @param char_device Name of the character device used to interact with the FPGA 
+ *                     for memory access.
+ *  @param fd File descriptor of the char_device.
+ *  @param sg scatter list of {host buffer, device offset, size} entries.
+ *  @param count number of entries in sg.
+ *  @return Return size of data written successfully, or a negative errno.
+ */
+ssize_t write_from_sg_list(char *char_device, int fd, const struct mem_sg_entry_t *sg, int count);
+
+/** @brief Set the keyhole aperture of transfers issued through a file descriptor.
+ *
+ *  With an aperture set, the device address of a transfer wraps within
+ *  [dev_offset, dev_offset + aperture_size), e.g., to stream into an AXI FIFO.
+ *  @param fd File descriptor of the character device for memory access.
+ *  @param aperture_size aperture in bytes, a power of 2, or 0 for linear transfers.
+ *  @return Return 0 on success, or -1 on failure.
+ */
+int set_mem_aperture(int fd, uint32_t aperture_size);
+
+/** @brief Stream data from a memory buffer into a keyhole aperture of the device memory.
+ *
+ *  The aperture of fd is restored to linear transfers on return.
+ *  @param char_device Character device name for memory access.
+ *  @param fd File descriptor of the char_device.
+ *  @param buffer A memory buffer used to store data.
+ *  @param size size of data.
+ *  @param dev_offset address offset of the aperture in the device memory.
+ *  @param aperture_size aperture in bytes, a power of 2.
+ *  @return Return size of data written successfully, or a negative errno.
+ */
+ssize_t write_to_keyhole(char *char_device, int fd, char *buffer, uint64_t size,
+                         uint64_t dev_offset, uint32_t aperture_size);
+
+/** @brief Create an asynchronous device memory access context.
+ *  @param fd File descriptor of the character device for memory access.
+ *  @param depth Maximum number of outstanding requests (rounded up to a power of 2).
+ *  @return a pointer to the context, or NULL if io_uring is unavailable.
+ */
+struct mem_async_ctx_t* create_mem_async_ctx(int fd, uint32_t depth);
+
+/** @brief Queue an asynchronous read from the device memory to a host buffer.
+ *  @param ctx An asynchronous memory access context.
+ *  @param buffer a destination host buffer used to store data.
+ *  @param size size of data, at most RW_MAX_SIZE.
+ *  @param dev_offset a source address offset of the device memory.
+ *  @param user_data tag reported back in the completion.
+ *  @return 0 on success, -EAGAIN if depth requests are outstanding, or -EINVAL.
+ */
+int async_read_to_buffer(struct mem_async_ctx_t* ctx, char *buffer, uint64_t size,
+                         uint64_t dev_offset, uint64_t user_data);
+
+/** @brief Queue an asynchronous write from a host buffer to the device memory.
+ *  @param ctx An asynchronous memory access context.
+ *  @param buffer a source buffer located at the host side.
+ *  @param size size of data, at most RW_MAX_SIZE.
+ *  @param dev_offset a destination address offset of the device memory.
+ *  @param user_data tag reported back in the completion.
+ *  @return 0 on success, -EAGAIN if depth requests are outstanding, or -EINVAL.
+ */
+int async_write_from_buffer(struct mem_async_ctx_t* ctx, char *buffer, uint64_t size,
+                            uint64_t dev_offset, uint64_t user_data);
+
+/** @brief Submit all queued asynchronous requests with a single syscall.
+ *  @param ctx An asynchronous memory access context.
+ *  @return number of requests submitted, or a negative errno.
+ */
+int submit_mem_async(struct mem_async_ctx_t* ctx);
+
+/** @brief Reap a batch of completed asynchronous requests.
+ *
+ *  Queued requests that were not submitted yet are flushed while waiting.
+ *  @param ctx An asynchronous memory access context.
+ *  @param cmpl array receiving the completions.
+ *  @param max_cmpl capacity of cmpl.
+ *  @param min_cmpl number of completions to wait for; 0 polls without blocking.
+ *  @return number of completions stored in cmpl, or a negative errno.
+ */
+int reap_mem_async(struct mem_async_ctx_t* ctx, struct mem_async_cmpl_t* cmpl,
+                   uint32_t max_cmpl, uint32_t min_cmpl);
+
+/** @brief Destroy an asynchronous device memory access context.
+ *
+ *  Outstanding requests should be reaped before the context is destroyed.
+ *  @param ctx An asynchronous memory access context.
+ *  @return void.
+ */
+void destroy_mem_async_ctx(struct mem_async_ctx_t* ctx);
+
+/** @brief Allocate a DMA buffer in the driver and map it into user space.
+ *
+ *  The driver allocates coherent DMA memory, which is usually limited to a few MB
+ *  per buffer.
+ *  @param fd File descriptor of the character device for memory access.
+ *  @param size Size of the buffer in bytes, rounded up to the page size.
+ *  @return a pointer to the buffer descriptor, or NULL on failure.
+ */
+struct mem_dma_buf_t* alloc_mem_dma_buf(int fd, uint64_t size);
+
+/** @brief Read data from the device memory into a driver-allocated DMA buffer.
+ *
+ *  No page is pinned or mapped for the transfer.
+ *  @param dma_buf A DMA buffer allocated by alloc_mem_dma_buf().
+ *  @param buf_offset offset into the DMA buffer.
+ *  @param size size of data.
+ *  @param dev_offset a source address offset of the device memory.
+ *  @return Return size of data read successfully, or a negative errno.
+ */
+ssize_t read_to_mem_dma_buf(struct mem_dma_buf_t* dma_buf, uint64_t buf_offset, uint64_t size,
+                            uint64_t dev_offset);
+
+/** @brief Write data in a driver-allocated DMA buffer to the device memory.
+ *
+ *  No page is pinned or mapped for the transfer.
+ *  @param dma_buf A DMA buffer allocated by alloc_mem_dma_buf().
+ *  @param buf_offset offset into the DMA buffer.
+ *  @param size size of data.
+ *  @param dev_offset a destination address offset of the device memory.
+ *  @return Return size of data written successfully, or a negative errno.
+ */
+ssize_t write_from_mem_dma_buf(struct mem_dma_buf_t* dma_buf, uint64_t buf_offset, uint64_t size,
+                               uint64_t dev_offset);
+
+/** @brief Unmap and free a driver-allocated DMA buffer.
+ *  @param dma_buf A DMA buffer allocated by alloc_mem_dma_buf().
+ *  @return void.
+ */
+void free_mem_dma_buf(struct mem_dma_buf_t* dma_buf);
+
+#endif /* __MEMORY_API_H__ */
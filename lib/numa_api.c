@@ -0,0 +1,181 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file numa_api.c
+ *  @brief NUMA placement helpers.
+ *
+ */
+
+#define _GNU_SOURCE
+#include <sched.h>
+#include <limits.h>
+#include <libgen.h>
+#include <sys/syscall.h>
+#include <linux/mempolicy.h>
+#include "numa_api.h"
+
+#define BITS_PER_ULONG (8 * sizeof(unsigned long))
+
+int get_pcie_numa_node(char* pcie_resource) {
+  char path[PATH_MAX];
+  char sysfs_path[PATH_MAX];
+  FILE* fp;
+  int numa_node = -1;
+
+  // resource2 sits in the sysfs directory of the PCIe function
+  if(realpath(pcie_resource, path) == NULL) {
+    fprintf(stderr, "Warning: failed to resolve %s: %s\n", pcie_resource, strerror(errno));
+    return -1;
+  }
+  snprintf(sysfs_path, sizeof(sysfs_path), "%s/numa_node", dirname(path));
+
+  fp = fopen(sysfs_path, "r");
+  if(fp == NULL) {
+    fprintf(stderr, "Warning: failed to open %s\n", sysfs_path);
+    return -1;
+  }
+  if(fscanf(fp, "%d", &numa_node) != 1) {
+    numa_node = -1;
+  }
+  fclose(fp);
+
+  Debug("Info: %s is attached to NUMA node %d\n", pcie_resource, numa_node);
+  return numa_node;
+}
+
+int get_numa_node_cpus(int numa_node, int* cpus, int max_cpus) {
+  char path[PATH_MAX];
+  FILE* fp;
+  int num_cpus = 0;
+  int first;
+  int last;
+  int cpu;
+  char sep;
+
+  if(numa_node < 0) {
+    return -1;
+  }
+
+  snprintf(path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", numa_node);
+  fp = fopen(path, "r");
+  if(fp == NULL) {
+    fprintf(stderr, "Warning: failed to open %s\n", path);
+    return -1;
+  }
+
+  // cpulist format: "0-3,8-11"
+  while(fscanf(fp, "%d", &first) == 1) {
+    last = first;
+    sep = fgetc(fp);
+    if(sep == '-') {
+      if(fscanf(fp, "%d", &last) != 1) {
+        break;
+      }
+      sep = fgetc(fp);
+    }
+    for(cpu = first; cpu <= last && num_cpus < max_cpus; cpu++) {
+      cpus[num_cpus++] = cpu;
+    }
+    if(sep != ',') {
+      break;
+    }
+  }
+  fclose(fp);
+
+  return num_cpus;
+}
+
+int bind_buffer_to_numa_node(void* buffer, uint64_t size, int numa_node) {
+  unsigned long nodemask[NUMA_MAX_NODES / BITS_PER_ULONG];
+
+  if(numa_node < 0 || numa_node >= NUMA_MAX_NODES) {
+    return -1;
+  }
+
+  memset(nodemask, 0, sizeof(nodemask));
+  nodemask[numa_node / BITS_PER_ULONG] = 1UL << (numa_node % BITS_PER_ULONG);
+
+  // The kernel expects maxnode to be one more than the number of bits in nodemask
+  if(syscall(SYS_mbind, buffer, size, MPOL_BIND, nodemask, NUMA_MAX_NODES + 1,
+             MPOL_MF_MOVE) != 0) {
+    fprintf(stderr, "Warning: failed to bind buffer %p to NUMA node %d: %s\n", buffer,
+            numa_node, strerror(errno));
+    return -1;
+  }
+
+  Debug("Info: bound buffer %p (0x%lx bytes) to NUMA node %d\n", buffer, size, numa_node);
+  return 0;
+}
+
+int get_buffer_numa_node(void* buffer) {
+  int numa_node = -1;
+
+  if(syscall(SYS_get_mempolicy, &numa_node, NULL, 0, buffer,
+             MPOL_F_NODE | MPOL_F_ADDR) != 0) {
+    fprintf(stderr, "Warning: failed to get NUMA node of buffer %p: %s\n", buffer,
+            strerror(errno));
+    return -1;
+  }
+
+  return numa_node;
+}
+
+int pin_thread_to_numa_node(pthread_t thread, int numa_node, int cpu_index) {
+  int* cpus;
+  int num_cpus;
+  int ret;
+  int i;
+  cpu_set_t cpuset;
+
+  cpus = (int*) malloc(CPU_SETSIZE * sizeof(int));
+  if(cpus == NULL) {
+    fprintf(stderr, "Error: failed to allocate cpu list\n");
+    return -1;
+  }
+
+  num_cpus = get_numa_node_cpus(numa_node, cpus, CPU_SETSIZE);
+  if(num_cpus <= 0) {
+    fprintf(stderr, "Warning: NUMA node %d has no CPUs, thread placement is remote\n", numa_node);
+    free(cpus);
+    return -1;
+  }
+
+  CPU_ZERO(&cpuset);
+  if(cpu_index < 0) {
+    for(i = 0; i < num_cpus; i++) {
+      CPU_SET(cpus[i], &cpuset);
+    }
+  } else {
+    CPU_SET(cpus[cpu_index % num_cpus], &cpuset);
+  }
+  free(cpus);
+
+  ret = pthread_setaffinity_np(thread, sizeof(cpu_set_t), &cpuset);
+  if(ret != 0) {
+    fprintf(stderr, "Warning: failed to pin thread to NUMA node %d: %s\n", numa_node,
+            strerror(ret));
+    return -1;
+  }
+
+  return 0;
+}
+
+int check_thread_numa_placement(int numa_node) {
+  unsigned int cpu;
+  unsigned int node;
+
+  if(numa_node < 0 || getcpu(&cpu, &node) != 0) {
+    return 1;
+  }
+
+  if((int) node != numa_node) {
+    fprintf(stderr, "Warning: thread runs on CPU %u of NUMA node %u, but the device is on NUMA node %d\n",
+            cpu, node, numa_node);
+    return 0;
+  }
+
+  return 1;
+}
@@ -0,0 +1,76 @@
+//==============================================================================
+// Copyright (C) 2023, Advanced Micro Devices, Inc. All rights reserved.
+// SPDX-License-Identifier: MIT
+//
+//==============================================================================
+
+/** @file numa_api.h
+ *  @brief NUMA placement helpers.
+ *
+ *  Helpers used to keep host buffers and polling threads on the NUMA node
+ *  the RecoNIC card is attached to. Memory policies are set with the raw
+ *  mbind/get_mempolicy system calls, so no libnuma is required.
+ */
+
+#ifndef __NUMA_API_H__
+#define __NUMA_API_H__
+
+#include <pthread.h>
+#include "auxiliary.h"
+
+/*! \def NUMA_MAX_NODES
+    \brief Maximum number of NUMA nodes covered by a node mask.
+*/
+#define NUMA_MAX_NODES 1024
+
+/** @brief Get the NUMA node a PCIe device is attached to.
+ *  @param pcie_resource Path to resource2 of a PCIe device
+ *                       (e.g., /sys/bus/pci/devices/0000:d8:00.0/resource2).
+ *  @return NUMA node of the device, or -1 if unknown or the system is not NUMA.
+ */
+int get_pcie_numa_node(char* pcie_resource);
+
+/** @brief Get the CPUs of a NUMA node.
+ *  @param numa_node A NUMA node.
+ *  @param cpus Array filled in with the CPU numbers of the node.
+ *  @param max_cpus Number of entries available in cpus.
+ *  @return Number of CPUs stored in cpus, or -1 on failure.
+ */
+int get_numa_node_cpus(int numa_node, int* cpus, int max_cpus);
+
+/** @brief Bind a buffer to a NUMA node.
+ *
+ *  Pages not yet faulted in are allocated on the node; pages already present
+ *  are migrated to it. Call it right after mmap and before the buffer is
+ *  touched or locked.
+ *  @param buffer Virtual address of a buffer, aligned to its page size.
+ *  @param size Size of the buffer in bytes.
+ *  @param numa_node A NUMA node.
+ *  @return 0 on success, or -1 on failure.
+ */
+int bind_buffer_to_numa_node(void* buffer, uint64_t size, int numa_node);
+
+/** @brief Get the NUMA node a buffer resides on.
+ *  @param buffer Virtual address of a buffer that has been faulted in.
+ *  @return NUMA node of the page backing buffer, or -1 on failure.
+ */
+int get_buffer_numa_node(void* buffer);
+
+/** @brief Pin a thread to the CPUs of a NUMA node.
+ *  @param thread A thread, e.g., pthread_self() for a polling thread.
+ *  @param numa_node A NUMA node.
+ *  @param cpu_index Pin to the (cpu_index % num_cpus)-th CPU of the node,
+ *                   or to all CPUs of the node if negative.
+ *  @return 0 on success, or -1 on failure.
+ */
+int pin_thread_to_numa_node(pthread_t thread, int numa_node, int cpu_index);
+
+/** @brief Check whether the calling thread runs on a given NUMA node.
+ *
+ *  A warning is printed if the thread runs on a remote node.
+ *  @param numa_node A NUMA node.
+ *  @return 1 - local or unknown placement; 0 - remote placement.
+ */
+int check_thread_numa_placement(int numa_node);
+
+#endif /* __NUMA_API_H__ */
@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2021 Xilinx, Inc.
+ * All rights reserved.
+ *
+ * This source code is free software; you can redistribute it and/or modify it
+ * under the terms and conditions of the GNU General Public License,
+ * version 2, as published by the Free Software Foundation.
+ *
+ * This program is distributed in the hope that it will be useful, but WITHOUT
+ * ANY WARRANTY; without even the implied warranty of MERCHANTABILITY or
+ * FITNESS FOR A PARTICULAR PURPOSE.  See the GNU General Public License for
+ * more details.
+ *
+ * The full GNU General Public License is included in this distribution in
+ * the file called "COPYING".
+ */
+#ifndef __ONIC_IOCTL_H__
+#define __ONIC_IOCTL_H__
+
+/*
+ * ioctl interface of the reconic-mm character device, shared by the driver
+ * and user space (libreconic). lib/onic_ioctl.h is a copy of this file so
+ * that libreconic builds on its own; keep both in sync.
+ */
+#include <linux/ioctl.h>
+#include <linux/types.h>
+
+#define ONIC_IOC_MAGIC 'R'
+
+/**
+ * Register a user buffer for repeated DMA
+ *
+ * The pages of [addr, addr + len) are pinned and DMA-mapped once. The
+ * returned handle stays valid until ONIC_IOC_UNREG_BUF or until the file
+ * is closed.
+ **/
+struct onic_ioc_reg_buf {
+  /* user virtual address of the buffer */
+  __u64 addr;
+  /* length of the buffer in bytes */
+  __u64 len;
+  /* handle of the registered buffer (out) */
+  __u32 handle;
+  __u32 rsvd;
+};
+
+/**
+ * DMA between a registered buffer and card memory
+ **/
+struct onic_ioc_buf_rw {
+  /* handle returned by ONIC_IOC_REG_BUF */
+  __u32 handle;
+  /* 1 - host to card, 0 - card to host */
+  __u32 write;
+  /* offset into the registered buffer */
+  __u64 offset;
+  /* number of bytes to transfer */
+  __u64 len;
+  /* card memory address */
+  __u64 dev_addr;
+};
+
+/**
+ * Allocate a DMA buffer to be mapped with mmap()
+ *
+ * The buffer is physically contiguous on the bus. Map it by passing
+ * mmap_offset as the offset to mmap() on the same file. Its handle can be
+ * used with ONIC_IOC_BUF_RW and released with ONIC_IOC_UNREG_BUF.
+ **/
+struct onic_ioc_dma_buf {
+  /* size of the buffer in bytes, rounded up to the page size */
+  __u64 size;
+  /* handle of the buffer (out) */
+  __u32 handle;
+  __u32 rsvd;
+  /* offset to pass to mmap() (out) */
+  __u64 mmap_offset;
+  /* bus address of the buffer as seen by the card (out) */
+  __u64 bus_addr;
+};
+
+/**
+ * Entry of a scatter list moved by ONIC_IOC_SG_RW
+ **/
+struct onic_ioc_sg_entry {
+  /* user virtual address */
+  __u64 addr;
+  /* card memory address */
+  __u64 dev_addr;
+  /* number of bytes to transfer */
+  __u64 len;
+};
+
+/**
+ * Move a scatter list between user buffers and card memory in one batch
+ **/
+struct onic_ioc_sg_rw {
+  /* user pointer to an array of struct onic_ioc_sg_entry */
+  __u64 entries;
+  /* number of entries, at most ONIC_SG_RW_MAX_ENTRIES */
+  __u32 count;
+  /* 1 - host to card, 0 - card to host */
+  __u32 write;
+};
+
+#define ONIC_SG_RW_MAX_ENTRIES 1024
+
+/**
+ * Contiguous bus address range of a buffer mapped by ONIC_IOC_MAP_USER_MEM
+ **/
+struct onic_ioc_iova_seg {
+  /* bus address as seen by the card, an IOVA when the IOMMU is on */
+  __u64 iova;
+  /* length in bytes */
+  __u64 len;
+};
+
+/**
+ * Pin an arbitrary user buffer and return its bus address ranges
+ *
+ * The buffer is mapped through the DMA API, so it works with the IOMMU on,
+ * which usually merges the whole buffer into one range. The returned handle
+ * can be used with ONIC_IOC_BUF_RW and released with ONIC_IOC_UNREG_BUF.
+ **/
+struct onic_ioc_map_user_mem {
+  /* user virtual address of the buffer */
+  __u64 addr;
+  /* length of the buffer in bytes */
+  __u64 len;
+  /* user pointer to an array of struct onic_ioc_iova_seg (out) */
+  __u64 segs;
+  /* number of entries available in segs */
+  __u32 max_segs;
+  /* number of address ranges of the buffer (out), fails with ENOSPC if above max_segs */
+  __u32 nr_segs;
+  /* handle of the mapped buffer (out) */
+  __u32 handle;
+  __u32 rsvd;
+};
+
+/* interrupt sources delivered through ONIC_IOC_SET_EVENTFD */
+enum onic_event_source {
+  /* ERNIC work queue completion */
+  ONIC_EVENT_CQ = 0,
+  /* ERNIC receive queue packet */
+  ONIC_EVENT_RQ,
+  /* any other ERNIC interrupt status, e.g. packet errors or fatal errors */
+  ONIC_EVENT_ERROR,
+  /* user interrupt without ERNIC status, raised by the compute logic */
+  ONIC_EVENT_COMPUTE,
+  ONIC_EVENT_MAX
+};
+
+/**
+ * Attach an eventfd to an interrupt source
+ *
+ * The eventfd counter is incremented on each interrupt of the source. The
+ * per-QP RQ/CQ status registers are left for user space to read.
+ **/
+struct onic_ioc_eventfd {
+  /* enum onic_event_source */
+  __u32 source;
+  /* eventfd file descriptor, or -1 to detach */
+  __s32 fd;
+};
+
+/* arguments of ONIC_IOC_SET_QUEUE besides a queue index */
+#define ONIC_QUEUE_UNBOUND  (-1)
+#define ONIC_QUEUE_AUTO     (-2)
+
+#define ONIC_IOC_REG_BUF    _IOWR(ONIC_IOC_MAGIC, 0x01, struct onic_ioc_reg_buf)
+#define ONIC_IOC_UNREG_BUF  _IOW(ONIC_IOC_MAGIC, 0x02, __u32)
+/* returns the number of bytes transferred */
+#define ONIC_IOC_BUF_RW     _IOW(ONIC_IOC_MAGIC, 0x03, struct onic_ioc_buf_rw)
+/* bind the file to an MM queue, ONIC_QUEUE_AUTO or ONIC_QUEUE_UNBOUND */
+#define ONIC_IOC_SET_QUEUE  _IOW(ONIC_IOC_MAGIC, 0x04, __s32)
+#define ONIC_IOC_GET_QUEUE  _IOR(ONIC_IOC_MAGIC, 0x05, __s32)
+#define ONIC_IOC_ALLOC_DMA_BUF _IOWR(ONIC_IOC_MAGIC, 0x06, struct onic_ioc_dma_buf)
+/* returns the number of bytes transferred */
+#define ONIC_IOC_SG_RW      _IOW(ONIC_IOC_MAGIC, 0x07, struct onic_ioc_sg_rw)
+#define ONIC_IOC_SET_EVENTFD _IOW(ONIC_IOC_MAGIC, 0x08, struct onic_ioc_eventfd)
+/*
+ * keyhole aperture in bytes, a power of 2 or 0 for linear transfers: card
+ * addresses of the file's transfers wrap within [offset, offset + aperture)
+ */
+#define ONIC_IOC_SET_APERTURE _IOW(ONIC_IOC_MAGIC, 0x09, __u32)
+#define ONIC_IOC_GET_APERTURE _IOR(ONIC_IOC_MAGIC, 0x0a, __u32)
+#define ONIC_IOC_MAP_USER_MEM _IOWR(ONIC_IOC_MAGIC, 0x0b, struct onic_ioc_map_user_mem)
+
+#endif /* ifndef __ONIC_IOCTL_H__ */
@@ -247,7 +247,15 @@ struct rdma_pd_t* allocate_rdma_pd(struct rdma_dev_t* rdma_dev, uint32_t pd_num)
   struct rdma_pd_t* rdma_pd = NULL;
 
   if(rdma_dev != NULL) {
+    if(pd_num >= RDMA_MAX_PD_NUM) {
+      fprintf(stderr, "Error: PD %u is out of the PD table of %d entries\n", pd_num, RDMA_MAX_PD_NUM);
+      return NULL;
+    }
     rdma_pd = (struct rdma_pd_t* ) malloc(sizeof(struct rdma_pd_t));
+    if(rdma_pd == NULL) {
+      fprintf(stderr, "Error: failed to allocate PD %u\n", pd_num);
+      return NULL;
+    }
     rdma_pd->pd_num = pd_num;
     rdma_pd->pd_access_type = 2 & 0x0000ffff;
     write32_data(rdma_dev->axil_ctl, get_rdma_pd_config_addr(RN_RDMA_PDT_PDPDNUM, pd_num), pd_num);
@@ -332,8 +340,116 @@ void rdma_register_memory_region(struct rdma_dev_t* rdma_dev, struct rdma_pd_t*
   fprintf(stderr, "Info: memory region for the %d-th PD is registered\n", pd_num);
 }
 
+struct rdma_user_mr_t* rdma_register_user_memory(struct rdma_dev_t* rdma_dev, int fd, uint32_t pd_num,
+                                                 uint32_t r_key, void* buffer, uint64_t size) {
+  struct onic_ioc_map_user_mem umap;
+  struct onic_ioc_iova_seg* segs;
+  struct rdma_user_mr_t* user_mr;
+  uint64_t page_size = (uint64_t) getpagesize();
+  uint64_t offset = 0;
+  uint32_t i;
+
+  if(rdma_dev == NULL || buffer == NULL || size == 0) {
+    fprintf(stderr, "Error: invalid user memory %p of 0x%lx bytes\n", buffer, size);
+    return NULL;
+  }
+
+  // Without an IOMMU, every physically contiguous run of pages is a separate range
+  memset(&umap, 0, sizeof(umap));
+  umap.max_segs = (uint32_t) ((((uintptr_t) buffer & (page_size - 1)) + size + page_size - 1) / page_size);
+  segs = (struct onic_ioc_iova_seg*) malloc(umap.max_segs * sizeof(struct onic_ioc_iova_seg));
+  if(segs == NULL) {
+    fprintf(stderr, "Error: failed to allocate %u IOVA ranges\n", umap.max_segs);
+    return NULL;
+  }
+  umap.addr = (uint64_t) (uintptr_t) buffer;
+  umap.len = size;
+  umap.segs = (uint64_t) (uintptr_t) segs;
+
+  if(ioctl(fd, ONIC_IOC_MAP_USER_MEM, &umap) < 0) {
+    fprintf(stderr, "Error: failed to map user memory %p of 0x%lx bytes: %s\n", buffer, size,
+            strerror(errno));
+    free(segs);
+    return NULL;
+  }
+
+  // Each IOVA range takes a PD table entry, check them all before writing any
+  if(pd_num >= RDMA_MAX_PD_NUM || umap.nr_segs > RDMA_MAX_PD_NUM - pd_num) {
+    fprintf(stderr, "Error: user memory %p of 0x%lx bytes needs PDs %u-%u, beyond the PD table of %d entries\n",
+            buffer, size, pd_num, pd_num + umap.nr_segs - 1, RDMA_MAX_PD_NUM);
+    ioctl(fd, ONIC_IOC_UNREG_BUF, &umap.handle);
+    free(segs);
+    return NULL;
+  }
+
+  user_mr = (struct rdma_user_mr_t*) calloc(1, sizeof(struct rdma_user_mr_t));
+  if(user_mr == NULL) {
+    fprintf(stderr, "Error: failed to allocate user_mr\n");
+    ioctl(fd, ONIC_IOC_UNREG_BUF, &umap.handle);
+    free(segs);
+    return NULL;
+  }
+  user_mr->fd = fd;
+  user_mr->handle = umap.handle;
+  user_mr->mr_bufs = (struct rdma_buff_t*) calloc(umap.nr_segs, sizeof(struct rdma_buff_t));
+  user_mr->pds = (struct rdma_pd_t**) calloc(umap.nr_segs, sizeof(struct rdma_pd_t*));
+  if(user_mr->mr_bufs == NULL || user_mr->pds == NULL) {
+    fprintf(stderr, "Error: failed to allocate %u memory regions\n", umap.nr_segs);
+    goto err_out;
+  }
+
+  for(i = 0; i < umap.nr_segs; i++) {
+    // buf_size of a memory region is 32-bit
+    if(segs[i].len > UINT32_MAX) {
+      fprintf(stderr, "Error: IOVA range %u of 0x%llx bytes exceeds a memory region\n", i,
+              (unsigned long long) segs[i].len);
+      goto err_out;
+    }
+    user_mr->mr_bufs[i].buffer = (char*) buffer + offset;
+    user_mr->mr_bufs[i].dma_addr = segs[i].iova;
+    user_mr->mr_bufs[i].buf_size = (uint32_t) segs[i].len;
+    user_mr->pds[i] = allocate_rdma_pd(rdma_dev, pd_num + i);
+    if(user_mr->pds[i] == NULL) {
+      goto err_out;
+    }
+    user_mr->num_mrs++;
+    rdma_register_memory_region(rdma_dev, user_mr->pds[i], r_key, &user_mr->mr_bufs[i]);
+    offset += segs[i].len;
+  }
+
+  Debug("Info: registered user memory %p of 0x%lx bytes as %u memory regions\n", buffer, size,
+        user_mr->num_mrs);
+  free(segs);
+  return user_mr;
+
+err_out:
+  free(segs);
+  rdma_deregister_user_memory(user_mr);
+  return NULL;
+}
+
+void rdma_deregister_user_memory(struct rdma_user_mr_t* user_mr) {
+  uint32_t i;
+
+  if(user_mr == NULL) {
+    return;
+  }
+
+  for(i = 0; i < user_mr->num_mrs; i++) {
+    destroy_rdma_pd_entry(user_mr->pds[i]);
+  }
+  if(ioctl(user_mr->fd, ONIC_IOC_UNREG_BUF, &user_mr->handle) < 0) {
+    fprintf(stderr, "Warning: failed to unmap user memory %u: %s\n", user_mr->handle,
+            strerror(errno));
+  }
+  free(user_mr->pds);
+  free(user_mr->mr_bufs);
+  free(user_mr);
+}
+
 struct rdma_buff_t* allocate_hugepages_buffer(uint32_t num_hugepages) {
   struct rdma_buff_t* rdma_buffer;
+  uint32_t hugepage_shift;
   rdma_buffer = (struct rdma_buff_t*) malloc(sizeof(struct rdma_buff_t));
 
   if(rdma_buffer == NULL) {
@@ -341,20 +457,9 @@ struct rdma_buff_t* allocate_hugepages_buffer(uint32_t num_hugepages) {
     exit(EXIT_FAILURE);
   }
 
-  rdma_buffer->buffer = mmap(NULL, num_hugepages * (1 << HUGE_PAGE_SHIFT),
-                             PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS | 
-                             MAP_HUGETLB, -1, 0);
-
-  if(rdma_buffer->buffer == NULL) {
-    fprintf(stderr, "Error: failed to allocate hugepage memory\n");
-    exit(EXIT_FAILURE);
-  }
-
-  // Lock the buffer in physical memory
-  if(mlock(rdma_buffer->buffer, num_hugepages * (1 << HUGE_PAGE_SHIFT)) == -1) {
-    fprintf(stderr, "Error: failed to lock %d page in memory\n", num_hugepages);
-    exit(EXIT_FAILURE);
-  }
+  hugepage_shift = HUGE_PAGE_SHIFT;
+  rdma_buffer->buffer = map_hugepages((uint64_t) num_hugepages << HUGE_PAGE_SHIFT, &hugepage_shift, NULL, -1);
+  rdma_buffer->buf_size = (uint32_t) ((uint64_t) num_hugepages << HUGE_PAGE_SHIFT);
 
   rdma_buffer->dma_addr = get_buffer_paddr(rdma_buffer->buffer);
 
@@ -428,6 +533,12 @@ struct rdma_qp_t* allocate_rdma_qp(struct rdma_dev_t* rdma_dev,
   qp->rdma_dev = rdma_dev;
   qp->qpid = qpid;
   qp->dst_qpid = dst_qpid;
+  qp->state = RDMA_QP_ACTIVE;
+  qp->recovery_polls = 0;
+  qp->saved_sq_ptr = 0;
+  qp->replay_from = -1;
+  qp->replay_attempts = 0;
+  qp->num_recoveries = 0;
   fprintf(stderr, "Allocating qp->sq\n");
   // Each WQE has 64 bytes
   sq_size = rdma_dev->num_qp * qdepth * 64;
@@ -848,6 +959,9 @@ int poll_cq_cidb(struct rdma_dev_t* rdma_dev, uint32_t qpid, int sq_cidb) {
   while(cq_cidb == sq_cidb) {
     cq_cidb = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid));
     timeout_cnt += 1;
+    if((timeout_cnt % RDMA_QP_FATAL_CHECK_INTERVAL) == 0 && rdma_qp_check_fatal(rdma_dev, qpid)) {
+      return RDMA_POLL_QP_FATAL;
+    }
     if(timeout_cnt > TIMEOUT_THRESHOLD) {
       goto timeout_action;
     }
@@ -858,11 +972,50 @@ int poll_cq_cidb(struct rdma_dev_t* rdma_dev, uint32_t qpid, int sq_cidb) {
   return cq_cidb;
 
 timeout_action:
+  if(rdma_qp_check_fatal(rdma_dev, qpid)) {
+    return RDMA_POLL_QP_FATAL;
+  }
   fprintf(stderr, "ERROR: poll_cq_cidb timeout! sq_cidb = %d; Polling CQ CIDB = %d\n", sq_cidb, cq_cidb);
   dump_registers(rdma_dev, 1, qpid);
   return -1;
 }
 
+int rdma_poll_send_completion(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
+  struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
+
+  // A QP under recovery is driven by the caller through rdma_qp_recovery_progress()
+  if(qp->state != RDMA_QP_ACTIVE) {
+    return RDMA_POLL_QP_FATAL;
+  }
+
+  while(qp->sq_cidb < qp->sq_pidb) {
+    // Wait for all WQE to be completed
+    qp->cq_cidb = poll_cq_cidb(rdma_dev, qpid, qp->sq_cidb);
+    if(qp->cq_cidb == RDMA_POLL_QP_FATAL) {
+      return RDMA_POLL_QP_FATAL;
+    }
+    if(qp->cq_cidb < 0) {
+      return -1;
+    }
+    qp->sq_cidb = qp->cq_cidb;
+  }
+
+  return 0;
+}
+
+/* Recover a fatal QP and wait until the replayed WQEs have completed */
+static int rdma_recover_send_completion(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
+  int ret;
+
+  while((ret = rdma_poll_send_completion(rdma_dev, qpid)) == RDMA_POLL_QP_FATAL) {
+    if(rdma_qp_recover(rdma_dev, qpid) < 0) {
+      return -1;
+    }
+  }
+
+  return ret;
+}
+
 int rdma_post_send(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
   if(rdma_dev == NULL) {
     fprintf(stderr, "Error: rdma_dev is NULL\n");  
@@ -877,6 +1030,11 @@ int rdma_post_send(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
   
   qp->sq_pidb++;
 
+  // A QP under recovery re-posts every WQE up to sq_pidb once it is replayed
+  if(qp->state != RDMA_QP_ACTIVE) {
+    return rdma_recover_send_completion(rdma_dev, qpid);
+  }
+
   // Update sq_pidb to hardware
   write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), qp->sq_pidb);
   Debug("[Register] RN_RDMA_QCSR_SQPIi=0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), qpid, qp->sq_pidb);
@@ -885,6 +1043,9 @@ int rdma_post_send(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
 
   // polling on completion, by checking CQ doorbell
   qp->cq_cidb = poll_cq_cidb(rdma_dev, qpid, qp->sq_cidb);
+  if(qp->cq_cidb == RDMA_POLL_QP_FATAL) {
+    return rdma_recover_send_completion(rdma_dev, qpid);
+  }
   qp->sq_cidb++;
 
   if(qp->cq_cidb < 0) {
@@ -913,6 +1074,11 @@ int rdma_post_batch_send(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t ba
     exit(EXIT_FAILURE);
   }
 
+  // A QP under recovery re-posts every WQE up to sq_pidb once it is replayed
+  if(qp->state != RDMA_QP_ACTIVE) {
+    return rdma_recover_send_completion(rdma_dev, qpid);
+  }
+
   // Update sq_pidb to hardware
   write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), qp->sq_pidb);
   Debug("[Register] RN_RDMA_QCSR_SQPIi=0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), qpid, qp->sq_pidb);
@@ -920,17 +1086,7 @@ int rdma_post_batch_send(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t ba
   Debug("DEBUG: Reading hardware SQPIi (0x%x) = 0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid)));
   Debug("[Register] RN_RDMA_QCSR_CQHEADi=0x%x, qpid=%d, value=0x%x\n", get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid), qpid, qp->cq_cidb);
   // polling on completion, by checking CQ doorbell
-  while(qp->cq_cidb < qp->sq_pidb) {
-    // Wait for all WQE to be completed
-    qp->cq_cidb = poll_cq_cidb(rdma_dev, qpid, qp->sq_cidb);
-    qp->sq_cidb = qp->cq_cidb;
-  }
-
-  if(qp->cq_cidb < 0) {
-    return -1;
-  } else {
-    return 0;
-  }
+  return rdma_recover_send_completion(rdma_dev, qpid);
 }
 
 void write_rq_cidb(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp, uint32_t db_val) {
@@ -992,38 +1148,23 @@ uint8_t rdma_release_rq_consumed (struct rdma_dev_t* rdma_dev, struct rdma_qp_t*
   return rc;
 }
 
-void rdma_qp_fatal_recovery(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
-  fprintf(stderr, "\n\n***** QP%d FATAL RECOVERY *****\n", qpid);
-  // Steps to clear traffic on QP:
+/* Check whether SQ/OSQ are empty and all posted WQEs have completed */
+static int rdma_qp_drained(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
   uint32_t rt_value;
-  uint32_t timeout_cnt = 0;
 
-  /* 1. Wait till SQ/OSQ are empty */
-  while(1) {
-    rt_value = read32_data(rdma_dev->axil_ctl, 
-                           get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATQPi, qpid));
-    // Debug("[Register] RN_RDMA_QCSR_STATQPi=0x%x, qpid=%d, value=0x%x\n", 
-    //                 get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATQPi, qpid), 
-    //                 qpid, 
-    //                 rt_value);
-    if ((rt_value >> 9) & 0x3)
-			break;
-  }
-
-  /* 2. Check SQ PI == CQ Head */
-  timeout_cnt = 0;
-  while(read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid)) 
-        != read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid))) {
-    timeout_cnt += 1;
-    if (timeout_cnt > 100000){
-      fprintf(stderr, "TIMEOUT: CQHEADi:0x%x and SQPIi:0x%x are different\n", 
-                      read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid)),
-                      read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid)));
-      exit(EXIT_FAILURE);
-    }
+  rt_value = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATQPi, qpid));
+  if(((rt_value >> 9) & 0x3) != 0x3) {
+    return 0;
   }
-  
-  /* Disable the QP */
+
+  return read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid))
+         == read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid));
+}
+
+/* Disable a QP and mark it under recovery */
+static void rdma_qp_disable(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
+  uint32_t rt_value;
+
   rt_value = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qpid));
   write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qpid), 
               (rt_value & ~(BIT(0)))); // set bit [0] to 0
@@ -1036,6 +1177,191 @@ void rdma_qp_fatal_recovery(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
                     qpid, rt_value);
 }
 
+void rdma_qp_fatal_recovery(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
+  uint32_t timeout_cnt = 0;
+
+  fprintf(stderr, "\n\n***** QP%d FATAL RECOVERY *****\n", qpid);
+  // Steps to clear traffic on QP:
+  /* 1. Wait till SQ/OSQ are empty and 2. SQ PI == CQ Head */
+  while(!rdma_qp_drained(rdma_dev, qpid)) {
+    timeout_cnt += 1;
+    if(timeout_cnt > RDMA_QP_DRAIN_THRESHOLD) {
+      fprintf(stderr, "TIMEOUT: QP%d not drained, CQHEADi:0x%x and SQPIi:0x%x, forcing reset\n", qpid,
+                      read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid)),
+                      read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid)));
+      break;
+    }
+  }
+
+  /* Disable the QP */
+  rdma_qp_disable(rdma_dev, qpid);
+}
+
+int rdma_qp_check_fatal(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
+  struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
+  uint32_t rt_value;
+
+  if(qp->state != RDMA_QP_ACTIVE) {
+    return 1;
+  }
+
+  rt_value = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATQPi, qpid));
+  if((rt_value & RDMA_QP_STAT_FATAL_MASK) == 0) {
+    return 0;
+  }
+
+  fprintf(stderr, "Warning: QP%d in fatal status (STATQPi=0x%x), starting recovery\n", qpid, rt_value);
+  // Capture the PSNs before the pointers get reset
+  qp->saved_sq_psn = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPSNi, qpid));
+  qp->saved_sq_ptr = (int) read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATCURSQPTRi, qpid));
+  qp->saved_last_rq_req = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_LSTRQREQi, qpid));
+  qp->recovery_polls = 0;
+  qp->state = RDMA_QP_DRAINING;
+
+  return 1;
+}
+
+/* Read the CQE of a WQE index, from host or device memory */
+static uint32_t rdma_qp_read_cqe(struct rdma_qp_t* qp, int idx) {
+  uint32_t cqe = 0;
+  uint32_t slot = ((uint32_t) idx) % qp->qdepth;
+
+  if(is_device_address(qp->cq->dma_addr)) {
+    if(read_to_buffer(device, fpga_fd, (char* ) &cqe, sizeof(uint32_t), qp->cq->dma_addr + (slot * sizeof(uint32_t))) < 0) {
+      fprintf(stderr, "Warning: failed to read CQE %d of QP%d from the device memory\n", idx, qp->qpid);
+      return RDMA_CQE_ERR_MASK;
+    }
+  } else {
+    cqe = ((volatile uint32_t* ) qp->cq->buffer)[slot];
+  }
+
+  return cqe;
+}
+
+/* Number of PSNs a WQE index takes on the wire, from the length in the SQ */
+static uint32_t rdma_qp_wqe_num_psns(struct rdma_qp_t* qp, int idx) {
+  struct rdma_wqe_t wqe;
+  uint32_t slot = ((uint32_t) idx) % qp->qdepth;
+
+  if(is_device_address(qp->sq->dma_addr)) {
+    if(read_to_buffer(device, fpga_fd, (char* ) &wqe, sizeof(struct rdma_wqe_t), qp->sq->dma_addr + (slot * sizeof(struct rdma_wqe_t))) < 0) {
+      fprintf(stderr, "Warning: failed to read WQE %d of QP%d from the device memory\n", idx, qp->qpid);
+      return 1;
+    }
+  } else {
+    wqe = ((struct rdma_wqe_t* ) qp->sq->buffer)[slot];
+  }
+
+  // A zero-length request still takes one packet
+  return (wqe.length == 0) ? 1 : (wqe.length + RDMA_PATH_MTU - 1) / RDMA_PATH_MTU;
+}
+
+/* Reset QP pointers to the first WQE that has not completed successfully */
+static void rdma_qp_reset(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp) {
+  uint32_t qpid = qp->qpid;
+  uint32_t adv_conf;
+  uint32_t rt_value;
+  uint32_t sq_psn;
+  int cq_head;
+  int replay_from;
+  int idx;
+
+  rdma_qp_disable(rdma_dev, qpid);
+
+  // WQEs past CQHEADi never completed; those before it may have completed with an error
+  cq_head = (int) read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid));
+  for(replay_from = qp->sq_cidb; replay_from < cq_head; replay_from++) {
+    if(rdma_qp_read_cqe(qp, replay_from) & RDMA_CQE_ERR_MASK) {
+      break;
+    }
+  }
+
+  if(replay_from == qp->replay_from) {
+    qp->replay_attempts++;
+  } else {
+    qp->replay_from = replay_from;
+    qp->replay_attempts = 1;
+  }
+  if(qp->replay_attempts > RDMA_QP_MAX_REPLAY_ATTEMPTS) {
+    fprintf(stderr, "Error: QP%d failed %d times at WQE %d, giving up\n", qpid, RDMA_QP_MAX_REPLAY_ATTEMPTS, replay_from);
+    qp->state = RDMA_QP_ERROR;
+    return;
+  }
+
+  // SQPSNi follows the last WQE sent, step it back over the WQEs that are replayed
+  sq_psn = qp->saved_sq_psn;
+  for(idx = replay_from; idx < qp->saved_sq_ptr; idx++) {
+    sq_psn -= rdma_qp_wqe_num_psns(qp, idx);
+  }
+  sq_psn &= 0x00ffffff;
+
+  // Software override allows writing CQHEADi and STATCURSQPTRi of this QP
+  adv_conf = read32_data(rdma_dev->axil_ctl, RN_RDMA_GCSR_XRNICADCONF);
+  write32_data(rdma_dev->axil_ctl, RN_RDMA_GCSR_XRNICADCONF, 
+              (adv_conf & 0x00fffffe) | ((qpid << 24) & 0xff000000) | 0x00000001);
+
+  write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), replay_from);
+  write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_CQHEADi, qpid), replay_from);
+  write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATCURSQPTRi, qpid), replay_from);
+
+  // Re-establish the PSNs, so that the remote side accepts the replayed requests
+  write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPSNi, qpid), sq_psn);
+  write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_LSTRQREQi, qpid), qp->saved_last_rq_req);
+
+  write32_data(rdma_dev->axil_ctl, RN_RDMA_GCSR_XRNICADCONF, adv_conf);
+
+  // Clear QP under recovery (QPCONFi[6]) and enable the QP (QPCONFi[0])
+  rt_value = read32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qpid));
+  write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_QPCONFi, qpid), 
+              ((rt_value & ~(BIT(6))) | BIT(0)));
+
+  qp->sq_cidb = replay_from;
+  qp->cq_cidb = replay_from;
+  Debug("DEBUG: QP%d reset, replaying WQEs [%d, %d) from PSN 0x%x\n", qpid, replay_from, qp->sq_pidb, sq_psn);
+  qp->state = RDMA_QP_REPLAYING;
+}
+
+enum rdma_qp_state_t rdma_qp_recovery_progress(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
+  struct rdma_qp_t* qp = rdma_dev->qps_ptr[qpid];
+
+  switch(qp->state) {
+    case RDMA_QP_DRAINING:
+      // One poll per step, so other QPs can be served in between
+      qp->recovery_polls++;
+      if(rdma_qp_drained(rdma_dev, qpid)) {
+        qp->state = RDMA_QP_RESETTING;
+      } else if(qp->recovery_polls > RDMA_QP_DRAIN_THRESHOLD) {
+        fprintf(stderr, "Warning: QP%d not drained after %d polls, forcing reset\n", qpid, RDMA_QP_DRAIN_THRESHOLD);
+        qp->state = RDMA_QP_RESETTING;
+      }
+      break;
+    case RDMA_QP_RESETTING:
+      rdma_qp_reset(rdma_dev, qp);
+      break;
+    case RDMA_QP_REPLAYING:
+      // The WQEs are still in the SQ, ringing the doorbell again re-posts them
+      write32_data(rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_SQPIi, qpid), qp->sq_pidb);
+      qp->num_recoveries++;
+      qp->state = RDMA_QP_ACTIVE;
+      fprintf(stderr, "Info: QP%d recovered, %d WQEs re-posted\n", qpid, qp->sq_pidb - qp->sq_cidb);
+      break;
+    default:
+      break;
+  }
+
+  return qp->state;
+}
+
+int rdma_qp_recover(struct rdma_dev_t* rdma_dev, uint32_t qpid) {
+  enum rdma_qp_state_t state;
+
+  do {
+    state = rdma_qp_recovery_progress(rdma_dev, qpid);
+  } while(state != RDMA_QP_ACTIVE && state != RDMA_QP_ERROR);
+
+  return (state == RDMA_QP_ACTIVE) ? 0 : -1;
+}
+
 void destroy_rdma_pd_entry(struct rdma_pd_t* pd) {
   if(pd != NULL) {
     free(pd);
@@ -1047,6 +1373,11 @@ int destroy_rdma_qp(struct rdma_qp_t* qp) {
   uint32_t rt_value;
 
   if(qp != NULL) {
+    // Finish a recovery left in progress by the data path before tearing the QP down
+    if(qp->state != RDMA_QP_ACTIVE && qp->state != RDMA_QP_ERROR) {
+      rdma_qp_recover(qp->rdma_dev, qp->qpid);
+    }
+
     // Read STATQPi to make sure STATQPi[7:0] = 8'd0 and STATQPi[10:9] = 2'b11;
     rt_value = read32_data(qp->rdma_dev->axil_ctl, get_rdma_per_q_config_addr(RN_RDMA_QCSR_STATQPi, qp->qpid));
     if(!(((rt_value & 0x000000ff)==0) && (((rt_value>>9) & 0x00000003) == 0x3))) {
@@ -1134,8 +1465,13 @@ int destroy_rdma_dev(struct rdma_dev_t* rdma_dev) {
 
 int destroy_rn_dev(struct rn_dev_t* rn_dev) {
   if(rn_dev != NULL) {
-    free(rn_dev->base_buf);
     destroy_rdma_dev((struct rdma_dev_t* ) rn_dev->rdma_dev);
+    // Release the hugepages only once the RNIC no longer accesses them
+    if(rn_dev->base_buf != NULL) {
+      munmap(rn_dev->base_buf->buffer, (uint64_t) rn_dev->num_hugepages << rn_dev->hugepage_shift);
+    }
+    free(rn_dev->hugepage_paddr);
+    free(rn_dev->base_buf);
     rn_dev = NULL;
   }
 
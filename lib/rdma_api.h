@@ -24,6 +24,57 @@
 */
 #define RQE_SIZE 512
 
+/*! \def RDMA_QP_STAT_FATAL_MASK
+    \brief STATQPi[7:0] is non-zero when a QP is in fatal status.
+*/
+#define RDMA_QP_STAT_FATAL_MASK 0x000000ff
+
+/*! \def RDMA_CQE_ERR_MASK
+    \brief CQE[31:24] carries the error flags of a completed WQE.
+*/
+#define RDMA_CQE_ERR_MASK 0xff000000
+
+/*! \def RDMA_POLL_QP_FATAL
+    \brief Returned by poll_cq_cidb() when the QP entered fatal status and recovery was started.
+*/
+#define RDMA_POLL_QP_FATAL -2
+
+/*! \def RDMA_QP_FATAL_CHECK_INTERVAL
+    \brief Number of CQ doorbell polls between two checks of the QP status.
+*/
+#define RDMA_QP_FATAL_CHECK_INTERVAL 256
+
+/*! \def RDMA_QP_DRAIN_THRESHOLD
+    \brief Number of drain polls after which a fatal QP is reset even if SQ/OSQ are not empty.
+*/
+#define RDMA_QP_DRAIN_THRESHOLD 100000
+
+/*! \def RDMA_MAX_PD_NUM
+    \brief Number of entries in the ERNIC protection domain table.
+*/
+#define RDMA_MAX_PD_NUM 256
+
+/*! \def RDMA_PATH_MTU
+    \brief Path MTU in bytes programmed in QPCONFi[10:8], each packet of a WQE takes one PSN.
+*/
+#define RDMA_PATH_MTU 4096
+
+/*! \def RDMA_QP_MAX_REPLAY_ATTEMPTS
+    \brief Number of times the same WQE is replayed before the QP is given up.
+*/
+#define RDMA_QP_MAX_REPLAY_ATTEMPTS 3
+
+/*! \enum rdma_qp_state_t
+    \brief Fatal-error recovery state of a queue pair.
+*/
+enum rdma_qp_state_t {
+  RDMA_QP_ACTIVE = 0, /*!< RDMA_QP_ACTIVE QP is operational. */
+  RDMA_QP_DRAINING,   /*!< RDMA_QP_DRAINING Fatal status detected, waiting for SQ/OSQ to drain. */
+  RDMA_QP_RESETTING,  /*!< RDMA_QP_RESETTING Resetting QP pointers and restoring PSNs. */
+  RDMA_QP_REPLAYING,  /*!< RDMA_QP_REPLAYING Re-posting the WQEs that had not completed. */
+  RDMA_QP_ERROR       /*!< RDMA_QP_ERROR Recovery gave up, the QP stays disabled. */
+};
+
 /*! \struct rdma_glb_csr_t
     \brief Structure used to store RDMA global control status registers.
 */
@@ -90,6 +141,20 @@ struct rdma_pd_t {
   struct rdma_buff_t* mr_buffer; /*!< mr_buffer a pointer to the allocated buffer. */
 };
 
+/*! \struct rdma_user_mr_t
+    \brief Memory regions registered out of an arbitrary user buffer.
+
+    The buffer is pinned and mapped by the driver. Each contiguous bus address range of
+    the buffer is registered as one memory region with its own protection domain entry.
+*/
+struct rdma_user_mr_t {
+  int fd;                      /*!< fd file descriptor of the character device that mapped the buffer. */
+  uint32_t handle;             /*!< handle handle of the mapped buffer in the driver. */
+  uint32_t num_mrs;            /*!< num_mrs number of memory regions, one per bus address range. */
+  struct rdma_buff_t* mr_bufs; /*!< mr_bufs bus address range of each memory region. */
+  struct rdma_pd_t** pds;      /*!< pds protection domain entry of each memory region. */
+};
+
 /*! \struct rdma_qp_t
     \brief RDMA queue pair structure.
 */
@@ -117,6 +182,16 @@ struct rdma_qp_t {
   uint32_t last_rq_psn; /*!< last_rq_psn Last RQ request PSN associated. */
   struct mac_addr_t* dst_mac; /*!< dst_mac destination MAC address. */
   uint32_t dst_ip; /*!< dst_ip destination IP address. */
+
+  // Fatal-error recovery
+  enum rdma_qp_state_t state; /*!< state Recovery state of the QP. */
+  uint32_t recovery_polls;    /*!< recovery_polls Number of drain polls in the current recovery. */
+  uint32_t saved_sq_psn;      /*!< saved_sq_psn SQPSNi captured when the fatal status was detected. */
+  int saved_sq_ptr;           /*!< saved_sq_ptr STATCURSQPTRi captured with saved_sq_psn, the WQEs sent so far. */
+  uint32_t saved_last_rq_req; /*!< saved_last_rq_req LSTRQREQi captured when the fatal status was detected. */
+  int replay_from;            /*!< replay_from Index of the first WQE replayed by the last recovery. */
+  uint32_t replay_attempts;   /*!< replay_attempts Number of consecutive replays starting at replay_from. */
+  uint32_t num_recoveries;    /*!< num_recoveries Number of completed fatal recoveries. */
 };
 
 /*! \struct rdma_wqe_t
@@ -188,8 +263,8 @@ void config_rdma_global_csr (struct rdma_dev_t* rdma_dev);
 
 /** @brief Allocate an RDMA protection domain entry.
  *  @param rdma_dev A pointer to the RDMA device.
- *  @param pd_num protection domain number.
- *  @return a pointer to the RDMA protection domain entry allocated.
+ *  @param pd_num protection domain number, below RDMA_MAX_PD_NUM.
+ *  @return a pointer to the RDMA protection domain entry allocated, or NULL on failure.
  */
 struct rdma_pd_t* allocate_rdma_pd(struct rdma_dev_t* rdma_dev, uint32_t pd_num);
 
@@ -203,12 +278,35 @@ struct rdma_pd_t* allocate_rdma_pd(struct rdma_dev_t* rdma_dev, uint32_t pd_num)
 void rdma_register_memory_region(struct rdma_dev_t* rdma_dev, struct rdma_pd_t* rdma_pd, 
                                  uint32_t r_key, struct rdma_buff_t* rdma_buf);
 
-/** @brief Allocate a host-side buffer.
+/** @brief Allocate a host-side buffer of 2MB hugepages, prefaulted and locked.
  *  @param num_hugepages Number of hugepages requested.
  *  @return a pointer to an RDMA buffer allocated.
  */
 struct rdma_buff_t* allocate_hugepages_buffer(uint32_t num_hugepages);
 
+/** @brief Register an arbitrary user buffer as RDMA memory regions.
+ *
+ *  The driver pins the buffer and maps it through the DMA API, so the buffer needs neither
+ *  the hugepage pool nor /proc/self/pagemap, and works with the IOMMU on. Each bus address
+ *  range of the buffer becomes a memory region of protection domain pd_num, pd_num + 1, ...
+ *  The registration fails if these do not all fit below RDMA_MAX_PD_NUM.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param fd File descriptor of the character device for memory access, e.g., fpga_fd.
+ *  @param pd_num protection domain number of the first memory region.
+ *  @param r_key RDMA security key or remote tag.
+ *  @param buffer virtual address of the user buffer.
+ *  @param size size of the user buffer in bytes.
+ *  @return a pointer to the registered memory regions, or NULL on failure.
+ */
+struct rdma_user_mr_t* rdma_register_user_memory(struct rdma_dev_t* rdma_dev, int fd, uint32_t pd_num,
+                                                 uint32_t r_key, void* buffer, uint64_t size);
+
+/** @brief Destroy the memory regions of a user buffer and unpin the buffer.
+ *  @param user_mr memory regions returned by rdma_register_user_memory().
+ *  @return void.
+ */
+void rdma_deregister_user_memory(struct rdma_user_mr_t* user_mr);
+
 /** @brief Configure last RQ packet sequence number.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qpid the corresponding QP ID.
@@ -290,7 +388,8 @@ void create_a_wqe(struct rdma_dev_t* rdma_dev,
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qpid The target queue pair ID.
  *  @param sq_cidb value of SQ consumer index doorbell.
- *  @return value of RDMA CQ consumer index doorbel register.
+ *  @return value of RDMA CQ consumer index doorbel register, -1 on timeout, or
+ *          RDMA_POLL_QP_FATAL if the QP entered fatal status.
  */
 int poll_cq_cidb(struct rdma_dev_t* rdma_dev, uint32_t qpid, int sq_cidb);
 
@@ -312,7 +411,10 @@ int poll_rq_pidb(struct rdma_dev_t* rdma_dev, uint32_t qpid);
 /** @brief Post an RDMA operation.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qpid The target QP ID.
- *  @return Success (0) or Failure (-1).
+ *
+ *  If the QP enters fatal status, its recovery is driven to completion with
+ *  rdma_qp_recover() and the replayed WQEs are waited for.
+ *  @return Success (0) or Failure (-1), also if the QP had to be given up.
  */
 int rdma_post_send(struct rdma_dev_t* rdma_dev, uint32_t qpid);
 
@@ -320,10 +422,18 @@ int rdma_post_send(struct rdma_dev_t* rdma_dev, uint32_t qpid);
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qpid The target QP ID.
  *  @param batch_size batch size.
- *  @return Success (0) or Failure (-1).
+ *  @return Success (0) or Failure (-1), recovering a fatal QP as rdma_post_send().
  */
 int rdma_post_batch_send(struct rdma_dev_t* rdma_dev, uint32_t qpid, uint32_t batch_size);
 
+/** @brief Wait until every posted RDMA operation of a QP has completed.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid The target QP ID.
+ *  @return Success (0), Failure (-1), or RDMA_POLL_QP_FATAL if the QP is under
+ *          recovery. The caller then steps rdma_qp_recovery_progress() and waits again.
+ */
+int rdma_poll_send_completion(struct rdma_dev_t* rdma_dev, uint32_t qpid);
+
 /** @brief Post an RDMA receive request.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qp a pointer to a queue pair.
@@ -338,13 +448,45 @@ void* rdma_post_receive(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp);
  */
 uint8_t rdma_release_rq_consumed(struct rdma_dev_t* rdma_dev, struct rdma_qp_t* qp);
 
-/** @brief Reset RDMA device when encountering fatal error.
+/** @brief Drain and disable a QP before it is reset, e.g., when it is destroyed.
+ *
+ *  Waits at most RDMA_QP_DRAIN_THRESHOLD polls for SQ/OSQ to drain, then
+ *  disables the QP and marks it under recovery.
  *  @param rdma_dev A pointer to the RDMA device.
  *  @param qpid the QP ID that has the fatal issues.
  *  @return void.
  */
 void rdma_qp_fatal_recovery(struct rdma_dev_t* rdma_dev, uint32_t qpid);
 
+/** @brief Check whether a QP is in fatal status and start its recovery if so.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid The target QP ID.
+ *  @return 1 - the QP is under recovery; 0 - the QP is active.
+ */
+int rdma_qp_check_fatal(struct rdma_dev_t* rdma_dev, uint32_t qpid);
+
+/** @brief Advance the fatal-error recovery of a QP by one non-blocking step.
+ *
+ *  The recovery drains the QP, resets its pointers to the first WQE that did
+ *  not complete successfully, rewinds the SQ PSN to that WQE and re-posts it
+ *  and every WQE after it. Other QPs keep running in the meantime.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid The target QP ID.
+ *  @return Recovery state of the QP after the step.
+ */
+enum rdma_qp_state_t rdma_qp_recovery_progress(struct rdma_dev_t* rdma_dev, uint32_t qpid);
+
+/** @brief Drive the fatal-error recovery of a QP to completion.
+ *
+ *  Blocks for up to RDMA_QP_DRAIN_THRESHOLD polls. rdma_post_send() and
+ *  rdma_post_batch_send() use it, as they block on completions anyway; callers
+ *  serving several QPs step rdma_qp_recovery_progress() instead.
+ *  @param rdma_dev A pointer to the RDMA device.
+ *  @param qpid The target QP ID.
+ *  @return Success (0) or Failure (-1) if the QP had to be given up.
+ */
+int rdma_qp_recover(struct rdma_dev_t* rdma_dev, uint32_t qpid);
+
 /** @brief Destroy the RDMA protection domain entry generated.
  *  @param pd A pointer to the RDMA protection domain.
  *  @return void.
@@ -377,4 +519,4 @@ int destroy_rn_dev(struct rn_dev_t* rn_dev);
  */
 void dump_registers(struct rdma_dev_t* rdma_dev, uint8_t is_sender, uint32_t qpid);
 
-#endif /* __RDMA_API_H__ */
\ No newline at end of file
+#endif /* __RDMA_API_H__ */
\ No newline at end of file
@@ -10,6 +10,9 @@
  */
 
 #include "reconic.h"
+#include <limits.h>
+#include <sys/vfs.h>
+#include <linux/magic.h>
 
 int debug = 0;
 
@@ -207,6 +210,97 @@ void config_rn_dev_axib_bdf(struct rn_dev_t* rn_dev, uint32_t high_addr, uint32_
   }
 }
 
+/* Physical address of an offset into the pre-allocated hugepage buffer */
+static uint64_t get_hugepage_buffer_paddr(struct rn_dev_t* rn_dev, uint64_t offset) {
+  uint64_t page_mask = (1UL << rn_dev->hugepage_shift) - 1;
+
+  return rn_dev->hugepage_paddr[offset >> rn_dev->hugepage_shift] + (offset & page_mask);
+}
+
+/* Page shift of a hugetlbfs mount, which sets the page size of its files */
+static int get_hugetlbfs_page_shift(char* hugetlbfs_path) {
+  struct statfs fs;
+
+  if(statfs(hugetlbfs_path, &fs) == -1 || fs.f_type != HUGETLBFS_MAGIC) {
+    fprintf(stderr, "Error: %s is not a hugetlbfs mount\n", hugetlbfs_path);
+    return -1;
+  }
+  return __builtin_ctzl(fs.f_bsize);
+}
+
+void* map_hugepages(uint64_t size, uint32_t* hugepage_shift, char* hugetlbfs_path, int numa_node) {
+  void* buffer;
+  uint64_t page_size;
+  uint64_t offset;
+  int fd = -1;
+  int flags;
+  int shift;
+  char file_path[PATH_MAX];
+
+  if(hugetlbfs_path != NULL) {
+    shift = get_hugetlbfs_page_shift(hugetlbfs_path);
+    if(shift < 0) {
+      return NULL;
+    }
+    *hugepage_shift = shift;
+    flags = MAP_SHARED;
+  } else {
+    flags = MAP_SHARED | MAP_ANONYMOUS | MAP_HUGETLB | (*hugepage_shift << MAP_HUGE_SHIFT);
+  }
+
+  page_size = 1UL << *hugepage_shift;
+  if(size == 0 || (size & (page_size - 1)) != 0) {
+    fprintf(stderr, "Error: hugepage buffer size 0x%lx is not a multiple of the page size 0x%lx\n", size, page_size);
+    return NULL;
+  }
+
+  if(hugetlbfs_path != NULL) {
+    snprintf(file_path, sizeof(file_path), "%s/reconic_XXXXXX", hugetlbfs_path);
+    fd = mkstemp(file_path);
+    if(fd == -1) {
+      fprintf(stderr, "Error: failed to create a hugepage file in %s: %s\n", hugetlbfs_path, strerror(errno));
+      return NULL;
+    }
+    // The mapping keeps the pages alive, drop the name so they are released on exit
+    unlink(file_path);
+
+    if(ftruncate(fd, size) == -1) {
+      fprintf(stderr, "Error: failed to reserve 0x%lx bytes in %s: %s\n", size, hugetlbfs_path, strerror(errno));
+      close(fd);
+      return NULL;
+    }
+  }
+
+  buffer = mmap(NULL, size, PROT_READ | PROT_WRITE, flags, fd, 0);
+  if(fd != -1) {
+    close(fd);
+  }
+  if(buffer == MAP_FAILED) {
+    fprintf(stderr, "Error: failed to map 0x%lx bytes of %luKB hugepages: %s\n", size, page_size >> 10, strerror(errno));
+    return NULL;
+  }
+
+  // The memory policy only applies to pages faulted in after it is set
+  if(numa_node >= 0) {
+    bind_buffer_to_numa_node(buffer, size, numa_node);
+  }
+
+  // Prefault every hugepage, so that no first-touch fault lands in the data path
+  for(offset = 0; offset < size; offset += page_size) {
+    ((volatile char*) buffer)[offset] = 0;
+  }
+
+  // Lock the buffer in physical memory
+  if(mlock(buffer, size) == -1) {
+    fprintf(stderr, "Error: failed to lock hugepage buffer in memory: %s\n", strerror(errno));
+    munmap(buffer, size);
+    return NULL;
+  }
+
+  Debug("Info: mapped 0x%lx bytes of %luKB hugepages at %p\n", size, page_size >> 10, buffer);
+  return buffer;
+}
+
 struct rdma_buff_t* allocate_rdma_buffer(struct rn_dev_t* rn_dev, uint64_t buf_size, char* buf_location) {
   struct rdma_buff_t* rdma_buffer;
   rdma_buffer = (struct rdma_buff_t*) malloc(sizeof(struct rdma_buff_t));
@@ -215,6 +309,11 @@ struct rdma_buff_t* allocate_rdma_buffer(struct rn_dev_t* rn_dev, uint64_t buf_s
     exit(EXIT_FAILURE);
   }
 
+  if(buf_size > UINT32_MAX) {
+    fprintf(stderr, "Error: rdma buffer size 0x%lx does not fit in 32 bits\n", buf_size);
+    exit(EXIT_FAILURE);
+  }
+
   if(!strcmp(buf_location, HOST_MEM)) {
     // Allocate the buffer in the host memory
     // Check the buffer_offset and buf_size whether it meets 4KB alignment or not
@@ -229,12 +328,20 @@ struct rdma_buff_t* allocate_rdma_buffer(struct rn_dev_t* rn_dev, uint64_t buf_s
         rn_dev->buffer_offset =  (rn_dev->buffer_offset + HARDWARE_PAGE_SIZE) & HARDWARE_PAGE_SIZE_ALIGNMENT_MASK;
       }
     }
+    if((rn_dev->buffer_offset + buf_size) > ((uint64_t) rn_dev->num_hugepages << rn_dev->hugepage_shift)) {
+      fprintf(stderr, "Error: pre-allocated hugepage buffer is exhausted, please request more hugepages\n");
+      exit(EXIT_FAILURE);
+    }
     rdma_buffer->buffer = (void*)((uint64_t) rn_dev->base_buf->buffer + rn_dev->buffer_offset);
-    rn_dev->buffer_offset += buf_size;
     rdma_buffer->buf_size = buf_size;
 
-    // Get the physical address of the buffer
-    rdma_buffer->dma_addr = get_buffer_paddr(rdma_buffer->buffer);
+    // Get the physical address of the buffer from the table built at init time
+    rdma_buffer->dma_addr = get_hugepage_buffer_paddr(rn_dev, rn_dev->buffer_offset);
+    if((rn_dev->buffer_offset >> rn_dev->hugepage_shift) != ((rn_dev->buffer_offset + buf_size - 1) >> rn_dev->hugepage_shift) &&
+       get_hugepage_buffer_paddr(rn_dev, rn_dev->buffer_offset + buf_size - 1) != (rdma_buffer->dma_addr + buf_size - 1)) {
+      fprintf(stderr, "Warning: host buffer %p spans physically discontiguous hugepages, consider a larger hugepage size\n", rdma_buffer->buffer);
+    }
+    rn_dev->buffer_offset += buf_size;
     Debug("Info: allocated host buffer vir addr = %p, physical addr = %lx, rn_dev->buffer_offset = 0x%lx\n", rdma_buffer->buffer, rdma_buffer->dma_addr, rn_dev->buffer_offset);
     Debug("Info: allocate_rdma_buffer - successfully allocated rdma host buffer\n");
   } else {
@@ -272,7 +379,17 @@ struct rdma_buff_t* allocate_rdma_buffer(struct rn_dev_t* rn_dev, uint64_t buf_s
 }
 
 struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint32_t num_hugepages_request, uint32_t num_qp) {
+  return create_rn_dev_with_hugepages(pcie_resource, pcie_resource_fd, num_hugepages_request,
+                                      HUGE_PAGE_SHIFT, NULL, num_qp);
+}
+
+struct rn_dev_t* create_rn_dev_with_hugepages(char* pcie_resource, int* pcie_resource_fd,
+                                              uint32_t num_hugepages_request, uint32_t hugepage_shift,
+                                              char* hugetlbfs_path, uint32_t num_qp) {
   int scr;
+  int shift;
+  uint32_t i;
+  uint64_t buf_size;
   // int rdma = -1;
   void* axil_scr_base;
   uint32_t phy_addr_msb;
@@ -281,12 +398,21 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
   struct rn_dev_t* rn_dev = NULL;
   struct win_size_t* winSize = NULL;
 
-  rn_dev = (struct rn_dev_t* ) malloc(sizeof(struct rn_dev_t));
+  // The page size of a hugetlbfs file is set by the mount, not by the caller
+  if(hugetlbfs_path != NULL) {
+    shift = get_hugetlbfs_page_shift(hugetlbfs_path);
+    if(shift < 0) {
+      return NULL;
+    }
+    hugepage_shift = shift;
+  }
+
+  rn_dev = (struct rn_dev_t* ) calloc(1, sizeof(struct rn_dev_t));
   winSize = (struct win_size_t* ) malloc(sizeof(struct win_size_t));
 
-  if(rn_dev == NULL) {
+  if(rn_dev == NULL || winSize == NULL) {
     fprintf(stderr, "Error: failed to allocate rn_dev\n");
-    exit(EXIT_FAILURE);
+    goto err_free;
   }
 
   rn_dev->axil_map_size = RN_SCR_MAP_SIZE;
@@ -299,10 +425,12 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
 
   if((scr = open(pcie_resource, O_RDWR | O_SYNC)) == -1) {
     fprintf(stderr, "Error can't open %s file for the PCIe resource2!\n", pcie_resource);
-    exit(EXIT_FAILURE);
+    goto err_free;
   }
 
-  *pcie_resource_fd = scr;
+  // Keep the hugepage pool on the NUMA node local to the device
+  rn_dev->numa_node = get_pcie_numa_node(pcie_resource);
+  fprintf(stderr, "Info: device is attached to NUMA node %d\n", rn_dev->numa_node);
 
   Debug("Info: scr(=%d)) file open successfully\n", scr);
 
@@ -310,8 +438,7 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
 
   if (axil_scr_base == MAP_FAILED) {
     fprintf(stderr, "Error: axil_scr_base mmap failed\n");
-    close(scr);
-    exit(EXIT_FAILURE);
+    goto err_close;
   }
 
   rn_dev->axil_ctl = (uint32_t* ) axil_scr_base;
@@ -321,22 +448,35 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
   rn_dev->base_buf = (struct rdma_buff_t*) malloc(sizeof(struct rdma_buff_t));
   if(rn_dev->base_buf == NULL) {
     fprintf(stderr, "Error: failed to create rn_dev->base_buf\n");
-    exit(EXIT_FAILURE);
+    goto err_unmap_scr;
+  }
+
+  // QP rings and doorbell areas are carved out of this pool, so it is bound to
+  // the local NUMA node before the first touch
+  buf_size = (uint64_t) num_hugepages_request << hugepage_shift;
+  rn_dev->hugepage_shift = hugepage_shift;
+  rn_dev->base_buf->buffer = map_hugepages(buf_size, &rn_dev->hugepage_shift, hugetlbfs_path, rn_dev->numa_node);
+  if(rn_dev->base_buf->buffer == NULL) {
+    goto err_free_base_buf;
   }
+  rn_dev->num_hugepages = (uint32_t) (buf_size >> rn_dev->hugepage_shift);
 
-  fprintf(stderr, "create_rn_dev - testing2\n");
-  rn_dev->base_buf->buffer = mmap(NULL, num_hugepages_request * (1 << HUGE_PAGE_SHIFT),
-                                  PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS |
-                                  MAP_HUGETLB, -1, 0);
+  if(rn_dev->numa_node >= 0 && get_buffer_numa_node(rn_dev->base_buf->buffer) != rn_dev->numa_node) {
+    fprintf(stderr, "Warning: hugepage buffer is not on NUMA node %d, every DMA crosses the socket interconnect\n", rn_dev->numa_node);
+  }
 
-  // Lock the buffer in physical memory
-  if(mlock(rn_dev->base_buf->buffer, num_hugepages_request * (1 << HUGE_PAGE_SHIFT)) == -1) {
-    fprintf(stderr, "Error: failed to lock page in memory\n");
-    exit(EXIT_FAILURE);
+  // Look up the physical address of each hugepage once
+  rn_dev->hugepage_paddr = (uint64_t*) malloc(rn_dev->num_hugepages * sizeof(uint64_t));
+  if(rn_dev->hugepage_paddr == NULL) {
+    fprintf(stderr, "Error: failed to create rn_dev->hugepage_paddr\n");
+    goto err_unmap_buf;
+  }
+  for(i = 0; i < rn_dev->num_hugepages; i++) {
+    rn_dev->hugepage_paddr[i] = get_buffer_paddr((void*) ((uint64_t) rn_dev->base_buf->buffer + ((uint64_t) i << rn_dev->hugepage_shift)));
   }
 
-  rn_dev->base_buf->dma_addr = get_buffer_paddr(rn_dev->base_buf->buffer);
-  fprintf(stderr, "Info: pre-allocated hugepage buffer vir addr = %p, physical addr = 0x%lx\n", rn_dev->base_buf->buffer, rn_dev->base_buf->dma_addr);
+  rn_dev->base_buf->dma_addr = rn_dev->hugepage_paddr[0];
+  fprintf(stderr, "Info: pre-allocated %d x %luKB hugepage buffer vir addr = %p, physical addr = 0x%lx\n", rn_dev->num_hugepages, (1UL << rn_dev->hugepage_shift) >> 10, rn_dev->base_buf->buffer, rn_dev->base_buf->dma_addr);
 
   phy_addr_msb = (uint32_t) ((rn_dev->base_buf->dma_addr & 0xffffffff00000000) >> 32);
   phy_addr_lsb = (uint32_t) ((rn_dev->base_buf->dma_addr & 0x00000000ffffffff));
@@ -347,5 +487,19 @@ struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint3
   rn_dev->buffer_offset = (uint64_t) 0;
   rn_dev->dev_buffer_offset = (uint64_t) 0;
 
+  *pcie_resource_fd = scr;
   return rn_dev;
+
+err_unmap_buf:
+  munmap(rn_dev->base_buf->buffer, buf_size);
+err_free_base_buf:
+  free(rn_dev->base_buf);
+err_unmap_scr:
+  munmap(axil_scr_base, RN_SCR_MAP_SIZE);
+err_close:
+  close(scr);
+err_free:
+  free(winSize);
+  free(rn_dev);
+  return NULL;
 }
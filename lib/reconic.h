@@ -16,6 +16,8 @@
 #include "reconic_reg.h"
 #include "memory_api.h"
 #include "control_api.h"
+#include "dma_engine.h"
+#include "numa_api.h"
 
 /*! \var device
     \brief A global string used to represent a character device for device memory access
@@ -87,6 +89,19 @@ extern int fpga_fd;
 */
 #define HUGE_PAGE_SHIFT 21
 
+/*! \def HUGE_PAGE_SHIFT_2MB
+    \brief Page shift of a 2MB hugepage.
+*/
+#define HUGE_PAGE_SHIFT_2MB 21
+
+/*! \def HUGE_PAGE_SHIFT_1GB
+    \brief Page shift of a 1GB hugepage.
+
+    1GB hugepages have to be reserved at boot time (e.g., "hugepagesz=1G hugepages=4")
+    or through /sys/kernel/mm/hugepages/hugepages-1048576kB/nr_hugepages.
+*/
+#define HUGE_PAGE_SHIFT_1GB 30
+
 /*! \def DEVICE_MEM_OFFSET
     \brief Device memory address offset.
 */
@@ -135,6 +150,10 @@ struct rn_dev_t {
   uint64_t dev_buffer_offset;   /*!< dev_buffer_offset offset of a free device buffer. */
   unsigned char num_qp;         /*!< num_qp Number of RDMA queue pairs required. */
   struct win_size_t* winSize;   /*!< Window size mask for PCIe BDF address conversion. */
+  int numa_node;                /*!< numa_node NUMA node the device is attached to, -1 if unknown. */
+  uint32_t hugepage_shift;      /*!< hugepage_shift Page shift of the pre-allocated hugepage buffer. */
+  uint32_t num_hugepages;       /*!< num_hugepages Number of hugepages in the pre-allocated buffer. */
+  uint64_t* hugepage_paddr;     /*!< hugepage_paddr Physical address of each pre-allocated hugepage. */
 };
 
 /** @brief Convert IP address from string to unsigned int.
@@ -195,21 +214,53 @@ void config_rn_dev_axib_bdf(struct rn_dev_t* rn_dev, uint32_t high_addr, uint32_
 
 /** @brief Allocate a buffer for RDMA communication.
  *  @param rn_dev A pointer to the RecoNIC device.
- *  @param buf_size buffer size.
+ *  @param buf_size buffer size, at most UINT32_MAX bytes.
  *  @param buf_location buffer location, either host memory ("host_mem") 
  *                      or device memory ("dev_mem").
  *  @return a pointer to the RDMA buffer allocated.
  */
 struct rdma_buff_t* allocate_rdma_buffer(struct rn_dev_t* rn_dev, uint64_t buf_size, char* buf_location);
 
+/** @brief Map a hugepage buffer, prefault it and lock it in physical memory.
+ *
+ *  The buffer is either anonymous (MAP_HUGETLB with the requested page size) or,
+ *  if hugetlbfs_path is given, backed by an unlinked file on a hugetlbfs mount,
+ *  whose page size is set by the mount. Every page is touched and locked before
+ *  the function returns, so no page fault is taken in the data path.
+ *  @param size Size of the buffer in bytes, a multiple of the hugepage size.
+ *  @param hugepage_shift Requested page shift (HUGE_PAGE_SHIFT_2MB or HUGE_PAGE_SHIFT_1GB).
+ *                        Updated with the page shift of the hugetlbfs mount if one is used.
+ *  @param hugetlbfs_path Directory of a hugetlbfs mount (e.g., /dev/hugepages1G), or NULL
+ *                        for anonymous hugepages.
+ *  @param numa_node NUMA node to bind the buffer to, or -1 for the default policy.
+ *  @return Virtual address of the buffer, or NULL on failure.
+ */
+void* map_hugepages(uint64_t size, uint32_t* hugepage_shift, char* hugetlbfs_path, int numa_node);
+
 /** @brief Create a RecoNIC device.
  *  @param pcie_resource Path to resource2 of a PCIe device.
  *  @param rn_scr File descriptor of the PCIe device resource2 for FPGA register access.
  *  @param num_hugepages_request Pre-allocate a hugepage buffer with the size of 
  *                               num_hugepages_request * per_hugepage_size
  *  @param num_qp Number of RDMA queue pairs required.
- *  @return A RecoNIC device pointer.
+ *  @return A RecoNIC device pointer, or NULL on failure.
  */
 struct rn_dev_t* create_rn_dev(char* pcie_resource, int* pcie_resource_fd, uint32_t num_hugepages_request, uint32_t num_qp);
 
+/** @brief Create a RecoNIC device with a selectable hugepage size.
+ *  @param pcie_resource Path to resource2 of a PCIe device.
+ *  @param rn_scr File descriptor of the PCIe device resource2 for FPGA register access.
+ *  @param num_hugepages_request Pre-allocate a hugepage buffer with the size of 
+ *                               num_hugepages_request * (1 << hugepage_shift)
+ *  @param hugepage_shift Page shift of the hugepages (HUGE_PAGE_SHIFT_2MB or HUGE_PAGE_SHIFT_1GB),
+ *                        ignored if hugetlbfs_path is given.
+ *  @param hugetlbfs_path Directory of a hugetlbfs mount backing the buffer, or NULL
+ *                        for anonymous hugepages. The hugepage size is taken from the mount.
+ *  @param num_qp Number of RDMA queue pairs required.
+ *  @return A RecoNIC device pointer, or NULL on failure.
+ */
+struct rn_dev_t* create_rn_dev_with_hugepages(char* pcie_resource, int* pcie_resource_fd,
+                                              uint32_t num_hugepages_request, uint32_t hugepage_shift,
+                                              char* hugetlbfs_path, uint32_t num_qp);
+
 #endif /* __RECONIC_H__ */
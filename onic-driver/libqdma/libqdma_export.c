@@ -2491,6 +2491,56 @@ unmap_sgl:
 	return rv;
 }
 
+/*****************************************************************************/
+/**
+ * qdma_request_cancel() - cancel a non-blocking request that has not
+ *			completed yet
+ *
+ * @param[in]	dev_hndl:	dev_hndl returned from qdma_device_open()
+ * @param[in]	id:		queue index
+ * @param[in]	req:		qdma request submitted with fp_done set
+ *
+ * @return	1: request cancelled, fp_done will not be called
+ * @return	0: request already completed
+ * @return	<0: error
+ *****************************************************************************/
+int qdma_request_cancel(unsigned long dev_hndl, unsigned long id,
+			struct qdma_request *req)
+{
+	struct xlnx_dma_dev *xdev = (struct xlnx_dma_dev *)dev_hndl;
+	struct qdma_descq *descq;
+	struct qdma_sgt_req_cb *cb;
+	int cancelled = 0;
+
+	if (!xdev || !req)
+		return -EINVAL;
+
+	descq = qdma_device_get_descq_by_id(xdev, id, NULL, 0, 1);
+	if (!descq)
+		return -EINVAL;
+
+	cb = qdma_req_cb_get(req);
+
+	/** same clean up as a timed out blocking request */
+	lock_descq(descq);
+	if (!cb->done) {
+		list_del(&cb->list);
+		cb->status = -ECANCELED;
+		cb->done = 1;
+		cancelled = 1;
+	}
+	unlock_descq(descq);
+
+	if (cancelled && cb->unmap_needed) {
+		sgl_unmap(xdev->conf.pdev, req->sgl, req->sgcnt,
+			(descq->conf.q_type == Q_C2H) ?
+			DMA_FROM_DEVICE : DMA_TO_DEVICE);
+		cb->unmap_needed = 0;
+	}
+
+	return cancelled;
+}
+
 /*****************************************************************************/
 /**
  * qdma_batch_request_submit() - submit a batch of scatter-gather list of data
@@ -2596,7 +2646,10 @@ ssize_t qdma_batch_request_submit(unsigned long dev_hndl, unsigned long id,
 						descq->conf.name,
 						req->sgcnt,
 						req->count);
+					/** completed with error, not queued */
+					cb->done = 1;
 					req->fp_done(req, 0, rv);
+					continue;
 				}
 				cb->unmap_needed = 1;
 			}
@@ -2609,6 +2662,15 @@ ssize_t qdma_batch_request_submit(unsigned long dev_hndl, unsigned long id,
 		unlock_descq(descq);
 		pr_err("%s descq %s NOT online.\n", xdev->conf.name,
 				descq->conf.name);
+		for (i = 0; i < count; i++) {
+			req = reqv[i];
+			cb = qdma_req_cb_get(req);
+			if (cb->unmap_needed) {
+				sgl_unmap(xdev->conf.pdev, req->sgl,
+					req->sgcnt, dir);
+				cb->unmap_needed = 0;
+			}
+		}
 		return -EINVAL;
 	}
 
@@ -2616,6 +2678,8 @@ ssize_t qdma_batch_request_submit(unsigned long dev_hndl, unsigned long id,
 		req = reqv[i];
 		cb = qdma_req_cb_get(req);
 
+		if (cb->done)
+			continue;
 		list_add_tail(&cb->list, &descq->work_list);
 	}
 	unlock_descq(descq);
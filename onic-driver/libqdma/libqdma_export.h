@@ -549,6 +549,8 @@ struct qdma_sw_sg {
 	unsigned int len;
 	/** dma address of the allocated page */
 	dma_addr_t dma_addr;
+	/** buffer owner data of the ULD, see fp_c2h_buf_alloc */
+	void *priv;
 };
 
 /** struct qdma_request forward declaration
@@ -656,6 +658,13 @@ struct qdma_queue_conf {
 	unsigned long quld;		/* set by user for per Q data */
 	/**  acummulate PIDX to batch packets */
 	u32 pidx_acc:8;
+	/**
+	 *  ST C2H only: bytes left free in front of each buffer, e.g. for
+	 *  XDP. The buffers are laid out at a stride of
+	 *  c2h_bufsz + c2h_headroom rounded up to a power of 2, and
+	 *  qdma_sw_sg.offset points past the headroom.
+	 */
+	u32 c2h_headroom;
 	/**
 	 *  @brief  Q interrupt top, per-queue additional handling
 	 *  code for example, network rx napi_schedule(&Q->napi)
@@ -699,6 +708,38 @@ struct qdma_queue_conf {
 	int (*fp_descq_c2h_packet)(unsigned long qhndl, unsigned long quld,
 				unsigned int len, unsigned int sgcnt,
 				struct qdma_sw_sg *sgl, void *udd);
+	/**
+	 * @brief optional, ST C2H with fp_descq_c2h_packet only: the free
+	 * list buffers are provided by the ULD instead of pages allocated by
+	 * libqdma, e.g. for AF_XDP zero-copy
+	 *
+	 * @param  qhndl	Queue handle
+	 * @param  quld		Queue ID
+	 * @param  sg		free list entry to fill in: dma_addr of a buffer
+	 *			of at least c2h_bufsz bytes, pg, offset and
+	 *			priv as the ULD needs them
+	 *
+	 * @returns
+	 *	0 on success
+	 *	< 0 if no buffer is available, the descriptor is retried on
+	 *	the next completion processing and not posted until then
+	 *
+	 * @note buffers handed up through fp_descq_c2h_packet belong to the
+	 *	ULD, the others are given back with fp_c2h_buf_free when the
+	 *	queue stops. c2h_headroom does not apply to them.
+	 */
+	int (*fp_c2h_buf_alloc)(unsigned long qhndl, unsigned long quld,
+				struct qdma_sw_sg *sg);
+	/**
+	 * @brief release a buffer of fp_c2h_buf_alloc that did not receive
+	 * a packet
+	 *
+	 * @param  qhndl	Queue handle
+	 * @param  quld		Queue ID
+	 * @param  sg		free list entry filled by fp_c2h_buf_alloc
+	 */
+	void (*fp_c2h_buf_free)(unsigned long qhndl, unsigned long quld,
+				struct qdma_sw_sg *sg);
 	/**
 	 * @brief fill the all the descriptors required for
 	 *                        transfer
@@ -787,6 +828,10 @@ struct qdma_request {
 	unsigned int count;
 	/**  MM only, DDR/BRAM memory addr */
 	u64 ep_addr;
+	/**  MM only, keyhole aperture size in bytes (power of 2) overriding
+	 *   the queue aperture_size, 0 - use the queue configuration
+	 */
+	u32 aperture_size;
 	/**  flag to indicate if memcpy is required */
 	u8 no_memcpy:1;
 	/**  if write to the device */
@@ -797,7 +842,11 @@ struct qdma_request {
 	u8 h2c_eot:1;
 	/** state check disbaled in queue pkt API */
 	u8 check_qstate_disabled:1;
-	u8 _pad:3;
+	/** ST H2C only, more requests follow: defer the PIDX update to the
+	 *  last request of the burst
+	 */
+	u8 xmit_more:1;
+	u8 _pad:2;
 	/** user defined data present */
 	u8 udd_len;
 	/**  number of scatter-gather entries < 64K */
@@ -1465,6 +1514,21 @@ ssize_t qdma_request_submit(unsigned long dev_hndl, unsigned long id,
 ssize_t qdma_batch_request_submit(unsigned long dev_hndl, unsigned long id,
 			  unsigned long count, struct qdma_request **reqv);
 
+/*****************************************************************************/
+/**
+ * Cancel a non-blocking request that has not completed yet
+ *
+ * @param dev_hndl	hndl returned from qdma_device_open()
+ * @param id		queue index
+ * @param req		qdma request submitted with fp_done set
+ *
+ * @returns		1 if the request was cancelled, 0 if it had already
+ *			completed (fp_done has returned) and <0 for error
+ *
+ *****************************************************************************/
+int qdma_request_cancel(unsigned long dev_hndl, unsigned long id,
+			struct qdma_request *req);
+
 /*****************************************************************************/
 /**
  * Peek a receive (c2h) queue
@@ -1563,6 +1627,9 @@ int qdma_queue_service(unsigned long dev_hndl, unsigned long id,
 /**
  * Update queue pointers
  *
+ * For ST H2C queues, writes the PIDX deferred by requests submitted with
+ * xmit_more set.
+ *
  * @param dev_hndl	dev_hndl returned from qdma_device_open()
  * @param qhndl		hndl returned from qdma_queue_add()
  *
@@ -75,6 +75,16 @@
 #endif  /* swaitq */
 #endif
 
+/*
+ * C2H free list pages are taken pre-mapped from a page_pool. They only go
+ * back to it when the free list replaces a page whose buffers the stack has
+ * already freed; skbs are not marked for recycling, so pages still held by
+ * the stack are unmapped and freed as before (see flq_put_page_one()).
+ */
+#if KERNEL_VERSION(5, 7, 0) <= LINUX_VERSION_CODE
+#define QDMA_FLQ_PAGE_POOL
+#endif
+
 /* timer */
 #if KERNEL_VERSION(4, 15, 0) <= LINUX_VERSION_CODE
 #define qdma_timer_setup(timer, fp_handler, data) \
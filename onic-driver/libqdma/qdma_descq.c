@@ -192,9 +192,8 @@ static ssize_t descq_mm_proc_request(struct qdma_descq *descq)
 	struct qdma_queue_conf *qconf = &descq->conf;
 	unsigned char is_ul_ext = (qconf->desc_bypass &&
 			qconf->fp_bypass_desc_fill) ? 1 : 0;
-	u32 aperture = qconf->aperture_size ?
-				 qconf->aperture_size : QDMA_DESC_BLEN_MAX;
-	u8 keyhole_en = qconf->aperture_size ? 1 : 0;
+	u32 aperture;
+	u8 keyhole_en;
 	u64 ep_addr_max = 0;
 
 	lock_descq(descq);
@@ -235,6 +234,12 @@ static ssize_t descq_mm_proc_request(struct qdma_descq *descq)
 		int i = 0;
 		int rv;
 
+		/* a request may override the queue keyhole aperture */
+		aperture = req->aperture_size ? req->aperture_size :
+						qconf->aperture_size;
+		keyhole_en = aperture ? 1 : 0;
+		if (!aperture)
+			aperture = QDMA_DESC_BLEN_MAX;
 		ep_addr_max = req->ep_addr + aperture - 1;
 
 		/**
@@ -488,10 +493,17 @@ static ssize_t descq_proc_st_h2c_request(struct qdma_descq *descq)
 	unsigned char is_ul_ext = (qconf->desc_bypass &&
 			qconf->fp_bypass_desc_fill) ? 1 : 0;
 	struct qdma_dev *qdev = NULL;
+	u8 xmit_more = 0;
 
 	lock_descq(descq);
 	/* process completion of submitted requests */
 	if (descq->q_stop_wait) {
+		/* hand the rest of a cut off burst to the hw */
+		if (descq->pidx_deferred) {
+			queue_pidx_update(descq->xdev, descq->conf.qidx,
+					descq->conf.q_type, &descq->pidx_info);
+			descq->pidx_deferred = 0;
+		}
 		descq_mm_n_h2c_cmpl_status(descq);
 		unlock_descq(descq);
 		return 0;
@@ -536,6 +548,7 @@ static ssize_t descq_proc_st_h2c_request(struct qdma_descq *descq)
 		if (!desc_max)
 			break;
 
+		xmit_more = req->xmit_more;
 #ifdef DEBUG
 		pr_info("%s, req %u.\n", descq->conf.name, req->count);
 		sgl_dump(req->sgl, sg_max);
@@ -662,8 +675,18 @@ update_pidx:
 			} else
 				pr_err("Err: Tx Time Offset is NULL\n");
 		}
+	}
 
-
+	/*
+	 * More requests follow: leave the PIDX update to the last request of
+	 * the burst, unless requests are left waiting for descriptors or the
+	 * ring is filling up.
+	 */
+	if (xmit_more && list_empty(&descq->work_list) &&
+	    descq->avail >= (rngsz >> 2)) {
+		if (desc_written)
+			descq->pidx_deferred = 1;
+	} else if (desc_written || descq->pidx_deferred) {
 		ret = queue_pidx_update(descq->xdev, descq->conf.qidx,
 				descq->conf.q_type, &descq->pidx_info);
 		if (ret < 0) {
@@ -672,6 +695,7 @@ update_pidx:
 			unlock_descq(descq);
 			return -EINVAL;
 		}
+		descq->pidx_deferred = 0;
 		descq_poll_mm_n_h2c_cmpl_status(descq);
 	}
 
@@ -949,7 +973,11 @@ int qdma_q_init_pointers(void *q_hndl)
 			if (descq->conf.q_type == Q_CMPT)
 				return 0;
 
-			descq->pidx_info.pidx = descq->conf.rngsz - 1;
+			/* ULD buffers: only what descq_flq_alloc_resource()
+			 * could fill
+			 */
+			if (!descq->conf.fp_c2h_buf_alloc)
+				descq->pidx_info.pidx = descq->conf.rngsz - 1;
 			rv = queue_pidx_update(descq->xdev, descq->conf.qidx,
 					descq->conf.q_type, &descq->pidx_info);
 			if (unlikely(rv < 0)) {
@@ -981,7 +1009,23 @@ int qdma_queue_update_pointers(unsigned long dev_hndl, unsigned long qhndl)
 		return -EINVAL;
 	}
 
-	if (descq->conf.st && (descq->conf.q_type == Q_C2H)) {
+	if (descq->conf.st && (descq->conf.q_type == Q_H2C)) {
+		/* PIDX deferred by an xmit_more burst */
+		lock_descq(descq);
+		if (descq->q_state == Q_STATE_ONLINE && descq->pidx_deferred) {
+			ret = queue_pidx_update(descq->xdev,
+					descq->conf.qidx,
+					descq->conf.q_type,
+					&descq->pidx_info);
+			if (ret < 0) {
+				pr_err("%s: Failed to update pidx\n",
+						descq->conf.name);
+				ret = -EBUSY;
+				goto func_exit;
+			}
+			descq->pidx_deferred = 0;
+		}
+	} else if (descq->conf.st && (descq->conf.q_type == Q_C2H)) {
 		lock_descq(descq);
 		if (descq->q_state == Q_STATE_ONLINE) {
 			ret = queue_cmpt_cidx_update(descq->xdev,
@@ -1059,7 +1103,8 @@ int qdma_descq_alloc_resource(struct qdma_descq *descq)
 		flq->buf_pg_shift = fls(descq->conf.c2h_bufsz) - 1;
 		flq->buf_pg_mask = (1 << flq->buf_pg_shift) - 1;
 
-		flq->desc_buf_size = get_next_powof2(descq->conf.c2h_bufsz);
+		flq->desc_buf_size = get_next_powof2(descq->conf.c2h_bufsz +
+						descq->conf.c2h_headroom);
 		flq->desc_pg_shift = fls(flq->desc_buf_size) - 1;
 
 		/* These code changes are to accomodate buf_sz
@@ -1259,6 +1304,9 @@ void qdma_descq_config(struct qdma_descq *descq, struct qdma_queue_conf *qconf,
 		descq->conf.ping_pong_en = qconf->ping_pong_en;
 		descq->conf.aperture_size = qconf->aperture_size;
 		descq->conf.pidx_acc = qconf->pidx_acc;
+		descq->conf.c2h_headroom = qconf->c2h_headroom;
+		descq->conf.fp_c2h_buf_alloc = qconf->fp_c2h_buf_alloc;
+		descq->conf.fp_c2h_buf_free = qconf->fp_c2h_buf_free;
 	}
 }
 
@@ -1316,6 +1364,7 @@ int qdma_descq_config_complete(struct qdma_descq *descq)
 	descq->pend_list_empty = 1;
 
 	descq->pidx = 0;
+	descq->pidx_deferred = 0;
 	descq->cidx = 0;
 	descq->cidx_cmpt = 0;
 	descq->pidx_cmpt = 0;
@@ -1401,7 +1450,11 @@ int qdma_descq_prog_hw(struct qdma_descq *descq)
 			if (descq->conf.q_type == Q_CMPT)
 				return rv;
 
-			descq->pidx_info.pidx = descq->conf.rngsz - 1;
+			/* ULD buffers: only what descq_flq_alloc_resource()
+			 * could fill
+			 */
+			if (!descq->conf.fp_c2h_buf_alloc)
+				descq->pidx_info.pidx = descq->conf.rngsz - 1;
 			rv = queue_pidx_update(descq->xdev, descq->conf.qidx,
 					descq->conf.q_type, &descq->pidx_info);
 			if (unlikely(rv < 0)) {
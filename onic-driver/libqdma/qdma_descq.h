@@ -49,7 +49,7 @@ struct q_state_name {
 
 extern struct q_state_name q_state_list[];
 
-#define QDMA_FLQ_SIZE 124
+#define QDMA_FLQ_SIZE 136
 
 /**
  * @struct - qdma_descq
@@ -72,6 +72,8 @@ struct qdma_descq {
 	u8 cpu_assigned:1;
 	/** state of the proc req */
 	u8 proc_req_running;
+	/** ST H2C: descriptors written with the PIDX update deferred */
+	u8 pidx_deferred;
 	/* rx_time in CPU timestamp of ping_pong pkt for
 	 * measuring H2C-C2H loopback latency
 	 */
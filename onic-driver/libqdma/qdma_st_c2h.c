@@ -37,6 +37,14 @@
 #include "qdma_ul_ext.h"
 #include "version.h"
 
+#ifdef QDMA_FLQ_PAGE_POOL
+#if KERNEL_VERSION(6, 6, 0) <= LINUX_VERSION_CODE
+#include <net/page_pool/helpers.h>
+#else
+#include <net/page_pool.h>
+#endif
+#endif
+
 /*
  * ST C2H descq (i.e., freelist) RX buffers
  */
@@ -106,8 +114,8 @@ static inline int flq_fill_one(struct qdma_descq *descq,
 
 
 	sdesc->pg = pg_sdesc->pg_base;
-	sdesc->offset = pg_sdesc->pg_offset;
-	sdesc->dma_addr = pg_sdesc->pg_dma_base_addr + pg_sdesc->pg_offset;
+	sdesc->offset = pg_sdesc->pg_offset + descq->conf.c2h_headroom;
+	sdesc->dma_addr = pg_sdesc->pg_dma_base_addr + sdesc->offset;
 	sdesc->len = descq->conf.c2h_bufsz;
 	desc->dst_addr = sdesc->dma_addr;
 #if KERNEL_VERSION(4, 6, 0) < LINUX_VERSION_CODE
@@ -123,10 +131,58 @@ static inline int flq_fill_one(struct qdma_descq *descq,
 	return 0;
 }
 
-static inline void flq_unmap_page_one(struct qdma_sw_pg_sg *pg_sdesc,
+/*
+ * ULD provided buffers (fp_c2h_buf_alloc): the descriptors consumed by the
+ * device are refilled in order from fill_idx, the ones the ULD has no
+ * buffer for yet stay unposted until the next call
+ */
+static int flq_ext_refill(struct qdma_descq *descq)
+{
+	struct qdma_flq *flq = (struct qdma_flq *)descq->flq;
+	struct qdma_sw_sg *sdesc;
+	int filled = 0;
+
+	while (flq->fill_cnt) {
+		sdesc = flq->sdesc + flq->fill_idx;
+		if (descq->conf.fp_c2h_buf_alloc(descq->q_hndl,
+				descq->conf.quld, sdesc) < 0)
+			break;
+
+		sdesc->len = descq->conf.c2h_bufsz;
+		flq->desc[flq->fill_idx].dst_addr = sdesc->dma_addr;
+		flq->sdesc_info[flq->fill_idx].fbits = 0;
+		flq->fill_idx = ring_idx_incr(flq->fill_idx, 1, flq->size);
+		flq->fill_cnt--;
+		filled++;
+	}
+
+	/* one descriptor of a fully posted ring is kept back, as without
+	 * ULD buffers
+	 */
+	descq->avail = flq->size - flq->fill_cnt - (flq->fill_cnt ? 0 : 1);
+
+	return filled;
+}
+
+/* pidx to write with ULD provided buffers */
+static inline unsigned int flq_ext_pidx(struct qdma_flq *flq)
+{
+	return flq->fill_cnt ? flq->fill_idx :
+		ring_idx_decr(flq->fill_idx, 1, flq->size);
+}
+
+static inline void flq_unmap_page_one(struct qdma_flq *flq,
+				struct qdma_sw_pg_sg *pg_sdesc,
 				struct device *dev,
 				unsigned char pg_order)
 {
+#ifdef QDMA_FLQ_PAGE_POOL
+	/* pool pages stay mapped until they leave the pool */
+	if (flq->pp) {
+		pg_sdesc->pg_dma_base_addr = 0UL;
+		return;
+	}
+#endif
 	if (pg_sdesc && pg_sdesc->pg_dma_base_addr) {
 		dma_unmap_page(dev, pg_sdesc->pg_dma_base_addr,
 				PAGE_SIZE << pg_order,
@@ -135,7 +191,29 @@ static inline void flq_unmap_page_one(struct qdma_sw_pg_sg *pg_sdesc,
 	}
 }
 
-static inline void flq_free_page_one(struct qdma_sw_pg_sg *pg_sdesc,
+/* drop the reference of the free list on the page of pg_sdesc */
+static inline void flq_put_page_one(struct qdma_flq *flq,
+				struct qdma_sw_pg_sg *pg_sdesc)
+{
+#ifdef QDMA_FLQ_PAGE_POOL
+	/*
+	 * back to the pool if the stack has freed all buffers of the page by
+	 * now, otherwise unmapped and released with its last reference.
+	 * Recycling only happens here: skbs are not marked for recycling, as
+	 * every buffer holds a plain page reference and page_pool would unmap
+	 * a page on the first skb free while its other buffers are still
+	 * posted to the card.
+	 */
+	if (flq->pp) {
+		page_pool_put_full_page(flq->pp, pg_sdesc->pg_base, false);
+		return;
+	}
+#endif
+	put_page(pg_sdesc->pg_base);
+}
+
+static inline void flq_free_page_one(struct qdma_flq *flq,
+				struct qdma_sw_pg_sg *pg_sdesc,
 				struct device *dev,
 				unsigned char pg_order,
 				unsigned int pg_shift)
@@ -144,13 +222,15 @@ static inline void flq_free_page_one(struct qdma_sw_pg_sg *pg_sdesc,
 	unsigned int i = 0;
 
 	if (pg_sdesc && pg_sdesc->pg_base) {
-		/* +1 for dma_unmap*/
-		page_count = (pg_sdesc->pg_offset >> pg_shift) + 1;
+		/* buffers still owned by the free list */
+		page_count = (pg_sdesc->pg_offset >> pg_shift);
 
-		flq_unmap_page_one(pg_sdesc, dev, pg_order);
+		flq_unmap_page_one(flq, pg_sdesc, dev, pg_order);
 
 		for (i = 0; i < page_count; i++)
 			put_page(pg_sdesc->pg_base);
+		/* +1 for dma_unmap*/
+		flq_put_page_one(flq, pg_sdesc);
 
 		pg_sdesc->pg_base = NULL;
 		pg_sdesc->pg_dma_base_addr = 0UL;
@@ -164,14 +244,22 @@ void descq_flq_free_page_resource(struct qdma_descq *descq)
 	struct qdma_flq *flq = (struct qdma_flq *)descq->flq;
 	struct qdma_sw_pg_sg *pg_sdesc = flq->pg_sdesc;
 	unsigned char pg_order = flq->desc_pg_order;
+#ifdef QDMA_FLQ_PAGE_POOL
+	struct page_pool *pp = flq->pp;
+#endif
 	int i;
 
 	for (i = 0; i < flq->num_pages; i++, pg_sdesc++)
-		flq_free_page_one(pg_sdesc, dev,
+		flq_free_page_one(flq, pg_sdesc, dev,
 				pg_order, flq->desc_pg_shift);
 
 	kfree(flq->pg_sdesc);
 	flq->pg_sdesc = NULL;
+#ifdef QDMA_FLQ_PAGE_POOL
+	/* pages still held by the stack return to the pool when freed */
+	if (pp)
+		page_pool_destroy(pp);
+#endif
 
 	memset(flq, 0, sizeof(struct qdma_flq));
 }
@@ -190,6 +278,17 @@ void descq_flq_free_resource(struct qdma_descq *descq)
 		return;
 	}
 
+	/* ULD buffers still posted to the device go back to the ULD */
+	if (descq->conf.fp_c2h_buf_alloc && descq->conf.fp_c2h_buf_free) {
+		unsigned int idx = flq->pidx_pend;
+
+		for (i = flq->size - flq->fill_cnt; i > 0; i--) {
+			descq->conf.fp_c2h_buf_free(descq->q_hndl,
+					descq->conf.quld, flq->sdesc + idx);
+			idx = ring_idx_incr(idx, 1, flq->size);
+		}
+	}
+
 	for (i = 0; i < flq->size; i++, sdesc++, desc++)
 		flq_free_one(sdesc, desc);
 
@@ -200,13 +299,30 @@ void descq_flq_free_resource(struct qdma_descq *descq)
 }
 
 
-static inline int flq_fill_page_one(struct qdma_sw_pg_sg *pg_sdesc,
+static inline int flq_fill_page_one(struct qdma_flq *flq,
+				struct qdma_sw_pg_sg *pg_sdesc,
 				struct device *dev,
 				int node, unsigned char pg_order, gfp_t gfp)
 {
 	struct page *pg;
 	dma_addr_t mapping;
 
+#ifdef QDMA_FLQ_PAGE_POOL
+	if (flq->pp) {
+		pg = page_pool_alloc_pages(flq->pp, gfp | __GFP_NOWARN);
+		if (unlikely(!pg)) {
+			pr_err("%s: failed to allocate the pages, order %d.\n",
+					__func__,
+					pg_order);
+			return -ENOMEM;
+		}
+		pg_sdesc->pg_base = pg;
+		pg_sdesc->pg_dma_base_addr = page_pool_get_dma_addr(pg);
+		pg_sdesc->pg_offset = 0;
+		return 0;
+	}
+#endif
+
 	pg = alloc_pages_node(node, __GFP_COMP | gfp, pg_order);
 	if (unlikely(!pg)) {
 		pr_err("%s: failed to allocate the pages, order %d.\n",
@@ -250,6 +366,10 @@ int descq_flq_alloc_resource(struct qdma_descq *descq)
 	/* find the most significant bit number */
 	unsigned int div_bits = 0;
 
+	/* no pages when the ULD provides the buffers */
+	if (descq->conf.fp_c2h_buf_alloc)
+		goto alloc_sdesc;
+
 	div_bits = flq->desc_pg_shift;
 	flq->num_bufs_per_pg =
 			(flq->max_pg_offset >> div_bits);
@@ -297,9 +417,32 @@ int descq_flq_alloc_resource(struct qdma_descq *descq)
 	}
 	flq->pg_sdesc = pg_sdesc;
 
+#ifdef QDMA_FLQ_PAGE_POOL
+	{
+		struct page_pool_params pp_params = {
+			.order = flq->desc_pg_order,
+			.flags = PP_FLAG_DMA_MAP | PP_FLAG_DMA_SYNC_DEV,
+			.pool_size = flq->num_pages,
+			.nid = node,
+			.dev = dev,
+			.dma_dir = DMA_FROM_DEVICE,
+			.offset = 0,
+			.max_len = PAGE_SIZE << flq->desc_pg_order,
+		};
+		struct page_pool *pp = page_pool_create(&pp_params);
+
+		/* fall back to pages mapped by hand */
+		if (IS_ERR(pp))
+			pr_warn("%s: page_pool_create failed %ld.\n",
+				descq->conf.name, PTR_ERR(pp));
+		else
+			flq->pp = pp;
+	}
+#endif
+
 	for (pg_sdesc = flq->pg_sdesc, i = 0;
 			i < flq->num_pages; i++, pg_sdesc++) {
-		rv = flq_fill_page_one(pg_sdesc, dev, node,
+		rv = flq_fill_page_one(flq, pg_sdesc, dev, node,
 				flq->desc_pg_order, GFP_KERNEL);
 		if (rv < 0) {
 			descq_flq_free_page_resource(descq);
@@ -307,6 +450,7 @@ int descq_flq_alloc_resource(struct qdma_descq *descq)
 		}
 	}
 
+alloc_sdesc:
 	sdesc = kzalloc_node(flq->size * (sizeof(struct qdma_sw_sg) +
 					  sizeof(struct qdma_sdesc_info)),
 				GFP_KERNEL, node);
@@ -337,6 +481,15 @@ int descq_flq_alloc_resource(struct qdma_descq *descq)
 	prev->next = flq->sdesc;
 	sprev->next = flq->sdesc_info;
 
+	/* the ULD may fill the ring later, see qdma_descq_prog_hw() */
+	if (descq->conf.fp_c2h_buf_alloc) {
+		flq->fill_idx = 0;
+		flq->fill_cnt = flq->size;
+		flq_ext_refill(descq);
+		descq->pidx_info.pidx = flq_ext_pidx(flq);
+		return 0;
+	}
+
 	for (sdesc = flq->sdesc, i = 0; i < flq->size; i++, sdesc++, desc++) {
 		rv = flq_fill_one(descq, sdesc, desc);
 		if (rv < 0) {
@@ -407,9 +560,10 @@ static inline int flq_refill_pages(struct qdma_descq *descq,
 				flq->recycle_idx == flq->alloc_idx)
 				break;
 
-			flq_unmap_page_one(pg_sdesc, dev, flq->desc_pg_order);
-			put_page(pg_sdesc->pg_base);
-			rv = flq_fill_page_one(pg_sdesc,
+			flq_unmap_page_one(flq, pg_sdesc, dev,
+					flq->desc_pg_order);
+			flq_put_page_one(flq, pg_sdesc);
+			rv = flq_fill_page_one(flq, pg_sdesc,
 					dev, node, flq->desc_pg_order, gfp);
 			if (rv < 0)
 				break;
@@ -706,7 +860,8 @@ static int get_fl_nr(unsigned int len,
 	unsigned int l_len = len;
 	int l_fl_nr = 1;
 
-	if ((len & (len-1)) == 0) {
+	/* the shortcut needs a power of 2 buffer size as well */
+	if ((len & (len-1)) == 0 && (c2h_bufsz & (c2h_bufsz - 1)) == 0) {
 		/* pr_info("Len is ^2"); */
 		l_fl_nr = len ? ((len + pg_mask) >> pg_shift) : 1;
 		l_len = (len & pg_mask);
@@ -742,7 +897,8 @@ static int rcv_pkt(struct qdma_descq *descq, struct qdma_ul_cmpt_info *cmpl,
 {
 	unsigned int pidx = cmpl->pidx;
 	struct qdma_flq *flq = (struct qdma_flq *)descq->flq;
-	unsigned int pg_shift = flq->desc_pg_shift;
+	/* buffers may be laid out at a larger stride, see c2h_headroom */
+	unsigned int pg_shift = flq->buf_pg_shift;
 	unsigned int pg_mask = (1 << pg_shift) - 1;
 	unsigned int rngsz = descq->conf.rngsz;
 	/* zero length still uses one descriptor */
@@ -1040,6 +1196,22 @@ int descq_process_completion_st_c2h(struct qdma_descq *descq, int budget,
 		return -EINVAL;
 	}
 
+	/*
+	 * retry the descriptors the ULD had no buffers for, the queue may not
+	 * receive anything until they are posted
+	 */
+	if (descq->conf.fp_c2h_buf_alloc && flq->fill_cnt &&
+	    flq_ext_refill(descq) > 0 && upd_cmpl && !descq->q_stop_wait) {
+		descq->pidx_info.pidx = flq_ext_pidx(flq);
+		rv = queue_pidx_update(descq->xdev, descq->conf.qidx,
+				descq->conf.q_type, &descq->pidx_info);
+		if (unlikely(rv < 0)) {
+			pr_err("%s: Failed to update pidx\n",
+					descq->conf.name);
+			return -EINVAL;
+		}
+	}
+
 	dma_rmb();
 	pend = ring_idx_delta(pidx_cmpt, cidx_cmpt, rngsz_cmpt);
 	if (!pend) {
@@ -1156,12 +1328,20 @@ int descq_process_completion_st_c2h(struct qdma_descq *descq, int budget,
 		if (flq->pidx_pend != pidx_pend) {
 			pend = ring_idx_delta(flq->pidx_pend, pidx_pend,
 						flq->size);
-			qdma_flq_refill(descq, pidx_pend, pend,
-					uld_handler ? 0 : 1, GFP_ATOMIC);
+			if (descq->conf.fp_c2h_buf_alloc) {
+				flq->fill_cnt += pend;
+				flq_ext_refill(descq);
+			} else
+				qdma_flq_refill(descq, pidx_pend, pend,
+						uld_handler ? 0 : 1,
+						GFP_ATOMIC);
 
 			if (upd_cmpl && !descq->q_stop_wait) {
-				pend = ring_idx_decr(flq->pidx_pend, 1,
-						     flq->size);
+				if (descq->conf.fp_c2h_buf_alloc)
+					pend = flq_ext_pidx(flq);
+				else
+					pend = ring_idx_decr(flq->pidx_pend, 1,
+							     flq->size);
 				descq->pidx_info.pidx = pend;
 				if (!descq->conf.fp_descq_c2h_packet) {
 					ret = queue_pidx_update(descq->xdev,
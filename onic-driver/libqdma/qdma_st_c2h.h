@@ -128,8 +128,16 @@ struct qdma_flq {
 	unsigned int pidx;
 	/** RW: pending pidxes */
 	unsigned int pidx_pend;
+	/** RW: ULD buffers: first descriptor waiting for a buffer */
+	unsigned int fill_idx;
+	/** RW: ULD buffers: # of descriptors waiting for a buffer */
+	unsigned int fill_cnt;
 	/** RW: Page list */
 	struct qdma_sw_pg_sg *pg_sdesc;
+#ifdef QDMA_FLQ_PAGE_POOL
+	/** RW: pool of pre-mapped pages backing pg_sdesc */
+	struct page_pool *pp;
+#endif
 	/** RW: sw scatter gather list */
 	struct qdma_sw_sg *sdesc;
 	/** RW: sw descriptor info */
@@ -1,18 +1,43 @@
 #ifndef ONIC_H
 #define ONIC_H
 
+#include <linux/version.h>
 #include <linux/netdevice.h>
 #include <linux/cpumask.h>
+#include <linux/u64_stats_sync.h>
 #include "libqdma_export.h"
 #include "onic_register.h"
 #include "qdma_access/qdma_access_common.h"
 #include "qdma_descq.h"
 
+/* native XDP, built on the xdp_buff helpers and ndo_xdp_xmit semantics
+ * of 5.13
+ */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 13, 0)
+#define ONIC_XDP
+#include <net/xdp.h>
+#include <net/xdp_sock_drv.h>
+#endif
+
 #define ONIC_ERROR_STR_BUF_LEN              (512)
 
 #define ONIC_RX_COPY_THRES                  (256)
 #define ONIC_RX_PULL_LEN                    (128)
+/* tailroom needed to build an skb around a C2H buffer */
+#define ONIC_RX_SHINFO_LEN \
+  SKB_DATA_ALIGN(sizeof(struct skb_shared_info))
 #define ONIC_NAPI_WEIGHT                    (64)
+/* a TX queue is stopped when fewer descriptors than a fragmented packet
+ * needs are free, and woken once twice as many are free again
+ */
+#define ONIC_TX_STOP_THRES                  (MAX_SKB_FRAGS + 1)
+#define ONIC_TX_WAKE_THRES                  (2 * ONIC_TX_STOP_THRES)
+/* a TX queue is also woken only once 1/8 of its request slots are free */
+#define ONIC_TX_SLOTS_WAKE_THRES(ring)      ((ring)->nr_slots / 8)
+
+/* RSS indirection table entries and Toeplitz key bytes of the shell */
+#define ONIC_RSS_INDIR_SIZE                 (128)
+#define ONIC_RSS_KEY_SIZE                   (40)
 
 #define DRV_CDEV_NAME "reconic-mm"
 #include "onic_cdev.h"
@@ -43,11 +68,88 @@ struct qdma_fmap_ctxt {
 
 struct onic_dma_request {
   struct sk_buff *skb;
+  /* XDP frame sent instead of skb */
+  struct xdp_frame *xdpf;
+  /* pool of the AF_XDP frame sent instead of skb */
+  struct xsk_buff_pool *xsk_pool;
   struct net_device *netdev;
+  u16 q_id;
+  /* H2C descriptors taken by the packet */
+  u16 desc_cnt;
   struct qdma_request qdma;
-  struct qdma_sw_sg sgl[MAX_SKB_FRAGS];
+  /* linear part and fragments */
+  struct qdma_sw_sg sgl[MAX_SKB_FRAGS + 1];
+};
+
+/* ONIC TX ring state */
+struct onic_tx_ring {
+  /* descriptors of packets handed to QDMA and not completed yet */
+  atomic_t desc_used;
+  /* request slots, taken in submission order and released in completion
+   * order, which is the same for an H2C queue
+   */
+  struct onic_dma_request *slots;
+  /* number of slots, a power of 2 no smaller than the H2C ring */
+  u32 nr_slots;
+  /* slots taken by onic_start_xmit() */
+  u32 prod;
+  /* slots released by onic_tx_done() */
+  u32 cons;
+};
+
+/* XDP work of a NAPI poll to flush before it ends */
+#define ONIC_XDP_FLUSH_TX                   BIT(0)
+#define ONIC_XDP_FLUSH_REDIRECT             BIT(1)
+
+/* ONIC RX ring state */
+struct onic_rx_ring {
+#ifdef ONIC_XDP
+  struct xdp_rxq_info xdp_rxq;
+  /* AF_XDP zero-copy pool of the queue pair, RX and TX */
+  struct xsk_buff_pool *xsk_pool;
+#endif
+  /* ONIC_XDP_FLUSH_* */
+  u8 xdp_flush;
+  /* the AF_XDP fill queue ran dry during a poll */
+  bool xsk_starved;
+};
+
+/* ONIC RX queue counters, written by the NAPI context of the queue only */
+struct onic_rx_qstats {
+  u64 packets;
+  u64 bytes;
+  /* packets dropped on skb allocation failures */
+  u64 dropped;
+  /* deliveries copied into a fresh skb */
+  u64 copybreak;
+  /* deliveries with the C2H buffer as skb head */
+  u64 build_skb;
+  /* deliveries with the C2H buffers attached as fragments */
+  u64 frags;
+  /* polls that used up their NAPI budget */
+  u64 budget_exhausted;
+  /* XDP verdicts, XDP_PASS is counted as a build_skb delivery */
+  u64 xdp_drop;
+  u64 xdp_tx;
+  u64 xdp_redirect;
+  struct u64_stats_sync syncp;
 };
 
+/* ONIC TX queue counters, written under the TX queue lock only */
+struct onic_tx_qstats {
+  u64 packets;
+  u64 bytes;
+  u64 dropped;
+  /* packets returned with NETDEV_TX_BUSY on a full ring */
+  u64 ring_full;
+  /* queue stops ahead of a full ring */
+  u64 stopped;
+  struct u64_stats_sync syncp;
+};
+
+/* CMAC counters exposed through ethtool -S, see onic_ethtool.c */
+#define ONIC_CMAC_STATS_LEN                 (68)
+
 struct onic_platform_info {
   u8 qdma_bar;
   u8 user_bar;
@@ -86,7 +188,6 @@ struct onic_priv {
   u16 num_msix;
   u16 nb_queues;
 
-  struct kmem_cache *dma_req;
   struct qdma_dev_conf qdma_dev_conf;
   struct qdma_dev* qdev;
   unsigned long dev_handle;
@@ -94,7 +195,19 @@ struct onic_priv {
 
   unsigned long base_tx_q_handle, base_rx_q_handle;
   struct napi_struct *napi;
-  struct rtnl_link_stats64 *tx_qstats, *rx_qstats;
+  struct onic_rx_ring *rx_rings;
+  struct onic_tx_ring *tx_rings;
+  /* C2H buffer size and the headroom reserved in front of it */
+  u32 rx_buf_sz;
+  u16 rx_headroom;
+  struct bpf_prog *xdp_prog;
+  struct onic_tx_qstats *tx_qstats;
+  struct onic_rx_qstats *rx_qstats;
+  /* RSS settings last written to the shell */
+  u32 rss_indir[ONIC_RSS_INDIR_SIZE];
+  u8 rss_key[ONIC_RSS_KEY_SIZE];
+  /* CMAC counters accumulated over ticks, under the RTNL lock */
+  u64 cmac_stats[ONIC_CMAC_STATS_LEN];
   struct onic_cdev *onic_cdev_ptr;
 };
 
@@ -17,57 +17,1212 @@
 #include "onic_cdev.h"
 #include <linux/pci.h>
 #include <linux/syscalls.h>
+#include <linux/mm.h>
+#include <linux/version.h>
+#include <linux/module.h>
+#include <linux/log2.h>
 /**
  * sysfs class structure
  **/
 static struct class *onic_cdev_class = NULL;
 
-// synchronisation
-// for read synchronisation
-static struct semaphore read_sem;
-static struct semaphore read_mutex;
-static struct semaphore read_mutex2;
-static int read_read_idx;
-static int read_write_idx;
-static int *read_queue_pool;
-// for write synchronisation
-static struct semaphore write_sem;
-static struct semaphore write_mutex;
-static struct semaphore write_mutex2;
-static int write_read_idx;
-static int write_write_idx;
-static int *write_queue_pool;
+/**
+ * Bind every newly opened file to an MM queue, as ONIC_QUEUE_AUTO does
+ **/
+static bool bind_queue_on_open = false;
+module_param(bind_queue_on_open, bool, 0644);
+MODULE_PARM_DESC(bind_queue_on_open, "Bind each open file of reconic-mm to an MM queue round-robin");
+
+/**
+ * Transfers of at least this many bytes on an unbound file are split across
+ * all MM queues
+ **/
+static unsigned int stripe_threshold = 4 << 20;
+module_param(stripe_threshold, uint, 0644);
+MODULE_PARM_DESC(stripe_threshold, "Minimum reconic-mm transfer size in bytes striped across MM queues, 0 to disable");
 
 /**
  * Minor of this char device
  **/
 static int cdev_minor = 0;
 
+static void onic_cdev_buf_release(struct kref *ref);
+static int map_user_buf_to_sgl(struct cdev_io_cb *iocb, bool write);
+static void unmap_user_buf(struct cdev_io_cb *iocb, bool write);
+static inline void iocb_release(struct cdev_io_cb *iocb);
+
 /**
  * Open a character device and initialize private data
  **/
 static int onic_cdev_open(struct inode *inode, struct file *file) {
   struct onic_cdev *onic_cdev_ptr = container_of(inode->i_cdev, struct onic_cdev, mm_cdev);
-  file->private_data = onic_cdev_ptr;
+  struct onic_cdev_file *fctx;
+
+  fctx = kzalloc(sizeof(struct onic_cdev_file), GFP_KERNEL);
+  if (!fctx)
+    return -ENOMEM;
+
+  fctx->xcdev = onic_cdev_ptr;
+  fctx->queue = ONIC_QUEUE_UNBOUND;
+  if (bind_queue_on_open)
+    fctx->queue = (unsigned int)atomic_inc_return(&onic_cdev_ptr->bind_queue_idx) %
+        onic_cdev_ptr->no_mm_queues;
+  mutex_init(&fctx->buf_lock);
+  idr_init(&fctx->buf_idr);
+  file->private_data = fctx;
   dev_dbg(&onic_cdev_ptr->qdev->pdev->dev, "%s: Open onic_cdev.\n", onic_cdev_ptr->name);
   return 0;
 }
 
 /**
- * Close a character device
+ * Close a character device and release the buffers registered through it
  **/
 static int onic_cdev_close(struct inode *inode, struct file *file) {
-  // Do nothing
-  struct onic_cdev *onic_cdev_ptr = (struct onic_cdev*) file->private_data;
+  struct onic_cdev_file *fctx = (struct onic_cdev_file *) file->private_data;
+  struct onic_cdev *onic_cdev_ptr = fctx->xcdev;
+  struct onic_cdev_buf *cbuf;
+  unsigned long flags;
+  int handle;
+  int i;
+
+  if (fctx->event_listed) {
+    spin_lock_irqsave(&onic_cdev_ptr->event_lock, flags);
+    list_del(&fctx->event_node);
+    spin_unlock_irqrestore(&onic_cdev_ptr->event_lock, flags);
+  }
+  for (i = 0; i < ONIC_EVENT_MAX; i++)
+    if (fctx->event_ctx[i])
+      eventfd_ctx_put(fctx->event_ctx[i]);
+
+  idr_for_each_entry(&fctx->buf_idr, cbuf, handle)
+    kref_put(&cbuf->ref, onic_cdev_buf_release);
+  idr_destroy(&fctx->buf_idr);
+  mutex_destroy(&fctx->buf_lock);
+  kfree(fctx);
+
   dev_info(&onic_cdev_ptr->qdev->pdev->dev, "%s: Close onic_cdev.\n", onic_cdev_ptr->name);
   return 0;
 }
 
+/*
+ * MM queue statistics
+ *
+ * Counters are per CPU and updated with this_cpu operations, so the data
+ * path takes no lock. A request may complete on another CPU than the one
+ * it was submitted on, so in-flight counts only add up over all CPUs.
+ */
+static inline struct onic_cdev_qstats __percpu *onic_cdev_qstats(struct onic_cdev *xcdev,
+        bool write, int target_queue)
+{
+  return xcdev->qstats + (write ? xcdev->no_mm_queues : 0) + target_queue;
+}
+
+static inline u64 onic_cdev_stats_start(struct onic_cdev *xcdev, bool write, int target_queue)
+{
+  this_cpu_inc(onic_cdev_qstats(xcdev, write, target_queue)->inflight);
+  return ktime_get_ns();
+}
+
+static void onic_cdev_stats_end(struct onic_cdev *xcdev, bool write, int target_queue,
+        u64 start, ssize_t res)
+{
+  struct onic_cdev_qstats __percpu *qs = onic_cdev_qstats(xcdev, write, target_queue);
+  u64 ns = ktime_get_ns() - start;
+  unsigned int bucket = min_t(unsigned int, fls64(div_u64(ns, NSEC_PER_USEC)),
+      ONIC_CDEV_LAT_BUCKETS - 1);
+
+  this_cpu_dec(qs->inflight);
+  this_cpu_inc(qs->requests);
+  if (res < 0)
+    this_cpu_inc(qs->errors);
+  else
+    this_cpu_add(qs->bytes, res);
+  this_cpu_add(qs->service_ns, ns);
+  this_cpu_inc(qs->service_hist[bucket]);
+}
+
+/*
+ * MM queue selection
+ *
+ * A file bound to a queue always uses it. Unbound files claim an idle queue
+ * from a lock-free bitmap, starting from the queue local to the current CPU,
+ * and share that queue when all of them are busy. libqdma serialises
+ * requests on a shared queue through its work list.
+ */
+static int onic_cdev_get_queue(struct onic_cdev_file *fctx, bool write, bool *claimed)
+{
+  struct onic_cdev *xcdev = fctx->xcdev;
+  unsigned long *busy = write ? &xcdev->h2c_queue_busy : &xcdev->c2h_queue_busy;
+  int bound = READ_ONCE(fctx->queue);
+  int start;
+  int q;
+  int i;
+
+  *claimed = false;
+  if (bound >= 0)
+    return bound;
+
+  start = raw_smp_processor_id() % xcdev->no_mm_queues;
+  for (i = 0; i < xcdev->no_mm_queues; i++) {
+    q = (start + i) % xcdev->no_mm_queues;
+    if (!test_bit(q, busy) && !test_and_set_bit_lock(q, busy)) {
+      *claimed = true;
+      return q;
+    }
+  }
+
+  this_cpu_inc(onic_cdev_qstats(xcdev, write, start)->shared);
+  return start;
+}
+
+static void onic_cdev_put_queue(struct onic_cdev_file *fctx, bool write, int target_queue,
+        bool claimed)
+{
+  struct onic_cdev *xcdev = fctx->xcdev;
+
+  if (claimed)
+    clear_bit_unlock(target_queue, write ? &xcdev->h2c_queue_busy : &xcdev->c2h_queue_busy);
+}
+
+static long onic_cdev_set_queue(struct onic_cdev_file *fctx, void __user *arg)
+{
+  struct onic_cdev *xcdev = fctx->xcdev;
+  s32 queue;
+
+  if (get_user(queue, (s32 __user *)arg))
+    return -EFAULT;
+
+  if (queue == ONIC_QUEUE_AUTO)
+    queue = (unsigned int)atomic_inc_return(&xcdev->bind_queue_idx) % xcdev->no_mm_queues;
+  else if (queue != ONIC_QUEUE_UNBOUND && (queue < 0 || queue >= xcdev->no_mm_queues))
+    return -EINVAL;
+
+  WRITE_ONCE(fctx->queue, queue);
+  dev_dbg(&xcdev->qdev->pdev->dev, "%s: file bound to queue %d\n", xcdev->name, queue);
+  return 0;
+}
+
+static inline unsigned long onic_cdev_qhndl(struct onic_cdev *xcdev, bool write, int target_queue)
+{
+  return write ? xcdev->mm_h2c_q_hndl + target_queue : xcdev->mm_c2h_q_hndl + target_queue;
+}
+
+static void onic_cdev_init_req(struct qdma_request *req, struct qdma_sw_sg *sgl,
+        unsigned int sgcnt, size_t count, u64 ep_addr, bool write, bool dma_mapped)
+{
+  memset(req, 0, sizeof(struct qdma_request));
+  req->sgcnt = sgcnt;
+  req->sgl = sgl;
+  req->write = write ? 1 : 0;
+  req->dma_mapped = dma_mapped ? 1 : 0;
+  req->udd_len = 0;
+  req->ep_addr = ep_addr;
+  req->count = count;
+  req->timeout_ms = 10 * 1000;    /* 10 seconds */
+  req->fp_done = NULL;        /* blocking */
+  req->h2c_eot = 1;        /* set to 1 for STM tests */
+}
+
+/**
+ * Submit a blocking MM request of a file on target_queue
+ **/
+static ssize_t onic_cdev_submit(struct onic_cdev_file *fctx, struct qdma_sw_sg *sgl,
+        unsigned int sgcnt, size_t count, u64 ep_addr, bool write,
+        int target_queue, bool dma_mapped)
+{
+  struct onic_cdev *xcdev = fctx->xcdev;
+  struct qdma_request req;
+  unsigned long qhndl = onic_cdev_qhndl(xcdev, write, target_queue);
+  ssize_t res;
+  u64 start;
+
+  pr_debug("%s, priv 0x%lx: %llu bytes, ep_addr 0x%llx, W %d.\n",
+      xcdev->name, qhndl, (u64)count, ep_addr, write);
+
+  onic_cdev_init_req(&req, sgl, sgcnt, count, ep_addr, write, dma_mapped);
+  req.aperture_size = READ_ONCE(fctx->aperture);
+  start = onic_cdev_stats_start(xcdev, write, target_queue);
+  res = xcdev->fp_rw(xcdev->dev_handle, qhndl, &req);
+  onic_cdev_stats_end(xcdev, write, target_queue, start, res);
+  return res;
+}
+
+/*
+ * Keyhole transfers
+ *
+ * With an aperture set, the card address of a request wraps within
+ * [ep_addr, ep_addr + aperture), so a large host buffer is streamed into a
+ * FIFO at a fixed address in one request. Keyhole requests are never
+ * striped, as the FIFO must receive the data in order.
+ */
+static long onic_cdev_set_aperture(struct onic_cdev_file *fctx, void __user *arg)
+{
+  u32 aperture;
+
+  if (get_user(aperture, (u32 __user *)arg))
+    return -EFAULT;
+
+  if (aperture && (!is_power_of_2(aperture) || aperture > QDMA_DESC_BLEN_MAX))
+    return -EINVAL;
+
+  WRITE_ONCE(fctx->aperture, aperture);
+  dev_dbg(&fctx->xcdev->qdev->pdev->dev, "%s: file aperture set to %u\n",
+          fctx->xcdev->name, aperture);
+  return 0;
+}
+
+/*
+ * Striped transfers
+ */
+static struct onic_cdev_stripe_ctl *onic_cdev_alloc_stripes(struct onic_cdev *xcdev,
+        unsigned int nstripes)
+{
+  struct onic_cdev_stripe_ctl *ctl;
+
+  ctl = kzalloc(sizeof(*ctl) + nstripes * sizeof(struct onic_cdev_stripe), GFP_KERNEL);
+  if (!ctl)
+    return NULL;
+
+  atomic_set(&ctl->pending, nstripes + 1);
+  refcount_set(&ctl->refs, nstripes + 1);
+  init_completion(&ctl->done);
+  ctl->xcdev = xcdev;
+  ctl->nstripes = nstripes;
+  return ctl;
+}
+
+static void onic_cdev_put_stripes(struct onic_cdev_stripe_ctl *ctl)
+{
+  if (refcount_dec_and_test(&ctl->refs))
+    kfree(ctl);
+}
+
+/**
+ * Account for a stripe that libqdma will not call back for any more
+ **/
+static void onic_cdev_stripe_release(struct onic_cdev_stripe_ctl *ctl)
+{
+  if (atomic_dec_and_test(&ctl->pending))
+    complete(&ctl->done);
+  onic_cdev_put_stripes(ctl);
+}
+
+static int onic_cdev_stripe_done(struct qdma_request *req, unsigned int bytes_done, int err)
+{
+  struct onic_cdev_stripe *stripe = container_of(req, struct onic_cdev_stripe, req);
+  struct onic_cdev_stripe_ctl *ctl = stripe->ctl;
+
+  stripe->bytes_done = bytes_done;
+  stripe->err = err;
+  onic_cdev_stats_end(ctl->xcdev, req->write, stripe->queue, stripe->start,
+      err ? err : bytes_done);
+  onic_cdev_stripe_release(ctl);
+  return 0;
+}
+
+/**
+ * Drop the submitter's reference on ctl and wait until every stripe is done.
+ * Stripes still queued after the timeout are cancelled, and the rest are
+ * waited for without a timeout: their sgl and user pages belong to libqdma
+ * until they come back, so the caller must not release them before.
+ * Returns the total number of bytes transferred, or the error of the first
+ * failed stripe. ctl must not be used after this returns.
+ **/
+static ssize_t onic_cdev_wait_stripes(struct onic_cdev *xcdev, struct onic_cdev_stripe_ctl *ctl)
+{
+  struct onic_cdev_stripe *stripe;
+  ssize_t res = 0;
+  int i;
+
+  if (!atomic_dec_and_test(&ctl->pending) &&
+      !wait_for_completion_timeout(&ctl->done, msecs_to_jiffies(10 * 1000))) {
+    /* reclaim the stripes still owned by libqdma before they go away */
+    for (i = 0; i < ctl->nstripes; i++) {
+      stripe = &ctl->stripes[i];
+      if (stripe->submitted &&
+          qdma_request_cancel(xcdev->dev_handle, stripe->qhndl, &stripe->req) == 1) {
+        stripe->err = -EIO;
+        onic_cdev_stats_end(xcdev, stripe->req.write, stripe->queue, stripe->start, -EIO);
+        onic_cdev_stripe_release(ctl);
+      }
+    }
+    /* the rest are owned by the hardware or finishing their callbacks */
+    wait_for_completion(&ctl->done);
+  }
+
+  for (i = 0; i < ctl->nstripes; i++) {
+    if (ctl->stripes[i].err) {
+      pr_err("%s: stripe %d of %u failed, %d.\n", xcdev->name, i, ctl->nstripes,
+          ctl->stripes[i].err);
+      res = ctl->stripes[i].err;
+      goto out;
+    }
+    res += ctl->stripes[i].bytes_done;
+  }
+
+out:
+  onic_cdev_put_stripes(ctl);
+  return res;
+}
+
+static inline bool onic_cdev_should_stripe(struct onic_cdev_file *fctx, size_t count,
+        unsigned int sgcnt)
+{
+  unsigned int threshold = READ_ONCE(stripe_threshold);
+
+  return threshold && count >= threshold && sgcnt > 1 &&
+      fctx->xcdev->no_mm_queues > 1 && READ_ONCE(fctx->queue) < 0 &&
+      !READ_ONCE(fctx->aperture);
+}
+
+/**
+ * Split a request page-wise into one stripe per MM queue, starting from
+ * first_queue, and wait until every stripe is done. sgl is modified.
+ **/
+static ssize_t onic_cdev_submit_striped(struct onic_cdev *xcdev, struct qdma_sw_sg *sgl,
+        unsigned int sgcnt, size_t count, u64 ep_addr, bool write,
+        int first_queue, bool dma_mapped)
+{
+  struct onic_cdev_stripe_ctl *ctl;
+  struct onic_cdev_stripe *stripe;
+  unsigned int nstripes = min_t(unsigned int, xcdev->no_mm_queues, sgcnt);
+  unsigned int pages_per_stripe = DIV_ROUND_UP(sgcnt, nstripes);
+  unsigned int first;
+  unsigned int nr;
+  unsigned int bytes;
+  u64 offset = 0;
+  ssize_t res = 0;
+  int i;
+  int j;
+
+  nstripes = DIV_ROUND_UP(sgcnt, pages_per_stripe);
+  ctl = onic_cdev_alloc_stripes(xcdev, nstripes);
+  if (!ctl)
+    return -ENOMEM;
+
+  for (i = 0; i < nstripes; i++) {
+    stripe = &ctl->stripes[i];
+    first = i * pages_per_stripe;
+    nr = min_t(unsigned int, pages_per_stripe, sgcnt - first);
+    for (j = 0, bytes = 0; j < nr; j++)
+      bytes += sgl[first + j].len;
+    sgl[first + nr - 1].next = NULL;
+
+    stripe->ctl = ctl;
+    stripe->queue = (first_queue + i) % xcdev->no_mm_queues;
+    stripe->qhndl = onic_cdev_qhndl(xcdev, write, stripe->queue);
+    onic_cdev_init_req(&stripe->req, &sgl[first], nr, bytes, ep_addr + offset, write,
+        dma_mapped);
+    stripe->req.fp_done = onic_cdev_stripe_done;
+    offset += bytes;
+
+    pr_debug("%s, priv 0x%lx: stripe %d, %u bytes, ep_addr 0x%llx, W %d.\n",
+        xcdev->name, stripe->qhndl, i, bytes, stripe->req.ep_addr, write);
+
+    stripe->start = onic_cdev_stats_start(xcdev, write, stripe->queue);
+    res = xcdev->fp_rw(xcdev->dev_handle, stripe->qhndl, &stripe->req);
+    if (res < 0) {
+      onic_cdev_stats_end(xcdev, write, stripe->queue, stripe->start, res);
+      stripe->err = res;
+      onic_cdev_stripe_release(ctl);
+    } else {
+      stripe->submitted = true;
+    }
+  }
+
+  return onic_cdev_wait_stripes(xcdev, ctl);
+}
+
+/**
+ * Pin every segment and submit all of them to one MM queue with a single
+ * qdma_batch_request_submit(), then wait until every segment is done.
+ **/
+static ssize_t onic_cdev_submit_batch(struct onic_cdev_file *fctx, struct onic_cdev_seg *segs,
+        unsigned int nr_segs, bool write)
+{
+  struct onic_cdev *xcdev = fctx->xcdev;
+  struct onic_cdev_stripe_ctl *ctl;
+  struct onic_cdev_stripe *stripes;
+  struct qdma_request **reqv;
+  struct cdev_io_cb *iocbs;
+  unsigned long qhndl;
+  unsigned int pinned = 0;
+  int target_queue;
+  bool claimed;
+  ssize_t res;
+  int i;
+
+  ctl = onic_cdev_alloc_stripes(xcdev, nr_segs);
+  iocbs = kcalloc(nr_segs, sizeof(struct cdev_io_cb), GFP_KERNEL);
+  reqv = kcalloc(nr_segs, sizeof(struct qdma_request *), GFP_KERNEL);
+  if (!ctl || !iocbs || !reqv) {
+    kfree(ctl);
+    res = -ENOMEM;
+    goto out;
+  }
+  stripes = ctl->stripes;
+
+  target_queue = onic_cdev_get_queue(fctx, write, &claimed);
+  qhndl = onic_cdev_qhndl(xcdev, write, target_queue);
+
+  for (i = 0; i < nr_segs; i++) {
+    iocbs[i].buf = segs[i].buf;
+    iocbs[i].len = segs[i].len;
+    res = map_user_buf_to_sgl(&iocbs[i], write);
+    if (res < 0) {
+      /* nothing has been submitted yet */
+      kfree(ctl);
+      goto put_queue;
+    }
+    pinned++;
+
+    stripes[i].ctl = ctl;
+    stripes[i].qhndl = qhndl;
+    stripes[i].queue = target_queue;
+    onic_cdev_init_req(&stripes[i].req, iocbs[i].sgl, iocbs[i].page_nb, segs[i].len,
+        segs[i].ep_addr, write, false);
+    stripes[i].req.aperture_size = READ_ONCE(fctx->aperture);
+    stripes[i].req.fp_done = onic_cdev_stripe_done;
+    reqv[i] = &stripes[i].req;
+  }
+
+  pr_debug("%s, priv 0x%lx: batch of %u segments, W %d.\n",
+      xcdev->name, qhndl, nr_segs, write);
+
+  for (i = 0; i < nr_segs; i++)
+    stripes[i].start = onic_cdev_stats_start(xcdev, write, target_queue);
+  res = qdma_batch_request_submit(xcdev->dev_handle, qhndl, nr_segs, reqv);
+  for (i = 0; i < nr_segs; i++) {
+    /* segments that failed to map were completed with an error already */
+    if (res < 0 && !stripes[i].err) {
+      onic_cdev_stats_end(xcdev, write, target_queue, stripes[i].start, res);
+      stripes[i].err = res;
+      onic_cdev_stripe_release(ctl);
+    } else if (res >= 0) {
+      stripes[i].submitted = true;
+    }
+  }
+  res = onic_cdev_wait_stripes(xcdev, ctl);
+
+put_queue:
+  onic_cdev_put_queue(fctx, write, target_queue, claimed);
+  for (i = 0; i < pinned; i++) {
+    unmap_user_buf(&iocbs[i], write);
+    iocb_release(&iocbs[i]);
+  }
+out:
+  kfree(reqv);
+  kfree(iocbs);
+  return res;
+}
+
+/*
+ * Scatter list of {user buffer, card address, length} entries, moved with
+ * one batch submission.
+ */
+static long onic_cdev_sg_rw(struct onic_cdev_file *fctx, void __user *arg)
+{
+  struct onic_ioc_sg_rw usg;
+  struct onic_ioc_sg_entry *entries;
+  struct onic_cdev_seg *segs;
+  size_t total = 0;
+  long res;
+  int i;
+
+  if (copy_from_user(&usg, arg, sizeof(struct onic_ioc_sg_rw)))
+    return -EFAULT;
+
+  if (!usg.count || usg.count > ONIC_SG_RW_MAX_ENTRIES)
+    return -EINVAL;
+
+  entries = memdup_user(u64_to_user_ptr(usg.entries),
+      usg.count * sizeof(struct onic_ioc_sg_entry));
+  if (IS_ERR(entries))
+    return PTR_ERR(entries);
+
+  segs = kcalloc(usg.count, sizeof(struct onic_cdev_seg), GFP_KERNEL);
+  if (!segs) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  /* the byte count is returned through ioctl(), so it has to fit an int */
+  for (i = 0; i < usg.count; i++) {
+    if (!entries[i].len || entries[i].len > MAX_RW_COUNT - total) {
+      res = -EINVAL;
+      goto out;
+    }
+    total += entries[i].len;
+    segs[i].buf = u64_to_user_ptr(entries[i].addr);
+    segs[i].len = entries[i].len;
+    segs[i].ep_addr = entries[i].dev_addr;
+  }
+
+  res = onic_cdev_submit_batch(fctx, segs, usg.count, usg.write);
+
+out:
+  kfree(segs);
+  kfree(entries);
+  return res;
+}
+
+/*
+ * Registered user buffers
+ */
+static void onic_cdev_buf_release(struct kref *ref)
+{
+  struct onic_cdev_buf *cbuf = container_of(ref, struct onic_cdev_buf, ref);
+  struct device *dev = &cbuf->xcdev->qdev->pdev->dev;
+  struct qdma_sw_sg *sg = cbuf->sgl;
+  unsigned int i;
+
+  if (!sg)
+    goto free_buf;
+
+  if (cbuf->cpu_addr) {
+    dma_free_coherent(dev, PAGE_ALIGN(cbuf->len), cbuf->cpu_addr, cbuf->dma_handle);
+    goto free_sgl;
+  }
+
+  if (cbuf->sgt.sgl) {
+    if (cbuf->sgt.nents)
+      dma_unmap_sg(dev, cbuf->sgt.sgl, cbuf->sgt.orig_nents, DMA_BIDIRECTIONAL);
+    sg_free_table(&cbuf->sgt);
+  } else {
+    for (i = 0; i < cbuf->page_nb; i++, sg++) {
+      if (sg->dma_addr)
+        dma_unmap_page(dev, sg->dma_addr - sg->offset, PAGE_SIZE, DMA_BIDIRECTIONAL);
+    }
+  }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+  unpin_user_pages_dirty_lock(cbuf->pages, cbuf->page_nb, true);
+#else
+  for (i = 0; i < cbuf->page_nb; i++) {
+    set_page_dirty_lock(cbuf->pages[i]);
+    put_page(cbuf->pages[i]);
+  }
+#endif
+
+free_sgl:
+  kvfree(cbuf->sgl);
+free_buf:
+  kfree(cbuf);
+}
+
+static struct onic_cdev_buf *onic_cdev_buf_get(struct onic_cdev_file *fctx, u32 handle)
+{
+  struct onic_cdev_buf *cbuf;
+
+  mutex_lock(&fctx->buf_lock);
+  cbuf = idr_find(&fctx->buf_idr, handle);
+  if (cbuf)
+    kref_get(&cbuf->ref);
+  mutex_unlock(&fctx->buf_lock);
+
+  return cbuf;
+}
+
+/*
+ * Allocate a buffer descriptor for [addr, addr + len) and pin its pages
+ * for long term DMA. On failure, the caller puts the returned reference.
+ */
+static struct onic_cdev_buf *onic_cdev_buf_pin(struct onic_cdev *xcdev, u64 addr, u64 len,
+        int *err)
+{
+  struct onic_cdev_buf *cbuf;
+  u64 pages_nr;
+  int rv;
+
+  *err = -EINVAL;
+  if (!len || addr + len < addr)
+    return NULL;
+  pages_nr = (len + offset_in_page(addr) + PAGE_SIZE - 1) >> PAGE_SHIFT;
+  if (pages_nr > INT_MAX)
+    return NULL;
+
+  *err = -ENOMEM;
+  cbuf = kzalloc(sizeof(struct onic_cdev_buf), GFP_KERNEL);
+  if (!cbuf)
+    return NULL;
+  kref_init(&cbuf->ref);
+  cbuf->xcdev = xcdev;
+  cbuf->addr = addr;
+  cbuf->len = len;
+
+  cbuf->sgl = kvzalloc(pages_nr * (sizeof(struct qdma_sw_sg) +
+          sizeof(struct page *)), GFP_KERNEL);
+  if (!cbuf->sgl) {
+    pr_err("sgl allocation failed for %llu pages", pages_nr);
+    return cbuf;
+  }
+  cbuf->pages = (struct page **)(cbuf->sgl + pages_nr);
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 6, 0)
+  rv = pin_user_pages_fast(addr, pages_nr, FOLL_WRITE | FOLL_LONGTERM, cbuf->pages);
+#else
+  rv = get_user_pages_fast(addr, pages_nr, 1/* write */, cbuf->pages);
+#endif
+  if (rv < 0) {
+    pr_err("unable to pin down %llu user pages, %d.\n", pages_nr, rv);
+    *err = rv;
+    return cbuf;
+  }
+  cbuf->page_nb = rv;
+  if (rv != pages_nr) {
+    pr_err("unable to pin down all %llu user pages, %d.\n", pages_nr, rv);
+    *err = -EFAULT;
+    return cbuf;
+  }
+
+  *err = 0;
+  return cbuf;
+}
+
+/*
+ * Pin a user buffer and map it for DMA once, so that later transfers with
+ * ONIC_IOC_BUF_RW skip get_user_pages and the per-request mapping.
+ */
+static long onic_cdev_reg_buf(struct onic_cdev_file *fctx, void __user *arg)
+{
+  struct onic_cdev *xcdev = fctx->xcdev;
+  struct device *dev = &xcdev->qdev->pdev->dev;
+  struct onic_ioc_reg_buf ureg;
+  struct onic_cdev_buf *cbuf;
+  struct qdma_sw_sg *sg;
+  unsigned long addr;
+  size_t len;
+  u64 pages_nr;
+  int i;
+  int rv;
+
+  if (copy_from_user(&ureg, arg, sizeof(struct onic_ioc_reg_buf)))
+    return -EFAULT;
+
+  cbuf = onic_cdev_buf_pin(xcdev, ureg.addr, ureg.len, &rv);
+  if (rv)
+    goto err_out;
+  pages_nr = cbuf->page_nb;
+
+  addr = ureg.addr;
+  len = ureg.len;
+  sg = cbuf->sgl;
+  for (i = 0; i < pages_nr; i++, sg++) {
+    unsigned int offset = offset_in_page(addr);
+    unsigned int nbytes = min_t(size_t, PAGE_SIZE - offset, len);
+    struct page *pg = cbuf->pages[i];
+    dma_addr_t dma_addr;
+
+    flush_dcache_page(pg);
+
+    /* same per-page mapping as sgl_map() in libqdma */
+    dma_addr = dma_map_page(dev, pg, 0, PAGE_SIZE, DMA_BIDIRECTIONAL);
+    if (unlikely(dma_mapping_error(dev, dma_addr))) {
+      pr_err("map sgl failed, sg %d, %u.\n", i, nbytes);
+      rv = -EIO;
+      goto err_out;
+    }
+
+    sg->next = sg + 1;
+    sg->pg = pg;
+    sg->offset = offset;
+    sg->len = nbytes;
+    sg->dma_addr = dma_addr + offset;
+
+    addr += nbytes;
+    len -= nbytes;
+  }
+  cbuf->sgl[pages_nr - 1].next = NULL;
+
+  mutex_lock(&fctx->buf_lock);
+  rv = idr_alloc(&fctx->buf_idr, cbuf, 1, 0, GFP_KERNEL);
+  mutex_unlock(&fctx->buf_lock);
+  if (rv < 0)
+    goto err_out;
+  cbuf->handle = rv;
+
+  ureg.handle = cbuf->handle;
+  if (copy_to_user(arg, &ureg, sizeof(struct onic_ioc_reg_buf))) {
+    mutex_lock(&fctx->buf_lock);
+    idr_remove(&fctx->buf_idr, cbuf->handle);
+    mutex_unlock(&fctx->buf_lock);
+    rv = -EFAULT;
+    goto err_out;
+  }
+
+  dev_dbg(dev, "%s: registered buffer %u, 0x%lx, %zu bytes, %u pages.\n",
+      xcdev->name, cbuf->handle, cbuf->addr, cbuf->len, cbuf->page_nb);
+  return 0;
+
+err_out:
+  if (cbuf)
+    kref_put(&cbuf->ref, onic_cdev_buf_release);
+  return rv;
+}
+
+/*
+ * Pin a user buffer and map it as a whole through the DMA API. Unlike
+ * ONIC_IOC_REG_BUF, the pages are mapped with one scatterlist so an IOMMU
+ * can merge them into a few IOVA ranges, which user space registers with
+ * the RDMA engine. The per-page scatter gather list is filled from the
+ * mapping, so ONIC_IOC_BUF_RW works on the buffer as well.
+ */
+static long onic_cdev_map_user_mem(struct onic_cdev_file *fctx, void __user *arg)
+{
+  struct onic_cdev *xcdev = fctx->xcdev;
+  struct device *dev = &xcdev->qdev->pdev->dev;
+  struct onic_ioc_map_user_mem umap;
+  struct onic_ioc_iova_seg __user *usegs;
+  struct onic_ioc_iova_seg seg = { 0, 0 };
+  struct onic_cdev_buf *cbuf;
+  struct qdma_sw_sg *sg;
+  struct scatterlist *s;
+  unsigned long addr;
+  size_t len;
+  u32 nr_segs = 0;
+  int nents;
+  int i = 0;
+  int j;
+  int rv;
+
+  if (copy_from_user(&umap, arg, sizeof(struct onic_ioc_map_user_mem)))
+    return -EFAULT;
+  usegs = u64_to_user_ptr(umap.segs);
+
+  cbuf = onic_cdev_buf_pin(xcdev, umap.addr, umap.len, &rv);
+  if (rv)
+    goto err_out;
+
+  rv = sg_alloc_table_from_pages(&cbuf->sgt, cbuf->pages, cbuf->page_nb,
+      offset_in_page(umap.addr), umap.len, GFP_KERNEL);
+  if (rv) {
+    memset(&cbuf->sgt, 0, sizeof(struct sg_table));
+    goto err_out;
+  }
+
+  nents = dma_map_sg(dev, cbuf->sgt.sgl, cbuf->sgt.orig_nents, DMA_BIDIRECTIONAL);
+  if (!nents) {
+    pr_err("map user memory failed, %u pages.\n", cbuf->page_nb);
+    rv = -EIO;
+    goto err_out;
+  }
+  cbuf->sgt.nents = nents;
+
+  addr = umap.addr;
+  len = umap.len;
+  sg = cbuf->sgl;
+  for_each_sg(cbuf->sgt.sgl, s, nents, j) {
+    dma_addr_t dma_addr = sg_dma_address(s);
+    unsigned int dma_len = sg_dma_len(s);
+
+    // merge ranges the mapping left adjacent
+    if (seg.len && seg.iova + seg.len == dma_addr) {
+      seg.len += dma_len;
+    } else {
+      if (seg.len && nr_segs < umap.max_segs &&
+          copy_to_user(&usegs[nr_segs], &seg, sizeof(seg))) {
+        rv = -EFAULT;
+        goto err_out;
+      }
+      if (seg.len)
+        nr_segs++;
+      seg.iova = dma_addr;
+      seg.len = dma_len;
+    }
+
+    // ranges start and end on page boundaries, except at the buffer ends
+    while (dma_len && i < cbuf->page_nb) {
+      unsigned int offset = offset_in_page(addr);
+      unsigned int nbytes = min_t(size_t, PAGE_SIZE - offset, len);
+
+      if (unlikely(nbytes > dma_len)) {
+        pr_err("user memory range %d splits a page.\n", j);
+        rv = -EIO;
+        goto err_out;
+      }
+
+      sg->next = sg + 1;
+      sg->pg = cbuf->pages[i];
+      sg->offset = offset;
+      sg->len = nbytes;
+      sg->dma_addr = dma_addr;
+
+      dma_addr += nbytes;
+      dma_len -= nbytes;
+      addr += nbytes;
+      len -= nbytes;
+      sg++;
+      i++;
+    }
+  }
+  if (seg.len && nr_segs < umap.max_segs &&
+      copy_to_user(&usegs[nr_segs], &seg, sizeof(seg))) {
+    rv = -EFAULT;
+    goto err_out;
+  }
+  if (seg.len)
+    nr_segs++;
+  cbuf->sgl[cbuf->page_nb - 1].next = NULL;
+
+  umap.nr_segs = nr_segs;
+  if (nr_segs > umap.max_segs) {
+    rv = -ENOSPC;
+    if (copy_to_user(arg, &umap, sizeof(struct onic_ioc_map_user_mem)))
+      rv = -EFAULT;
+    goto err_out;
+  }
+
+  mutex_lock(&fctx->buf_lock);
+  rv = idr_alloc(&fctx->buf_idr, cbuf, 1, 0, GFP_KERNEL);
+  mutex_unlock(&fctx->buf_lock);
+  if (rv < 0)
+    goto err_out;
+  cbuf->handle = rv;
+
+  umap.handle = cbuf->handle;
+  if (copy_to_user(arg, &umap, sizeof(struct onic_ioc_map_user_mem))) {
+    mutex_lock(&fctx->buf_lock);
+    idr_remove(&fctx->buf_idr, cbuf->handle);
+    mutex_unlock(&fctx->buf_lock);
+    rv = -EFAULT;
+    goto err_out;
+  }
+
+  dev_dbg(dev, "%s: mapped user memory %u, 0x%lx, %zu bytes, %u ranges.\n",
+      xcdev->name, cbuf->handle, cbuf->addr, cbuf->len, nr_segs);
+  return 0;
+
+err_out:
+  if (cbuf)
+    kref_put(&cbuf->ref, onic_cdev_buf_release);
+  return rv;
+}
+
+/*
+ * Allocate a coherent DMA buffer to be mapped into user space. It is
+ * described by the same per-page scatter gather list as a registered
+ * buffer, so ONIC_IOC_BUF_RW works on both.
+ */
+static long onic_cdev_alloc_dma_buf(struct onic_cdev_file *fctx, void __user *arg)
+{
+  struct onic_cdev *xcdev = fctx->xcdev;
+  struct device *dev = &xcdev->qdev->pdev->dev;
+  struct onic_ioc_dma_buf udma;
+  struct onic_cdev_buf *cbuf;
+  struct qdma_sw_sg *sg;
+  u64 pages_nr;
+  int i;
+  int rv;
+
+  if (copy_from_user(&udma, arg, sizeof(struct onic_ioc_dma_buf)))
+    return -EFAULT;
+
+  if (!udma.size || udma.size > INT_MAX)
+    return -EINVAL;
+  pages_nr = PAGE_ALIGN(udma.size) >> PAGE_SHIFT;
+
+  cbuf = kzalloc(sizeof(struct onic_cdev_buf), GFP_KERNEL);
+  if (!cbuf)
+    return -ENOMEM;
+  kref_init(&cbuf->ref);
+  cbuf->xcdev = xcdev;
+  cbuf->len = PAGE_ALIGN(udma.size);
+
+  cbuf->sgl = kvzalloc(pages_nr * sizeof(struct qdma_sw_sg), GFP_KERNEL);
+  if (!cbuf->sgl) {
+    rv = -ENOMEM;
+    goto err_out;
+  }
+
+  cbuf->cpu_addr = dma_alloc_coherent(dev, cbuf->len, &cbuf->dma_handle, GFP_KERNEL);
+  if (!cbuf->cpu_addr) {
+    dev_err(dev, "%s: failed to allocate a %zu byte DMA buffer\n", xcdev->name, cbuf->len);
+    rv = -ENOMEM;
+    goto err_out;
+  }
+  cbuf->page_nb = pages_nr;
+
+  for (i = 0, sg = cbuf->sgl; i < pages_nr; i++, sg++) {
+    sg->next = sg + 1;
+    sg->pg = NULL;
+    sg->offset = 0;
+    sg->len = PAGE_SIZE;
+    sg->dma_addr = cbuf->dma_handle + ((dma_addr_t)i << PAGE_SHIFT);
+  }
+  cbuf->sgl[pages_nr - 1].next = NULL;
+
+  mutex_lock(&fctx->buf_lock);
+  rv = idr_alloc(&fctx->buf_idr, cbuf, 1, 0, GFP_KERNEL);
+  mutex_unlock(&fctx->buf_lock);
+  if (rv < 0)
+    goto err_out;
+  cbuf->handle = rv;
+
+  udma.handle = cbuf->handle;
+  udma.mmap_offset = (u64)cbuf->handle << PAGE_SHIFT;
+  udma.bus_addr = cbuf->dma_handle;
+  if (copy_to_user(arg, &udma, sizeof(struct onic_ioc_dma_buf))) {
+    mutex_lock(&fctx->buf_lock);
+    idr_remove(&fctx->buf_idr, cbuf->handle);
+    mutex_unlock(&fctx->buf_lock);
+    rv = -EFAULT;
+    goto err_out;
+  }
+
+  dev_dbg(dev, "%s: allocated DMA buffer %u, %zu bytes at bus address 0x%llx.\n",
+      xcdev->name, cbuf->handle, cbuf->len, (u64)cbuf->dma_handle);
+  return 0;
+
+err_out:
+  kref_put(&cbuf->ref, onic_cdev_buf_release);
+  return rv;
+}
+
+static long onic_cdev_unreg_buf(struct onic_cdev_file *fctx, void __user *arg)
+{
+  struct onic_cdev_buf *cbuf;
+  u32 handle;
+
+  if (get_user(handle, (u32 __user *)arg))
+    return -EFAULT;
+
+  mutex_lock(&fctx->buf_lock);
+  cbuf = idr_remove(&fctx->buf_idr, handle);
+  mutex_unlock(&fctx->buf_lock);
+  if (!cbuf)
+    return -EINVAL;
+
+  /* transfers still using the buffer hold their own reference */
+  kref_put(&cbuf->ref, onic_cdev_buf_release);
+  return 0;
+}
+
+static void onic_cdev_buf_sync(struct device *dev, struct qdma_sw_sg *sgl,
+        unsigned int sgcnt, bool for_device)
+{
+  struct qdma_sw_sg *sg;
+  unsigned int i;
+
+  for (i = 0, sg = sgl; i < sgcnt; i++, sg++) {
+    if (for_device)
+      dma_sync_single_range_for_device(dev, sg->dma_addr - sg->offset, sg->offset,
+          sg->len, DMA_BIDIRECTIONAL);
+    else
+      dma_sync_single_range_for_cpu(dev, sg->dma_addr - sg->offset, sg->offset,
+          sg->len, DMA_BIDIRECTIONAL);
+  }
+}
+
+/*
+ * Transfer part of a registered buffer. The request gets its own view of
+ * the cached scatter gather list, so no page is pinned or mapped here.
+ */
+static long onic_cdev_buf_rw(struct onic_cdev_file *fctx, void __user *arg)
+{
+  struct onic_cdev *xcdev = fctx->xcdev;
+  struct device *dev = &xcdev->qdev->pdev->dev;
+  struct onic_ioc_buf_rw urw;
+  struct onic_cdev_buf *cbuf;
+  struct qdma_sw_sg *sgl;
+  struct qdma_sw_sg *src;
+  unsigned long pos;
+  unsigned int pg_off;
+  unsigned int sgcnt;
+  size_t count;
+  size_t len;
+  int target_queue;
+  bool claimed;
+  long res;
+  int i;
+
+  if (copy_from_user(&urw, arg, sizeof(struct onic_ioc_buf_rw)))
+    return -EFAULT;
+
+  cbuf = onic_cdev_buf_get(fctx, urw.handle);
+  if (!cbuf)
+    return -EINVAL;
+
+  if (!urw.len || urw.offset > cbuf->len || urw.len > cbuf->len - urw.offset) {
+    res = -EINVAL;
+    goto out;
+  }
+  count = min_t(u64, urw.len, MAX_RW_COUNT);
+
+  /* offset from the start of the first pinned page */
+  pos = cbuf->sgl[0].offset + urw.offset;
+  src = cbuf->sgl + (pos >> PAGE_SHIFT);
+  pg_off = offset_in_page(pos);
+  sgcnt = (pg_off + count + PAGE_SIZE - 1) >> PAGE_SHIFT;
+
+  sgl = kvmalloc_array(sgcnt, sizeof(struct qdma_sw_sg), GFP_KERNEL);
+  if (!sgl) {
+    res = -ENOMEM;
+    goto out;
+  }
+
+  len = count;
+  for (i = 0; i < sgcnt; i++, src++) {
+    unsigned int offset = i ? 0 : pg_off;
+
+    sgl[i].next = &sgl[i + 1];
+    sgl[i].pg = src->pg;
+    sgl[i].offset = offset;
+    sgl[i].len = min_t(size_t, PAGE_SIZE - offset, len);
+    sgl[i].dma_addr = src->dma_addr - src->offset + offset;
+    len -= sgl[i].len;
+  }
+  sgl[sgcnt - 1].next = NULL;
+
+  if (!cbuf->cpu_addr)
+    onic_cdev_buf_sync(dev, sgl, sgcnt, true);
+
+  target_queue = onic_cdev_get_queue(fctx, urw.write, &claimed);
+  if (onic_cdev_should_stripe(fctx, count, sgcnt))
+    res = onic_cdev_submit_striped(xcdev, sgl, sgcnt, count, urw.dev_addr, urw.write,
+        target_queue, true);
+  else
+    res = onic_cdev_submit(fctx, sgl, sgcnt, count, urw.dev_addr, urw.write,
+        target_queue, true);
+  onic_cdev_put_queue(fctx, urw.write, target_queue, claimed);
+
+  if (!urw.write && !cbuf->cpu_addr)
+    onic_cdev_buf_sync(dev, sgl, sgcnt, false);
+
+  kvfree(sgl);
+out:
+  kref_put(&cbuf->ref, onic_cdev_buf_release);
+  return res;
+}
+
+/*
+ * User interrupts
+ *
+ * libqdma owns the user MSI-X vector and forwards every user interrupt to
+ * onic_cdev_user_isr(). ERNIC reports its sources in the global INTSTS
+ * register; a user interrupt without ERNIC status comes from the compute
+ * logic. Each source is delivered to the eventfds attached to it, so user
+ * space can block in epoll instead of polling the card.
+ */
+static long onic_cdev_set_eventfd(struct onic_cdev_file *fctx, void __user *arg)
+{
+  struct onic_cdev *xcdev = fctx->xcdev;
+  struct onic_ioc_eventfd uev;
+  struct eventfd_ctx *ctx = NULL;
+  struct eventfd_ctx *old;
+  unsigned long flags;
+  bool attached = false;
+  int i;
+
+  if (copy_from_user(&uev, arg, sizeof(uev)))
+    return -EFAULT;
+  if (uev.source >= ONIC_EVENT_MAX)
+    return -EINVAL;
+
+  if (uev.fd >= 0) {
+    ctx = eventfd_ctx_fdget(uev.fd);
+    if (IS_ERR(ctx))
+      return PTR_ERR(ctx);
+  }
+
+  spin_lock_irqsave(&xcdev->event_lock, flags);
+  old = fctx->event_ctx[uev.source];
+  fctx->event_ctx[uev.source] = ctx;
+  for (i = 0; i < ONIC_EVENT_MAX; i++)
+    attached |= fctx->event_ctx[i] != NULL;
+  /* the ISR only acknowledges INTSTS while some file has an eventfd attached */
+  if (attached && !fctx->event_listed) {
+    list_add_tail(&fctx->event_node, &xcdev->event_files);
+    fctx->event_listed = true;
+  } else if (!attached && fctx->event_listed) {
+    list_del(&fctx->event_node);
+    fctx->event_listed = false;
+  }
+  spin_unlock_irqrestore(&xcdev->event_lock, flags);
+
+  if (old)
+    eventfd_ctx_put(old);
+  return 0;
+}
+
+void onic_cdev_user_isr(struct onic_cdev *xcdev)
+{
+  struct onic_priv *xpriv = smp_load_acquire(&xcdev->xpriv);
+  struct onic_cdev_file *fctx;
+  unsigned long sources = 0;
+  u32 status;
+  int i;
+
+  if (!xpriv)
+    return;
+
+  spin_lock(&xcdev->event_lock);
+  // nobody listens, leave the status to user space pollers
+  if (list_empty(&xcdev->event_files))
+    goto unlock;
+
+  status = readl(xpriv->bar_base + RN_RDMA_OFFSET_INTSTS);
+  if (status) {
+    // write 1 to clear
+    writel(status, xpriv->bar_base + RN_RDMA_OFFSET_INTSTS);
+    if (status & RN_RDMA_INTSTS_CQ_MASK)
+      __set_bit(ONIC_EVENT_CQ, &sources);
+    if (status & RN_RDMA_INTSTS_RQ_MASK)
+      __set_bit(ONIC_EVENT_RQ, &sources);
+    if (status & RN_RDMA_INTSTS_ERR_MASK)
+      __set_bit(ONIC_EVENT_ERROR, &sources);
+  } else {
+    __set_bit(ONIC_EVENT_COMPUTE, &sources);
+  }
+
+  list_for_each_entry(fctx, &xcdev->event_files, event_node) {
+    for_each_set_bit(i, &sources, ONIC_EVENT_MAX) {
+      if (!fctx->event_ctx[i])
+        continue;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 8, 0)
+      eventfd_signal(fctx->event_ctx[i]);
+#else
+      eventfd_signal(fctx->event_ctx[i], 1);
+#endif
+    }
+  }
+
+unlock:
+  spin_unlock(&xcdev->event_lock);
+}
+
 static long onic_cdev_ioctl(
   struct file *file,	/* ditto */
   unsigned int ioctl_num,	/* number and param for ioctl */
   unsigned long ioctl_param){
-	return 0;
+  struct onic_cdev_file *fctx = (struct onic_cdev_file *) file->private_data;
+  void __user *arg = (void __user *) ioctl_param;
+
+  switch (ioctl_num) {
+  case ONIC_IOC_REG_BUF:
+    return onic_cdev_reg_buf(fctx, arg);
+  case ONIC_IOC_UNREG_BUF:
+    return onic_cdev_unreg_buf(fctx, arg);
+  case ONIC_IOC_BUF_RW:
+    return onic_cdev_buf_rw(fctx, arg);
+  case ONIC_IOC_SET_QUEUE:
+    return onic_cdev_set_queue(fctx, arg);
+  case ONIC_IOC_GET_QUEUE:
+    return put_user((s32)READ_ONCE(fctx->queue), (s32 __user *)arg);
+  case ONIC_IOC_ALLOC_DMA_BUF:
+    return onic_cdev_alloc_dma_buf(fctx, arg);
+  case ONIC_IOC_SG_RW:
+    return onic_cdev_sg_rw(fctx, arg);
+  case ONIC_IOC_SET_EVENTFD:
+    return onic_cdev_set_eventfd(fctx, arg);
+  case ONIC_IOC_SET_APERTURE:
+    return onic_cdev_set_aperture(fctx, arg);
+  case ONIC_IOC_GET_APERTURE:
+    return put_user(READ_ONCE(fctx->aperture), (u32 __user *)arg);
+  case ONIC_IOC_MAP_USER_MEM:
+    return onic_cdev_map_user_mem(fctx, arg);
+  default:
+    return -ENOTTY;
+  }
 }
 
 static void unmap_user_buf(struct cdev_io_cb *iocb, bool write)
@@ -194,12 +1349,11 @@ err_out:
 static ssize_t onic_gen_read_write(struct file *file, char __user *buf,
         size_t count, loff_t *pos, bool write, int target_queue)
 {
-  struct onic_cdev *xcdev = (struct onic_cdev *)file->private_data;
+  struct onic_cdev_file *fctx = (struct onic_cdev_file *)file->private_data;
+  struct onic_cdev *xcdev = fctx->xcdev;
   struct cdev_io_cb iocb;
-  struct qdma_request *req = &iocb.qd_req;
   ssize_t res = 0;
   int rv;
-  unsigned long qhndl;
 
   if (!xcdev) {
     pr_err("file 0x%p, xcdev NULL, 0x%p,%llu, pos %llu, W %d.\n",
@@ -213,11 +1367,8 @@ static ssize_t onic_gen_read_write(struct file *file, char __user *buf,
     return -EINVAL;
   }
 
-  qhndl = write ? xcdev->mm_h2c_q_hndl + target_queue : xcdev->mm_c2h_q_hndl + target_queue;
-
-  pr_debug("%s, priv 0x%lx: buf 0x%p,%llu, pos %llu, W %d.\n",
-      xcdev->name, qhndl, buf, (u64)count, (u64)*pos,
-      write);
+  pr_debug("%s: buf 0x%p,%llu, pos %llu, W %d.\n",
+      xcdev->name, buf, (u64)count, (u64)*pos, write);
 
   memset(&iocb, 0, sizeof(struct cdev_io_cb));
   iocb.buf = buf;
@@ -226,75 +1377,311 @@ static ssize_t onic_gen_read_write(struct file *file, char __user *buf,
   if (rv < 0)
     return rv;
 
-  req->sgcnt = iocb.page_nb;
-  req->sgl = iocb.sgl;
-  req->write = write ? 1 : 0;
-  req->dma_mapped = 0;
-  req->udd_len = 0;
-  req->ep_addr = (u64)*pos;
-  req->count = count;
-  req->timeout_ms = 10 * 1000;    /* 10 seconds */
-  req->fp_done = NULL;        /* blocking */
-  req->h2c_eot = 1;        /* set to 1 for STM tests */
-
-  res = xcdev->fp_rw(xcdev->dev_handle, qhndl, req);
+  if (onic_cdev_should_stripe(fctx, count, iocb.page_nb))
+    res = onic_cdev_submit_striped(xcdev, iocb.sgl, iocb.page_nb, count, (u64)*pos,
+        write, target_queue, false);
+  else
+    res = onic_cdev_submit(fctx, iocb.sgl, iocb.page_nb, count, (u64)*pos,
+        write, target_queue, false);
 
   unmap_user_buf(&iocb, write);
   iocb_release(&iocb);
 
-  if(!write){
-    down(&read_mutex2);
-    read_queue_pool[read_write_idx] = target_queue;
-    read_write_idx = (read_write_idx + 1) % xcdev->no_mm_queues;
-    up(&read_mutex2);
-    up(&read_sem);
+  return res;
+}
+
+/*
+ * Asynchronous read_iter/write_iter
+ */
+static void onic_cdev_aio_work(struct work_struct *work)
+{
+  struct onic_cdev_aio *aio = container_of(work, struct onic_cdev_aio, work);
+  struct kiocb *kiocb = aio->kiocb;
+  ssize_t res = aio->res;
+
+  unmap_user_buf(&aio->iocb, aio->write);
+  iocb_release(&aio->iocb);
+  kfree(aio);
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 16, 0)
+  kiocb->ki_complete(kiocb, res, 0);
+#else
+  kiocb->ki_complete(kiocb, res);
+#endif
+}
+
+/*
+ * Called by libqdma with the descriptor queue locked, so unpinning the pages
+ * and completing the kiocb are left to onic_cdev_aio_work().
+ */
+static int onic_cdev_aio_done(struct qdma_request *req, unsigned int bytes_done, int err)
+{
+  struct onic_cdev_aio *aio = container_of(req, struct onic_cdev_aio, iocb.qd_req);
+  struct onic_cdev_file *fctx = aio->kiocb->ki_filp->private_data;
+
+  aio->res = err ? err : bytes_done;
+  onic_cdev_stats_end(fctx->xcdev, aio->write, aio->queue, aio->start, aio->res);
+  schedule_work(&aio->work);
+  return 0;
+}
+
+static ssize_t onic_cdev_aio_submit(struct onic_cdev_file *fctx, struct kiocb *kiocb,
+        char __user *buf, size_t count, bool write)
+{
+  struct onic_cdev *xcdev = fctx->xcdev;
+  struct onic_cdev_aio *aio;
+  struct qdma_request *req;
+  unsigned long qhndl;
+  int target_queue;
+  ssize_t rv;
+
+  aio = kzalloc(sizeof(struct onic_cdev_aio), GFP_KERNEL);
+  if (!aio)
+    return -ENOMEM;
+
+  aio->kiocb = kiocb;
+  aio->write = write;
+  INIT_WORK(&aio->work, onic_cdev_aio_work);
+  aio->iocb.private = aio;
+  aio->iocb.buf = buf;
+  aio->iocb.len = count;
+  rv = map_user_buf_to_sgl(&aio->iocb, write);
+  if (rv < 0) {
+    kfree(aio);
+    return rv;
+  }
+
+  /*
+   * libqdma keeps a work list per queue, so asynchronous requests of an
+   * unbound file share the MM queues round-robin instead of claiming one
+   * until they complete.
+   */
+  target_queue = READ_ONCE(fctx->queue);
+  if (target_queue < 0)
+    target_queue = (unsigned int)atomic_inc_return(&xcdev->async_queue_idx) % xcdev->no_mm_queues;
+  qhndl = onic_cdev_qhndl(xcdev, write, target_queue);
+
+  req = &aio->iocb.qd_req;
+  onic_cdev_init_req(req, aio->iocb.sgl, aio->iocb.page_nb, count, (u64)kiocb->ki_pos,
+      write, false);
+  req->aperture_size = READ_ONCE(fctx->aperture);
+  req->fp_done = onic_cdev_aio_done;
+
+  pr_debug("%s, priv 0x%lx: aio buf 0x%p,%llu, pos %llu, W %d.\n",
+      xcdev->name, qhndl, buf, (u64)count, (u64)kiocb->ki_pos, write);
+
+  aio->queue = target_queue;
+  aio->start = onic_cdev_stats_start(xcdev, write, target_queue);
+  rv = xcdev->fp_rw(xcdev->dev_handle, qhndl, req);
+  if (rv < 0) {
+    onic_cdev_stats_end(xcdev, write, target_queue, aio->start, rv);
+    unmap_user_buf(&aio->iocb, write);
+    iocb_release(&aio->iocb);
+    kfree(aio);
+    return rv;
   }
-  else{
-    down(&write_mutex2);
-    write_queue_pool[write_write_idx] = target_queue;
-    write_write_idx = (write_write_idx + 1) % xcdev->no_mm_queues;
-    up(&write_mutex2);
-    up(&write_sem);
+
+  return -EIOCBQUEUED;
+}
+
+/* iov_iter::iov became __iov in 6.4, read through iter_iov() */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 4, 0)
+#define iter_iov(iter) ((iter)->iov)
+#endif
+
+static char __user *onic_cdev_iter_buf(struct iov_iter *iter)
+{
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 0, 0)
+  if (iter_is_ubuf(iter))
+    return (char __user *)iter->ubuf + iter->iov_offset;
+#endif
+  if (iter_is_iovec(iter))
+    return (char __user *)iter_iov(iter)->iov_base + iter->iov_offset;
+  return NULL;
+}
+
+/*
+ * readv/writev: the iovecs cover consecutive card memory starting at pos and
+ * are submitted to one queue as a single batch.
+ */
+static ssize_t onic_cdev_rw_iovec(struct onic_cdev_file *fctx, struct iov_iter *iter,
+        loff_t pos, bool write)
+{
+  const struct iovec *iov = iter_iov(iter);
+  struct onic_cdev_seg *segs;
+  size_t left = iov_iter_count(iter);
+  size_t skip = iter->iov_offset;
+  unsigned int nr_segs = 0;
+  ssize_t res;
+  int i;
+
+  segs = kcalloc(iter->nr_segs, sizeof(struct onic_cdev_seg), GFP_KERNEL);
+  if (!segs)
+    return -ENOMEM;
+
+  for (i = 0; i < iter->nr_segs && left; i++, skip = 0) {
+    size_t len = min_t(size_t, iov[i].iov_len - skip, left);
+
+    if (!len)
+      continue;
+    segs[nr_segs].buf = (char __user *)iov[i].iov_base + skip;
+    segs[nr_segs].len = len;
+    segs[nr_segs].ep_addr = (u64)pos;
+    nr_segs++;
+    pos += len;
+    left -= len;
   }
 
+  res = onic_cdev_submit_batch(fctx, segs, nr_segs, write);
+  if (res > 0)
+    iov_iter_advance(iter, res);
+
+  kfree(segs);
   return res;
 }
 
+/*
+ * Like read() and write(), ki_pos is the card memory address and is not
+ * advanced. Async kiocbs with a single segment are completed from the DMA
+ * completion path, vectored I/O is submitted as one batch.
+ */
+static ssize_t onic_cdev_rw_iter(struct kiocb *kiocb, struct iov_iter *iter, bool write)
+{
+  struct file *file = kiocb->ki_filp;
+  struct onic_cdev_file *fctx = (struct onic_cdev_file *)file->private_data;
+  char __user *buf = onic_cdev_iter_buf(iter);
+  loff_t pos = kiocb->ki_pos;
+  size_t count = iov_iter_count(iter);
+  ssize_t res;
+  int target_queue;
+  bool claimed;
+
+  if (!count)
+    return 0;
+
+  if (!buf)
+    return -EINVAL;
+
+  if (iov_iter_single_seg_count(iter) != count)
+    return onic_cdev_rw_iovec(fctx, iter, pos, write);
+
+  if (!is_sync_kiocb(kiocb))
+    return onic_cdev_aio_submit(fctx, kiocb, buf, count, write);
+
+  target_queue = onic_cdev_get_queue(fctx, write, &claimed);
+  res = onic_gen_read_write(file, buf, count, &pos, write, target_queue);
+  onic_cdev_put_queue(fctx, write, target_queue, claimed);
+  if (res > 0)
+    iov_iter_advance(iter, res);
+
+  return res;
+}
+
+static ssize_t onic_cdev_read_iter(struct kiocb *kiocb, struct iov_iter *iter)
+{
+  return onic_cdev_rw_iter(kiocb, iter, false);
+}
+
+static ssize_t onic_cdev_write_iter(struct kiocb *kiocb, struct iov_iter *iter)
+{
+  return onic_cdev_rw_iter(kiocb, iter, true);
+}
+
+/*
+ * mmap() of driver-allocated DMA buffers. Each mapping holds a reference to
+ * its buffer, so the buffer outlives ONIC_IOC_UNREG_BUF and close() until
+ * it is unmapped.
+ */
+static void onic_cdev_vm_open(struct vm_area_struct *vma)
+{
+  struct onic_cdev_buf *cbuf = vma->vm_private_data;
+
+  kref_get(&cbuf->ref);
+}
+
+static void onic_cdev_vm_close(struct vm_area_struct *vma)
+{
+  struct onic_cdev_buf *cbuf = vma->vm_private_data;
+
+  kref_put(&cbuf->ref, onic_cdev_buf_release);
+}
+
+static const struct vm_operations_struct onic_cdev_vm_ops = {
+  .open   = onic_cdev_vm_open,
+  .close  = onic_cdev_vm_close,
+};
+
+static int onic_cdev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+  struct onic_cdev_file *fctx = (struct onic_cdev_file *)file->private_data;
+  struct device *dev = &fctx->xcdev->qdev->pdev->dev;
+  struct onic_cdev_buf *cbuf;
+  int rv;
+
+  /* the mmap offset selects the buffer, the mapping starts at its beginning */
+  if (vma->vm_pgoff > U32_MAX)
+    return -EINVAL;
+  cbuf = onic_cdev_buf_get(fctx, vma->vm_pgoff);
+  if (!cbuf)
+    return -EINVAL;
+
+  if (!cbuf->cpu_addr || vma->vm_end - vma->vm_start > cbuf->len) {
+    rv = -EINVAL;
+    goto err_out;
+  }
+
+  vma->vm_pgoff = 0;
+  rv = dma_mmap_coherent(dev, vma, cbuf->cpu_addr, cbuf->dma_handle, cbuf->len);
+  if (rv < 0)
+    goto err_out;
+
+  /* the reference taken by onic_cdev_buf_get() is dropped in vm_close */
+  vma->vm_private_data = cbuf;
+  vma->vm_ops = &onic_cdev_vm_ops;
+  return 0;
+
+err_out:
+  kref_put(&cbuf->ref, onic_cdev_buf_release);
+  return rv;
+}
+
 /**
  * Write operation for a character device
  **/
 static ssize_t onic_cdev_write(struct file *file, const char __user *usr_buf, size_t count, loff_t *offset) {
-  struct onic_cdev *onic_cdev_ptr = (struct onic_cdev*) file->private_data;
+  struct onic_cdev_file *fctx = (struct onic_cdev_file *) file->private_data;
   int target_queue;
-  down(&write_sem);
-  down(&write_mutex);
-  target_queue = write_queue_pool[write_read_idx];
-  write_read_idx = (write_read_idx + 1) % onic_cdev_ptr->no_mm_queues;
-  up(&write_mutex);
-  dev_dbg(&onic_cdev_ptr->qdev->pdev->dev, "Write obtained queue %d\n", target_queue);
-  return onic_gen_read_write(file, (char *) usr_buf, count, offset, 1, target_queue);
+  bool claimed;
+  ssize_t res;
+
+  target_queue = onic_cdev_get_queue(fctx, 1, &claimed);
+  dev_dbg(&fctx->xcdev->qdev->pdev->dev, "Write obtained queue %d\n", target_queue);
+  res = onic_gen_read_write(file, (char *) usr_buf, count, offset, 1, target_queue);
+  onic_cdev_put_queue(fctx, 1, target_queue, claimed);
+  return res;
 }
 
 /**
  * Read operation for a character device
  **/
 static ssize_t onic_cdev_read(struct file *file, char __user *usr_buf, size_t count, loff_t *offset) {
-  struct onic_cdev *onic_cdev_ptr = (struct onic_cdev*) file->private_data;
+  struct onic_cdev_file *fctx = (struct onic_cdev_file *) file->private_data;
   int target_queue;
-  down(&read_sem);
-  down(&read_mutex);
-  target_queue = read_queue_pool[read_read_idx];
-  read_read_idx = (read_read_idx + 1) % onic_cdev_ptr->no_mm_queues;
-  up(&read_mutex);
-  dev_dbg(&onic_cdev_ptr->qdev->pdev->dev, "Read obtained queue %d\n", target_queue);
-  return onic_gen_read_write(file, (char *) usr_buf, count, offset, 0, target_queue);
+  bool claimed;
+  ssize_t res;
+
+  target_queue = onic_cdev_get_queue(fctx, 0, &claimed);
+  dev_dbg(&fctx->xcdev->qdev->pdev->dev, "Read obtained queue %d\n", target_queue);
+  res = onic_gen_read_write(file, (char *) usr_buf, count, offset, 0, target_queue);
+  onic_cdev_put_queue(fctx, 0, target_queue, claimed);
+  return res;
 }
 
 /**
  * Set offset in the character device
  */
 static loff_t onic_cdev_llseek(struct file *file, loff_t off, int whence) {
-  struct onic_cdev *onic_cdev_ptr = (struct onic_cdev*) file->private_data;
+  struct onic_cdev *onic_cdev_ptr = ((struct onic_cdev_file *) file->private_data)->xcdev;
 
   loff_t newpos = 0;
 
@@ -326,33 +1713,69 @@ static loff_t onic_cdev_llseek(struct file *file, loff_t off, int whence) {
 static const struct file_operations onic_cdev_fops = {
   .read         = onic_cdev_read,
   .write        = onic_cdev_write,
+  .read_iter    = onic_cdev_read_iter,
+  .write_iter   = onic_cdev_write_iter,
   .unlocked_ioctl = onic_cdev_ioctl,
   .open         = onic_cdev_open,
   .release      = onic_cdev_close,
   .llseek       = onic_cdev_llseek,
+  .mmap         = onic_cdev_mmap,
 };
 
-int onic_init_cdev(struct onic_cdev *onic_cdev_ptr, int no_mm_queues) {
+/**
+ * Dump the MM queue statistics, one line per queue and direction:
+ * dir queue requests bytes errors shared inflight service_ns hist[0..15]
+ **/
+static ssize_t mm_stats_show(struct device *dev, struct device_attribute *attr, char *buf)
+{
+  struct onic_cdev *xcdev = dev_get_drvdata(dev);
+  struct onic_cdev_qstats sum;
+  struct onic_cdev_qstats *qs;
+  ssize_t len = 0;
+  int write;
+  int cpu;
+  int q;
   int i;
 
-  sema_init(&read_sem, no_mm_queues);
-  sema_init(&read_mutex, 1);
-  sema_init(&read_mutex2, 1);
-  read_read_idx = 0;
-  read_write_idx = 0;
-
-  for(i = 0 ; i < no_mm_queues ; i++){
-    read_queue_pool[i] = i;
+  for (write = 0; write < 2; write++) {
+    for (q = 0; q < xcdev->no_mm_queues; q++) {
+      memset(&sum, 0, sizeof(sum));
+      for_each_possible_cpu(cpu) {
+        qs = per_cpu_ptr(onic_cdev_qstats(xcdev, write, q), cpu);
+        sum.requests += READ_ONCE(qs->requests);
+        sum.bytes += READ_ONCE(qs->bytes);
+        sum.errors += READ_ONCE(qs->errors);
+        sum.shared += READ_ONCE(qs->shared);
+        sum.inflight += READ_ONCE(qs->inflight);
+        sum.service_ns += READ_ONCE(qs->service_ns);
+        for (i = 0; i < ONIC_CDEV_LAT_BUCKETS; i++)
+          sum.service_hist[i] += READ_ONCE(qs->service_hist[i]);
+      }
+
+      len += scnprintf(buf + len, PAGE_SIZE - len, "%s %d %llu %llu %llu %llu %lld %llu",
+          write ? "h2c" : "c2h", q, sum.requests, sum.bytes, sum.errors, sum.shared,
+          max_t(s64, sum.inflight, 0), sum.service_ns);
+      for (i = 0; i < ONIC_CDEV_LAT_BUCKETS; i++)
+        len += scnprintf(buf + len, PAGE_SIZE - len, " %llu", sum.service_hist[i]);
+      len += scnprintf(buf + len, PAGE_SIZE - len, "\n");
+    }
   }
 
-  sema_init(&write_sem, no_mm_queues);
-  sema_init(&write_mutex, 1);
-  sema_init(&write_mutex2, 1);
-  write_read_idx = 0;
-  write_write_idx = 0;
-  for(i = 0 ; i < no_mm_queues ; i++){
-    write_queue_pool[i] = i;
-  }
+  return len;
+}
+static DEVICE_ATTR_RO(mm_stats);
+
+static struct attribute *onic_cdev_attrs[] = {
+  &dev_attr_mm_stats.attr,
+  NULL,
+};
+ATTRIBUTE_GROUPS(onic_cdev);
+
+int onic_init_cdev(struct onic_cdev *onic_cdev_ptr, int no_mm_queues) {
+  onic_cdev_ptr->c2h_queue_busy = 0;
+  onic_cdev_ptr->h2c_queue_busy = 0;
+  atomic_set(&onic_cdev_ptr->async_queue_idx, 0);
+  atomic_set(&onic_cdev_ptr->bind_queue_idx, 0);
   return 0;
 }
 
@@ -368,17 +1791,33 @@ int onic_create_cdev(struct onic_cdev *onic_cdev_ptr, struct onic_priv * xpriv,
   xdev = (struct xlnx_dma_dev *)xpriv->dev_handle;
   no_mm_queues = xpriv->pinfo->mm_queues;
 
+  // the user interrupt handler may run as soon as xpriv is set
+  spin_lock_init(&onic_cdev_ptr->event_lock);
+  INIT_LIST_HEAD(&onic_cdev_ptr->event_files);
+
   onic_cdev_ptr->dev_handle = xpriv->dev_handle;
   xpriv->onic_cdev_ptr = onic_cdev_ptr;
   xpriv->onic_cdev_ptr->qdev = xdev_2_qdev(xdev);
-  xpriv->onic_cdev_ptr->xpriv = xpriv;
+  smp_store_release(&xpriv->onic_cdev_ptr->xpriv, xpriv);
   xpriv->onic_cdev_ptr->qdev->pdev = xpriv->pcidev;
 
+  // queue claims are tracked in one bitmap word per direction
+  if (no_mm_queues > BITS_PER_LONG) {
+    dev_warn(&onic_cdev_ptr->qdev->pdev->dev, "%s: using %d of %d MM queues\n",
+             ONIC_CDEV_CLASS_NAME, BITS_PER_LONG, no_mm_queues);
+    no_mm_queues = BITS_PER_LONG;
+  }
+
   onic_cdev_ptr->fp_rw = qdma_request_submit;
   onic_cdev_ptr->no_mm_queues = no_mm_queues;
 
-  read_queue_pool = (int*) kzalloc(sizeof(int) * no_mm_queues, GFP_KERNEL);
-  write_queue_pool = (int*) kzalloc(sizeof(int) * no_mm_queues, GFP_KERNEL);
+  onic_cdev_ptr->qstats = __alloc_percpu(2 * no_mm_queues * sizeof(struct onic_cdev_qstats),
+                                         __alignof__(struct onic_cdev_qstats));
+  if (!onic_cdev_ptr->qstats) {
+    dev_err(&onic_cdev_ptr->qdev->pdev->dev, "%s: failed to allocate MM queue statistics\n",
+            ONIC_CDEV_CLASS_NAME);
+    return -ENOMEM;
+  }
 
   // Create a cdev class
   onic_cdev_class = class_create(THIS_MODULE, ONIC_CDEV_CLASS_NAME);
@@ -427,7 +1866,7 @@ int onic_create_cdev(struct onic_cdev *onic_cdev_ptr, struct onic_priv * xpriv,
 
   // Create a device file node and register it with sysfs
   if(onic_cdev_class){
-    sysfs_dev = device_create(onic_cdev_class, &(onic_cdev_ptr->qdev->pdev->dev), onic_cdev_ptr->cdev_no, NULL, "%s", onic_cdev_ptr->name);
+    sysfs_dev = device_create_with_groups(onic_cdev_class, &(onic_cdev_ptr->qdev->pdev->dev), onic_cdev_ptr->cdev_no, onic_cdev_ptr, onic_cdev_groups, "%s", onic_cdev_ptr->name);
     if(IS_ERR(sysfs_dev)) {
       err = PTR_ERR(sysfs_dev);
       dev_err(&onic_cdev_ptr->qdev->pdev->dev, "%s: device_create failed %d\n", onic_cdev_ptr->name, err);
@@ -468,7 +1907,6 @@ void onic_destroy_cdev(struct onic_cdev *onic_cdev_ptr) {
       dev_info(&onic_cdev_ptr->qdev->pdev->dev, "%s cdev_major is reset to %d, onic_destroy_cdev done\n", onic_cdev_ptr->name, onic_cdev_ptr->cdev_major);
   }
 
-  kfree(read_queue_pool);
-  kfree(write_queue_pool);
+  free_percpu(onic_cdev_ptr->qstats);
   kfree(onic_cdev_ptr);
 }
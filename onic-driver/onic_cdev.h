@@ -25,9 +25,39 @@
 #include <asm/cacheflush.h>
 #include <linux/syscalls.h>
 #include <linux/semaphore.h>
+#include <linux/mutex.h>
+#include <linux/idr.h>
+#include <linux/kref.h>
+#include <linux/refcount.h>
+#include <linux/uio.h>
+#include <linux/workqueue.h>
+#include <linux/completion.h>
+#include <linux/eventfd.h>
+#include <linux/spinlock.h>
+#include <linux/scatterlist.h>
+#include "onic_ioctl.h"
 
 #define ONIC_CDEV_CLASS_NAME DRV_CDEV_NAME
 #define MAX_MINOR_DEV 64
+/* service time buckets: bucket i counts requests below 2^i us, the last one the rest */
+#define ONIC_CDEV_LAT_BUCKETS 16
+
+/**
+ * Transfer statistics of one MM queue in one direction, kept per CPU and
+ * summed when read
+ **/
+struct onic_cdev_qstats {
+  u64 requests;
+  u64 bytes;
+  u64 errors;
+  /* requests of unbound files that found every queue busy and shared this one */
+  u64 shared;
+  /* submitted minus completed requests, only meaningful summed over CPUs */
+  s64 inflight;
+  /* total time from submission to completion in ns */
+  u64 service_ns;
+  u64 service_hist[ONIC_CDEV_LAT_BUCKETS];
+};
 
 /**
  * Data structure for a character device
@@ -53,14 +83,72 @@ struct onic_cdev {
   unsigned long dev_handle;
   /* callback function to handle read/write request */
   ssize_t (*fp_rw)(unsigned long xpdev_hndl, unsigned long q_hndl, struct qdma_request *qd_req);
-  /* name of the character device */
-  char name[0];
   struct onic_priv *xpriv;
   //struct net_device *netdev;
 
   int read_idx;
   int write_idx;
+  /* next queue for asynchronous requests, which do not own a queue */
+  atomic_t async_queue_idx;
+  /* next queue for files bound with ONIC_QUEUE_AUTO */
+  atomic_t bind_queue_idx;
+  /* queues claimed by unbound files, one bit per MM queue */
+  unsigned long c2h_queue_busy;
+  unsigned long h2c_queue_busy;
+  /* per-CPU statistics, C2H queues first, then H2C queues */
+  struct onic_cdev_qstats __percpu *qstats;
+  /* protects event_files, taken from the user interrupt handler */
+  spinlock_t event_lock;
+  /* open files with at least one eventfd attached */
+  struct list_head event_files;
 
+  /* name of the character device, allocated past the end of the struct */
+  char name[0];
+};
+
+/**
+ * Data structure for a user buffer registered with ONIC_IOC_REG_BUF, or a
+ * DMA buffer allocated with ONIC_IOC_ALLOC_DMA_BUF
+ **/
+struct onic_cdev_buf {
+  struct kref ref;
+  /* handle returned to user space */
+  u32 handle;
+  /* user virtual address and length of the buffer */
+  unsigned long addr;
+  size_t len;
+  /* number of pinned pages */
+  unsigned int page_nb;
+  /* scatter gather list with cached DMA addresses, one entry per page */
+  struct qdma_sw_sg *sgl;
+  /* pinned pages */
+  struct page **pages;
+  /* kernel address and bus address of a driver-allocated DMA buffer */
+  void *cpu_addr;
+  dma_addr_t dma_handle;
+  /* pinned pages mapped as a whole, for ONIC_IOC_MAP_USER_MEM */
+  struct sg_table sgt;
+  struct onic_cdev *xcdev;
+};
+
+/**
+ * Data structure for an open file of a character device
+ **/
+struct onic_cdev_file {
+  struct onic_cdev *xcdev;
+  /* MM queue bound to this file, or ONIC_QUEUE_UNBOUND */
+  int queue;
+  /* keyhole aperture of requests issued through this file, 0 - linear */
+  u32 aperture;
+  /* protects buf_idr */
+  struct mutex buf_lock;
+  /* registered user buffers, indexed by handle */
+  struct idr buf_idr;
+  /* eventfds signalled on user interrupts, indexed by enum onic_event_source */
+  struct eventfd_ctx *event_ctx[ONIC_EVENT_MAX];
+  /* entry in onic_cdev.event_files */
+  struct list_head event_node;
+  bool event_listed;
 };
 
 /**
@@ -82,6 +170,68 @@ struct cdev_io_cb {
   struct qdma_request qd_req;
 };
 
+/**
+ * Data structure for an asynchronous read_iter/write_iter request
+ **/
+struct onic_cdev_aio {
+  /* kiocb completed when the DMA is done */
+  struct kiocb *kiocb;
+  /* completion is deferred out of the libqdma completion path */
+  struct work_struct work;
+  bool write;
+  /* bytes transferred or negative error code */
+  ssize_t res;
+  /* MM queue and submission time, for statistics */
+  int queue;
+  u64 start;
+  struct cdev_io_cb iocb;
+};
+
+struct onic_cdev_stripe_ctl;
+
+/**
+ * Data structure for one stripe of a striped transfer
+ **/
+struct onic_cdev_stripe {
+  struct qdma_request req;
+  struct onic_cdev_stripe_ctl *ctl;
+  /* queue handle the stripe was submitted to */
+  unsigned long qhndl;
+  /* MM queue index and submission time, for statistics */
+  int queue;
+  u64 start;
+  /* the stripe is owned by libqdma until it completes */
+  bool submitted;
+  unsigned int bytes_done;
+  int err;
+};
+
+/**
+ * Data structure shared by the stripes of a striped transfer
+ **/
+struct onic_cdev_stripe_ctl {
+  /* stripes not completed yet, plus one held by the submitter */
+  atomic_t pending;
+  /* same, but the submitter only drops its reference once it is done with
+   * the stripes, so that ctl outlives the callback that completes done */
+  refcount_t refs;
+  struct completion done;
+  struct onic_cdev *xcdev;
+  unsigned int nstripes;
+  struct onic_cdev_stripe stripes[];
+};
+
+/**
+ * Data structure for one segment of a batch submission
+ **/
+struct onic_cdev_seg {
+  /* user buffer */
+  char __user *buf;
+  size_t len;
+  /* card memory address */
+  u64 ep_addr;
+};
+
 /**
  * qdma scatter gather request
  * @ingroup libqdma_struct
@@ -122,4 +272,12 @@ void onic_destroy_cdev(struct onic_cdev *onic_cdev_ptr);
  **/
 int onic_create_cdev(struct onic_cdev *onic_cdev_ptr, struct onic_priv * xpriv, unsigned int qid);
 
+/**
+ * onic_cdev_user_isr - signal the eventfds attached to a user interrupt
+ * @onic_cdev_ptr: pointer to an onic_cdev data
+ *
+ * Called in hard interrupt context.
+ **/
+void onic_cdev_user_isr(struct onic_cdev *onic_cdev_ptr);
+
 #endif /* ifndef __ONIC_CDEV_H__ */
@@ -1,3 +1,4 @@
+#include <linux/version.h>
 #include <linux/pci.h>
 #include <linux/netdevice.h>
 #include <linux/ethtool.h>
@@ -6,6 +7,131 @@
 
 extern const char onic_drv_name[];
 extern const char onic_drv_ver[];
+extern int onic_qdma_reconfig(struct onic_priv *xpriv, u8 rx_rng_sz_idx,
+			      u8 tx_rng_sz_idx, u8 timer_idx, u8 cnt_th_idx,
+			      u8 buf_sz_idx, u16 headroom);
+extern int onic_qdma_set_coalesce(struct onic_priv *xpriv, u8 timer_idx,
+				  u8 cnt_th_idx);
+extern void onic_write_rss_indir(struct onic_priv *xpriv);
+extern void onic_write_rss_key(struct onic_priv *xpriv);
+
+struct onic_stat {
+	char name[ETH_GSTRING_LEN];
+	int offset;
+};
+
+#define ONIC_RX_QSTAT(m) { #m, offsetof(struct onic_rx_qstats, m) }
+#define ONIC_TX_QSTAT(m) { #m, offsetof(struct onic_tx_qstats, m) }
+
+static const struct onic_stat onic_rx_qstats_desc[] = {
+	ONIC_RX_QSTAT(packets),
+	ONIC_RX_QSTAT(bytes),
+	ONIC_RX_QSTAT(dropped),
+	ONIC_RX_QSTAT(copybreak),
+	ONIC_RX_QSTAT(build_skb),
+	ONIC_RX_QSTAT(frags),
+	ONIC_RX_QSTAT(budget_exhausted),
+	ONIC_RX_QSTAT(xdp_drop),
+	ONIC_RX_QSTAT(xdp_tx),
+	ONIC_RX_QSTAT(xdp_redirect),
+};
+
+static const struct onic_stat onic_tx_qstats_desc[] = {
+	ONIC_TX_QSTAT(packets),
+	ONIC_TX_QSTAT(bytes),
+	ONIC_TX_QSTAT(dropped),
+	ONIC_TX_QSTAT(ring_full),
+	ONIC_TX_QSTAT(stopped),
+};
+
+#define ONIC_RX_QSTATS_LEN ARRAY_SIZE(onic_rx_qstats_desc)
+#define ONIC_TX_QSTATS_LEN ARRAY_SIZE(onic_tx_qstats_desc)
+
+/*
+ * CMAC statistics are 48-bit counters latched by a write to the tick
+ * register, each snapshot holding the counts since the previous tick, so
+ * they are accumulated in software. The adapter counters are plain 32-bit
+ * registers. Offsets are given for CMAC 0 and rebased on the port in use.
+ */
+struct onic_cmac_stat {
+	char name[ETH_GSTRING_LEN];
+	u32 offset;
+	bool latched;
+};
+
+#define ONIC_CMAC_STAT(s, r) { s, CMAC_OFFSET_STAT_##r(0), true }
+#define ONIC_ADPT_STAT(s, r) { s, CMAC_ADPT_OFFSET_##r(0), false }
+
+static const struct onic_cmac_stat onic_cmac_stats_desc[] = {
+	ONIC_CMAC_STAT("cmac_tx_total_pkts", TX_TOTAL_PKTS),
+	ONIC_CMAC_STAT("cmac_tx_total_good_pkts", TX_TOTAL_GOOD_PKTS),
+	ONIC_CMAC_STAT("cmac_tx_total_bytes", TX_TOTAL_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_total_good_bytes", TX_TOTAL_GOOD_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_pkt_64_bytes", TX_PKT_64_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_pkt_65_127_bytes", TX_PKT_65_127_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_pkt_128_255_bytes", TX_PKT_128_255_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_pkt_256_511_bytes", TX_PKT_256_511_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_pkt_512_1023_bytes", TX_PKT_512_1023_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_pkt_1024_1518_bytes", TX_PKT_1024_1518_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_pkt_1519_1522_bytes", TX_PKT_1519_1522_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_pkt_1523_1548_bytes", TX_PKT_1523_1548_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_pkt_1549_2047_bytes", TX_PKT_1549_2047_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_pkt_2048_4095_bytes", TX_PKT_2048_4095_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_pkt_4096_8191_bytes", TX_PKT_4096_8191_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_pkt_8192_9215_bytes", TX_PKT_8192_9215_BYTES),
+	ONIC_CMAC_STAT("cmac_tx_pkt_large", TX_PKT_LARGE),
+	ONIC_CMAC_STAT("cmac_tx_pkt_small", TX_PKT_SMALL),
+	ONIC_CMAC_STAT("cmac_tx_bad_fcs", TX_BAD_FCS),
+	ONIC_CMAC_STAT("cmac_tx_frame_error", TX_FRAME_ERROR),
+	ONIC_CMAC_STAT("cmac_tx_unicast", TX_UNICAST),
+	ONIC_CMAC_STAT("cmac_tx_multicast", TX_MULTICAST),
+	ONIC_CMAC_STAT("cmac_tx_broadcast", TX_BROADCAST),
+	ONIC_CMAC_STAT("cmac_tx_vlan", TX_VLAN),
+	ONIC_CMAC_STAT("cmac_tx_pause", TX_PAUSE),
+	ONIC_CMAC_STAT("cmac_tx_user_pause", TX_USER_PAUSE),
+	ONIC_CMAC_STAT("cmac_rx_total_pkts", RX_TOTAL_PKTS),
+	ONIC_CMAC_STAT("cmac_rx_total_good_pkts", RX_TOTAL_GOOD_PKTS),
+	ONIC_CMAC_STAT("cmac_rx_total_bytes", RX_TOTAL_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_total_good_bytes", RX_TOTAL_GOOD_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_pkt_64_bytes", RX_PKT_64_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_pkt_65_127_bytes", RX_PKT_65_127_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_pkt_128_255_bytes", RX_PKT_128_255_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_pkt_256_511_bytes", RX_PKT_256_511_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_pkt_512_1023_bytes", RX_PKT_512_1023_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_pkt_1024_1518_bytes", RX_PKT_1024_1518_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_pkt_1519_1522_bytes", RX_PKT_1519_1522_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_pkt_1523_1548_bytes", RX_PKT_1523_1548_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_pkt_1549_2047_bytes", RX_PKT_1549_2047_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_pkt_2048_4095_bytes", RX_PKT_2048_4095_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_pkt_4096_8191_bytes", RX_PKT_4096_8191_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_pkt_8192_9215_bytes", RX_PKT_8192_9215_BYTES),
+	ONIC_CMAC_STAT("cmac_rx_pkt_large", RX_PKT_LARGE),
+	ONIC_CMAC_STAT("cmac_rx_pkt_small", RX_PKT_SMALL),
+	ONIC_CMAC_STAT("cmac_rx_undersize", RX_UNDERSIZE),
+	ONIC_CMAC_STAT("cmac_rx_fragment", RX_FRAGMENT),
+	ONIC_CMAC_STAT("cmac_rx_oversize", RX_OVERSIZE),
+	ONIC_CMAC_STAT("cmac_rx_toolong", RX_TOOLONG),
+	ONIC_CMAC_STAT("cmac_rx_jabber", RX_JABBER),
+	ONIC_CMAC_STAT("cmac_rx_bad_fcs", RX_BAD_FCS),
+	ONIC_CMAC_STAT("cmac_rx_pkt_bad_fcs", RX_PKT_BAD_FCS),
+	ONIC_CMAC_STAT("cmac_rx_stomped_fcs", RX_STOMPED_FCS),
+	ONIC_CMAC_STAT("cmac_rx_unicast", RX_UNICAST),
+	ONIC_CMAC_STAT("cmac_rx_multicast", RX_MULTICAST),
+	ONIC_CMAC_STAT("cmac_rx_broadcast", RX_BROADCAST),
+	ONIC_CMAC_STAT("cmac_rx_vlan", RX_VLAN),
+	ONIC_CMAC_STAT("cmac_rx_pause", RX_PAUSE),
+	ONIC_CMAC_STAT("cmac_rx_user_pause", RX_USER_PAUSE),
+	ONIC_CMAC_STAT("cmac_rx_inrangeerr", RX_INRANGEERR),
+	ONIC_CMAC_STAT("cmac_rx_truncated", RX_TRUNCATED),
+	ONIC_CMAC_STAT("cmac_rx_bad_code", RX_BAD_CODE),
+	ONIC_CMAC_STAT("cmac_rx_rsfec_corrected_cw", RX_RSFEC_CORRECTED_CW_INC),
+	ONIC_CMAC_STAT("cmac_rx_rsfec_uncorrected_cw", RX_RSFEC_UNCORRECTED_CW_INC),
+	ONIC_ADPT_STAT("adpt_tx_pkt_recv", TX_PKT_RECV),
+	ONIC_ADPT_STAT("adpt_tx_pkt_drop", TX_PKT_DROP),
+	ONIC_ADPT_STAT("adpt_rx_pkt_recv", RX_PKT_RECV),
+	ONIC_ADPT_STAT("adpt_rx_pkt_drop", RX_PKT_DROP),
+	ONIC_ADPT_STAT("adpt_rx_pkt_error", RX_PKT_ERROR),
+};
 
 static void onic_get_drvinfo(struct net_device *netdev,
 			     struct ethtool_drvinfo *drvinfo)
@@ -19,9 +145,392 @@ static void onic_get_drvinfo(struct net_device *netdev,
 		sizeof(drvinfo->bus_info));
 }
 
+static int onic_get_sset_count(struct net_device *netdev, int sset)
+{
+	switch (sset) {
+	case ETH_SS_STATS:
+		return netdev->real_num_rx_queues * ONIC_RX_QSTATS_LEN +
+		       netdev->real_num_tx_queues * ONIC_TX_QSTATS_LEN +
+		       ONIC_CMAC_STATS_LEN;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static void onic_get_strings(struct net_device *netdev, u32 sset, u8 *data)
+{
+	unsigned int q, i;
+
+	if (sset != ETH_SS_STATS)
+		return;
+
+	for (q = 0; q < netdev->real_num_rx_queues; q++) {
+		for (i = 0; i < ONIC_RX_QSTATS_LEN; i++) {
+			snprintf(data, ETH_GSTRING_LEN, "rx%u_%s", q,
+				 onic_rx_qstats_desc[i].name);
+			data += ETH_GSTRING_LEN;
+		}
+	}
+
+	for (q = 0; q < netdev->real_num_tx_queues; q++) {
+		for (i = 0; i < ONIC_TX_QSTATS_LEN; i++) {
+			snprintf(data, ETH_GSTRING_LEN, "tx%u_%s", q,
+				 onic_tx_qstats_desc[i].name);
+			data += ETH_GSTRING_LEN;
+		}
+	}
+
+	for (i = 0; i < ONIC_CMAC_STATS_LEN; i++) {
+		memcpy(data, onic_cmac_stats_desc[i].name, ETH_GSTRING_LEN);
+		data += ETH_GSTRING_LEN;
+	}
+}
+
+/* Latch the CMAC counters and fold them into xpriv->cmac_stats */
+static void onic_update_cmac_stats(struct onic_priv *xpriv)
+{
+	u8 port_id = xpriv->pinfo->port_id;
+	u32 base = CMAC_SUBSYSTEM_OFFSET(port_id) - CMAC_SUBSYSTEM_OFFSET(0);
+	void __iomem *reg;
+	u64 val;
+	int i;
+
+	writel(0x1, xpriv->bar_base + CMAC_OFFSET_TICK(port_id));
+
+	for (i = 0; i < ONIC_CMAC_STATS_LEN; i++) {
+		reg = xpriv->bar_base + base + onic_cmac_stats_desc[i].offset;
+		if (onic_cmac_stats_desc[i].latched) {
+			val = readl(reg);
+			val |= (u64)(readl(reg + 4) & 0xffff) << 32;
+			xpriv->cmac_stats[i] += val;
+		} else {
+			xpriv->cmac_stats[i] = readl(reg);
+		}
+	}
+}
+
+static void onic_get_ethtool_stats(struct net_device *netdev,
+				   struct ethtool_stats *stats, u64 *data)
+{
+	struct onic_priv *xpriv = netdev_priv(netdev);
+	struct onic_rx_qstats *rxs;
+	struct onic_tx_qstats *txs;
+	unsigned int q, i, start;
+
+	BUILD_BUG_ON(ARRAY_SIZE(onic_cmac_stats_desc) != ONIC_CMAC_STATS_LEN);
+
+	for (q = 0; q < netdev->real_num_rx_queues; q++) {
+		rxs = &xpriv->rx_qstats[q];
+		do {
+			start = u64_stats_fetch_begin(&rxs->syncp);
+			for (i = 0; i < ONIC_RX_QSTATS_LEN; i++)
+				data[i] = *(u64 *)((u8 *)rxs +
+					onic_rx_qstats_desc[i].offset);
+		} while (u64_stats_fetch_retry(&rxs->syncp, start));
+		data += ONIC_RX_QSTATS_LEN;
+	}
+
+	for (q = 0; q < netdev->real_num_tx_queues; q++) {
+		txs = &xpriv->tx_qstats[q];
+		do {
+			start = u64_stats_fetch_begin(&txs->syncp);
+			for (i = 0; i < ONIC_TX_QSTATS_LEN; i++)
+				data[i] = *(u64 *)((u8 *)txs +
+					onic_tx_qstats_desc[i].offset);
+		} while (u64_stats_fetch_retry(&txs->syncp, start));
+		data += ONIC_TX_QSTATS_LEN;
+	}
+
+	/* ethtool ops run under the RTNL lock, which serializes the ticks */
+	onic_update_cmac_stats(xpriv);
+	memcpy(data, xpriv->cmac_stats, sizeof(xpriv->cmac_stats));
+}
+
+static int onic_get_csr_conf(struct onic_priv *xpriv,
+			     struct global_csr_conf *csr_conf)
+{
+	int ret;
+
+	ret = qdma_global_csr_get(xpriv->dev_handle, 0,
+				  QDMA_GLOBAL_CSR_ARRAY_SZ, csr_conf);
+	if (ret != 0) {
+		netdev_err(xpriv->netdev,
+			   "%s: qdma_global_csr_get() failed with status %d\n",
+			   __func__, ret);
+		return -EINVAL;
+	}
+	return 0;
+}
+
+static unsigned int onic_csr_max(unsigned int *arr)
+{
+	unsigned int max = 0;
+	int i;
+
+	for (i = 0; i < QDMA_GLOBAL_CSR_ARRAY_SZ; i++)
+		max = max_t(unsigned int, max, arr[i]);
+	return max;
+}
+
+/* Index of the CSR table entry closest to val */
+static u8 onic_csr_closest(unsigned int *arr, unsigned int val)
+{
+	unsigned int diff, best_diff = UINT_MAX;
+	u8 best = 0;
+	int i;
+
+	for (i = 0; i < QDMA_GLOBAL_CSR_ARRAY_SZ; i++) {
+		diff = arr[i] > val ? arr[i] - val : val - arr[i];
+		if (diff < best_diff) {
+			best_diff = diff;
+			best = i;
+		}
+	}
+	return best;
+}
+
+/* Index of the CSR table entry equal to val, or -1 */
+static int onic_csr_find(unsigned int *arr, unsigned int val)
+{
+	int i;
+
+	for (i = 0; i < QDMA_GLOBAL_CSR_ARRAY_SZ; i++) {
+		if (arr[i] == val)
+			return i;
+	}
+	return -1;
+}
+
+/*
+ * Ring sizes are the entries of the global CSR ring size table, which QDMA
+ * shares between all queues of the device
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 17, 0)
+static void onic_get_ringparam(struct net_device *netdev,
+			       struct ethtool_ringparam *ring)
+#else
+static void onic_get_ringparam(struct net_device *netdev,
+			       struct ethtool_ringparam *ring,
+			       struct kernel_ethtool_ringparam *kring,
+			       struct netlink_ext_ack *extack)
+#endif
+{
+	struct onic_priv *xpriv = netdev_priv(netdev);
+	struct global_csr_conf csr_conf;
+
+	if (onic_get_csr_conf(xpriv, &csr_conf) != 0)
+		return;
+
+	ring->rx_max_pending = onic_csr_max(csr_conf.ring_sz);
+	ring->tx_max_pending = ring->rx_max_pending;
+	ring->rx_pending = csr_conf.ring_sz[xpriv->rx_desc_rng_sz_idx];
+	ring->tx_pending = csr_conf.ring_sz[xpriv->tx_desc_rng_sz_idx];
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 17, 0)
+static int onic_set_ringparam(struct net_device *netdev,
+			      struct ethtool_ringparam *ring)
+#else
+static int onic_set_ringparam(struct net_device *netdev,
+			      struct ethtool_ringparam *ring,
+			      struct kernel_ethtool_ringparam *kring,
+			      struct netlink_ext_ack *extack)
+#endif
+{
+	struct onic_priv *xpriv = netdev_priv(netdev);
+	struct global_csr_conf csr_conf;
+	int rx_idx, tx_idx, ret;
+
+	if (ring->rx_mini_pending || ring->rx_jumbo_pending)
+		return -EINVAL;
+
+	ret = onic_get_csr_conf(xpriv, &csr_conf);
+	if (ret != 0)
+		return ret;
+
+	rx_idx = onic_csr_find(csr_conf.ring_sz, ring->rx_pending);
+	tx_idx = onic_csr_find(csr_conf.ring_sz, ring->tx_pending);
+	if (rx_idx < 0 || tx_idx < 0) {
+		netdev_err(netdev, "%s: ring sizes must be entries of the QDMA ring size table\n",
+			   __func__);
+		return -EINVAL;
+	}
+	/* the TX queue is stopped and woken on ONIC_TX_WAKE_THRES free entries */
+	if (ring->tx_pending <= ONIC_TX_WAKE_THRES + 2)
+		return -EINVAL;
+
+	if (rx_idx == xpriv->rx_desc_rng_sz_idx &&
+	    tx_idx == xpriv->tx_desc_rng_sz_idx)
+		return 0;
+
+	return onic_qdma_reconfig(xpriv, rx_idx, tx_idx, xpriv->rx_timer_idx,
+				  xpriv->rx_cnt_th_idx, xpriv->rx_buf_sz_idx,
+				  xpriv->rx_headroom);
+}
+
+/*
+ * RX moderation is the C2H completion timer and counter threshold, picked
+ * from the global CSR tables. rx-usecs is the timer count of the table.
+ * H2C completions are not moderated.
+ */
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 15, 0)
+static int onic_get_coalesce(struct net_device *netdev,
+			     struct ethtool_coalesce *ec)
+#else
+static int onic_get_coalesce(struct net_device *netdev,
+			     struct ethtool_coalesce *ec,
+			     struct kernel_ethtool_coalesce *kec,
+			     struct netlink_ext_ack *extack)
+#endif
+{
+	struct onic_priv *xpriv = netdev_priv(netdev);
+	struct global_csr_conf csr_conf;
+	int ret;
+
+	ret = onic_get_csr_conf(xpriv, &csr_conf);
+	if (ret != 0)
+		return ret;
+
+	ec->rx_coalesce_usecs = csr_conf.c2h_timer_cnt[xpriv->rx_timer_idx];
+	ec->rx_max_coalesced_frames = csr_conf.c2h_cnt_th[xpriv->rx_cnt_th_idx];
+	return 0;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 15, 0)
+static int onic_set_coalesce(struct net_device *netdev,
+			     struct ethtool_coalesce *ec)
+#else
+static int onic_set_coalesce(struct net_device *netdev,
+			     struct ethtool_coalesce *ec,
+			     struct kernel_ethtool_coalesce *kec,
+			     struct netlink_ext_ack *extack)
+#endif
+{
+	struct onic_priv *xpriv = netdev_priv(netdev);
+	struct global_csr_conf csr_conf;
+	u8 timer_idx, cnt_th_idx;
+	int ret;
+
+	ret = onic_get_csr_conf(xpriv, &csr_conf);
+	if (ret != 0)
+		return ret;
+
+	timer_idx = onic_csr_closest(csr_conf.c2h_timer_cnt,
+				     ec->rx_coalesce_usecs);
+	cnt_th_idx = onic_csr_closest(csr_conf.c2h_cnt_th,
+				      ec->rx_max_coalesced_frames);
+
+	if (timer_idx == xpriv->rx_timer_idx &&
+	    cnt_th_idx == xpriv->rx_cnt_th_idx)
+		return 0;
+
+	return onic_qdma_set_coalesce(xpriv, timer_idx, cnt_th_idx);
+}
+
+static int onic_get_rxnfc(struct net_device *netdev,
+			  struct ethtool_rxnfc *info, u32 *rule_locs)
+{
+	switch (info->cmd) {
+	case ETHTOOL_GRXRINGS:
+		info->data = netdev->real_num_rx_queues;
+		return 0;
+	default:
+		return -EOPNOTSUPP;
+	}
+}
+
+static u32 onic_get_rxfh_indir_size(struct net_device *netdev)
+{
+	return ONIC_RSS_INDIR_SIZE;
+}
+
+static u32 onic_get_rxfh_key_size(struct net_device *netdev)
+{
+	return ONIC_RSS_KEY_SIZE;
+}
+
+/*
+ * The shell hashes with Toeplitz only. Its registers are write-only from the
+ * driver's point of view, so the settings are reported from xpriv.
+ */
+static void onic_get_rss(struct onic_priv *xpriv, u32 *indir, u8 *key)
+{
+	if (indir)
+		memcpy(indir, xpriv->rss_indir, sizeof(xpriv->rss_indir));
+	if (key)
+		memcpy(key, xpriv->rss_key, sizeof(xpriv->rss_key));
+}
+
+static int onic_set_rss(struct onic_priv *xpriv, const u32 *indir,
+			const u8 *key, u8 hfunc)
+{
+	if (hfunc != ETH_RSS_HASH_NO_CHANGE && hfunc != ETH_RSS_HASH_TOP)
+		return -EOPNOTSUPP;
+
+	/* entries are checked against ETHTOOL_GRXRINGS by the core */
+	if (indir) {
+		memcpy(xpriv->rss_indir, indir, sizeof(xpriv->rss_indir));
+		onic_write_rss_indir(xpriv);
+	}
+	if (key) {
+		memcpy(xpriv->rss_key, key, sizeof(xpriv->rss_key));
+		onic_write_rss_key(xpriv);
+	}
+	return 0;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 8, 0)
+static int onic_get_rxfh(struct net_device *netdev, u32 *indir, u8 *key,
+			 u8 *hfunc)
+{
+	if (hfunc)
+		*hfunc = ETH_RSS_HASH_TOP;
+	onic_get_rss(netdev_priv(netdev), indir, key);
+	return 0;
+}
+
+static int onic_set_rxfh(struct net_device *netdev, const u32 *indir,
+			 const u8 *key, const u8 hfunc)
+{
+	return onic_set_rss(netdev_priv(netdev), indir, key, hfunc);
+}
+#else
+static int onic_get_rxfh(struct net_device *netdev,
+			 struct ethtool_rxfh_param *rxfh)
+{
+	rxfh->hfunc = ETH_RSS_HASH_TOP;
+	onic_get_rss(netdev_priv(netdev), rxfh->indir, rxfh->key);
+	return 0;
+}
+
+static int onic_set_rxfh(struct net_device *netdev,
+			 struct ethtool_rxfh_param *rxfh,
+			 struct netlink_ext_ack *extack)
+{
+	return onic_set_rss(netdev_priv(netdev), rxfh->indir, rxfh->key,
+			    rxfh->hfunc);
+}
+#endif
+
 static const struct ethtool_ops onic_ethtool_ops = {
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(5, 7, 0)
+	.supported_coalesce_params = ETHTOOL_COALESCE_RX_USECS |
+				     ETHTOOL_COALESCE_RX_MAX_FRAMES,
+#endif
 	.get_drvinfo = onic_get_drvinfo,
 	.get_link = ethtool_op_get_link,
+	.get_sset_count = onic_get_sset_count,
+	.get_strings = onic_get_strings,
+	.get_ethtool_stats = onic_get_ethtool_stats,
+	.get_ringparam = onic_get_ringparam,
+	.set_ringparam = onic_set_ringparam,
+	.get_coalesce = onic_get_coalesce,
+	.set_coalesce = onic_set_coalesce,
+	.get_rxnfc = onic_get_rxnfc,
+	.get_rxfh_indir_size = onic_get_rxfh_indir_size,
+	.get_rxfh_key_size = onic_get_rxfh_key_size,
+	.get_rxfh = onic_get_rxfh,
+	.set_rxfh = onic_set_rxfh,
 };
 
 void onic_set_ethtool_ops(struct net_device *netdev)
@@ -5,9 +5,16 @@
 #include <linux/pci.h>
 #include <linux/etherdevice.h>
 #include <linux/netdevice.h>
+#include <linux/log2.h>
+#include <linux/ethtool.h>
 #include <net/busy_poll.h>
 
 #include "onic.h"
+#ifdef ONIC_XDP
+#include <linux/bpf.h>
+#include <linux/bpf_trace.h>
+#include <linux/if_vlan.h>
+#endif
 
 char onic_drv_name[] = "onic";
 
@@ -39,6 +46,8 @@ MODULE_DEVICE_TABLE(pci, onic_pci_ids);
 
 static int onic_stats_alloc(struct onic_priv *xpriv)
 {
+  unsigned int i;
+
   if (!xpriv) {
     pr_err("%s: xpriv is NULL\n", __func__);
     return -EINVAL;
@@ -50,9 +59,9 @@ static int onic_stats_alloc(struct onic_priv *xpriv)
 
   xpriv->tx_qstats = kcalloc(1,
            (xpriv->netdev->real_num_tx_queues *
-            sizeof(struct rtnl_link_stats64)) +
+            sizeof(struct onic_tx_qstats)) +
            (xpriv->netdev->real_num_rx_queues *
-            sizeof(struct rtnl_link_stats64))
+            sizeof(struct onic_rx_qstats))
            , GFP_KERNEL);
 
   printk(KERN_INFO "real_num_tx_queues: %d real_num_rx_queues %d\n", xpriv->netdev->real_num_tx_queues, xpriv->netdev->real_num_rx_queues);
@@ -63,18 +72,292 @@ static int onic_stats_alloc(struct onic_priv *xpriv)
     return -ENOMEM;
   }
 
-  xpriv->rx_qstats = xpriv->tx_qstats + xpriv->netdev->real_num_tx_queues;
+  xpriv->rx_qstats = (struct onic_rx_qstats *)
+    (xpriv->tx_qstats + xpriv->netdev->real_num_tx_queues);
+
+  for (i = 0; i < xpriv->netdev->real_num_tx_queues; i++)
+    u64_stats_init(&xpriv->tx_qstats[i].syncp);
+  for (i = 0; i < xpriv->netdev->real_num_rx_queues; i++)
+    u64_stats_init(&xpriv->rx_qstats[i].syncp);
+
+  return 0;
+}
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 12, 0)
+#define napi_build_skb(data, frag_size) build_skb(data, frag_size)
+#endif
+
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 2, 0)
+#define onic_xmit_more(skb) ((skb)->xmit_more)
+#else
+#define onic_xmit_more(skb) netdev_xmit_more()
+#endif
+
+/* Distance between C2H buffers, libqdma lays them out at power of 2 strides */
+static inline unsigned int onic_rx_buf_stride(struct onic_priv *xpriv)
+{
+  return roundup_pow_of_two(xpriv->rx_buf_sz + xpriv->rx_headroom);
+}
+
+#ifdef ONIC_XDP
+static int onic_xdp_xmit_frame(struct onic_priv *xpriv, u16 q_id,
+                               struct xdp_frame *xdpf, bool xmit_more);
+static bool onic_xsk_poll(struct onic_priv *xpriv, u16 q_id, int budget);
+
+/* This function sends an XDP_TX frame on the TX queue paired with an RX
+ * queue, the PIDX is flushed by onic_xdp_flush()
+ */
+static int onic_xdp_tx(struct onic_priv *xpriv, u32 q_no,
+                       struct xdp_frame *xdpf)
+{
+  struct net_device *netdev = xpriv->netdev;
+  struct netdev_queue *txq;
+  u16 tx_q_id;
+  int ret;
+
+  /* shares the TX queue of the stack, whose lock serializes the two */
+  tx_q_id = q_no % netdev->real_num_tx_queues;
+  txq = netdev_get_tx_queue(netdev, tx_q_id);
+  __netif_tx_lock(txq, smp_processor_id());
+  ret = onic_xdp_xmit_frame(xpriv, tx_q_id, xdpf, true);
+  __netif_tx_unlock(txq);
+  if (ret == 0)
+    xpriv->rx_rings[q_no].xdp_flush |= ONIC_XDP_FLUSH_TX;
+
+  return ret;
+}
+
+/* This function runs the XDP program on a received packet. Unless the
+ * verdict is XDP_PASS, the C2H buffers of the packet are consumed.
+ */
+static u32 onic_rx_xdp(struct onic_priv *xpriv, u32 q_no, struct bpf_prog *prog,
+                       unsigned int len, unsigned int sgcnt,
+                       struct qdma_sw_sg *sgl, struct xdp_buff *xdp)
+{
+  struct net_device *netdev = xpriv->netdev;
+  struct onic_rx_ring *rx_ring = &xpriv->rx_rings[q_no];
+  struct onic_rx_qstats *rxs = &xpriv->rx_qstats[q_no];
+  struct xdp_frame *xdpf;
+  u64 *verdict;
+  u32 act;
+
+  /* onic_xdp_setup() sizes the buffers for the MTU, only oversized frames
+   * span several of them
+   */
+  if (unlikely(sgcnt != 1)) {
+    act = XDP_DROP;
+    goto drop;
+  }
+
+  xdp_init_buff(xdp, onic_rx_buf_stride(xpriv), &rx_ring->xdp_rxq);
+  xdp_prepare_buff(xdp, page_address(sgl->pg) + sgl->offset -
+                   xpriv->rx_headroom, xpriv->rx_headroom, len, true);
+
+  act = bpf_prog_run_xdp(prog, xdp);
+  switch (act) {
+  case XDP_PASS:
+    return act;
+  case XDP_TX:
+    xdpf = xdp_convert_buff_to_frame(xdp);
+    if (unlikely(!xdpf || onic_xdp_tx(xpriv, q_no, xdpf) != 0))
+      goto drop;
+
+    verdict = &rxs->xdp_tx;
+    break;
+  case XDP_REDIRECT:
+    if (unlikely(xdp_do_redirect(netdev, xdp, prog) != 0))
+      goto drop;
+
+    rx_ring->xdp_flush |= ONIC_XDP_FLUSH_REDIRECT;
+    verdict = &rxs->xdp_redirect;
+    break;
+  default:
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 17, 0)
+    bpf_warn_invalid_xdp_action(act);
+#else
+    bpf_warn_invalid_xdp_action(netdev, prog, act);
+#endif
+    fallthrough;
+  case XDP_ABORTED:
+    trace_xdp_exception(netdev, prog, act);
+    fallthrough;
+  case XDP_DROP:
+    goto drop;
+  }
+
+  u64_stats_update_begin(&rxs->syncp);
+  (*verdict)++;
+  u64_stats_update_end(&rxs->syncp);
+  return act;
+
+drop:
+  while (sgcnt) {
+    put_page(sgl->pg);
+    sgl = sgl->next;
+    sgcnt--;
+  }
+
+  u64_stats_update_begin(&rxs->syncp);
+  rxs->xdp_drop++;
+  u64_stats_update_end(&rxs->syncp);
+  return XDP_DROP;
+}
+
+/* This function runs the XDP program on a packet received into an AF_XDP
+ * buffer. Unless the verdict is XDP_PASS, the buffer is consumed.
+ */
+static u32 onic_rx_xsk(struct onic_priv *xpriv, u32 q_no, struct bpf_prog *prog,
+                       unsigned int len, unsigned int sgcnt,
+                       struct qdma_sw_sg *sgl)
+{
+  struct net_device *netdev = xpriv->netdev;
+  struct onic_rx_ring *rx_ring = &xpriv->rx_rings[q_no];
+  struct onic_rx_qstats *rxs = &xpriv->rx_qstats[q_no];
+  struct xdp_buff *xdp = sgl->priv;
+  struct xdp_frame *xdpf;
+  u64 *verdict;
+  u32 act;
+
+  /* onic_xsk_enable() sizes the buffers for the MTU */
+  if (unlikely(sgcnt != 1))
+    goto drop;
+
+  xdp->data_end = xdp->data + len;
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 10, 0)
+  xsk_buff_dma_sync_for_cpu(xdp, rx_ring->xsk_pool);
+#else
+  xsk_buff_dma_sync_for_cpu(xdp);
+#endif
+
+  if (!prog)
+    return XDP_PASS;
+
+  act = bpf_prog_run_xdp(prog, xdp);
+  switch (act) {
+  case XDP_PASS:
+    return act;
+  case XDP_TX:
+    /* the frame is copied out of the UMEM, which releases the buffer */
+    xdpf = xdp_convert_buff_to_frame(xdp);
+    if (unlikely(!xdpf))
+      goto drop;
+    if (unlikely(onic_xdp_tx(xpriv, q_no, xdpf) != 0)) {
+      xdp_return_frame(xdpf);
+      goto count_drop;
+    }
+
+    verdict = &rxs->xdp_tx;
+    break;
+  case XDP_REDIRECT:
+    if (unlikely(xdp_do_redirect(netdev, xdp, prog) != 0))
+      goto drop;
+
+    rx_ring->xdp_flush |= ONIC_XDP_FLUSH_REDIRECT;
+    verdict = &rxs->xdp_redirect;
+    break;
+  default:
+#if LINUX_VERSION_CODE < KERNEL_VERSION(5, 17, 0)
+    bpf_warn_invalid_xdp_action(act);
+#else
+    bpf_warn_invalid_xdp_action(netdev, prog, act);
+#endif
+    fallthrough;
+  case XDP_ABORTED:
+    trace_xdp_exception(netdev, prog, act);
+    fallthrough;
+  case XDP_DROP:
+    goto drop;
+  }
+
+  u64_stats_update_begin(&rxs->syncp);
+  (*verdict)++;
+  u64_stats_update_end(&rxs->syncp);
+  return act;
+
+drop:
+  while (sgcnt) {
+    xsk_buff_free(sgl->priv);
+    sgl = sgl->next;
+    sgcnt--;
+  }
+count_drop:
+  u64_stats_update_begin(&rxs->syncp);
+  rxs->xdp_drop++;
+  u64_stats_update_end(&rxs->syncp);
+  return XDP_DROP;
+}
+
+/* This function posts an AF_XDP buffer to the free list of a C2H queue */
+static int onic_xsk_buf_alloc(unsigned long qhndl, unsigned long quld,
+                              struct qdma_sw_sg *sg)
+{
+  struct onic_priv *xpriv = (struct onic_priv *)quld;
+  struct onic_rx_ring *rx_ring;
+  struct xdp_buff *xdp;
+
+  rx_ring = &xpriv->rx_rings[qhndl - xpriv->base_rx_q_handle];
+  xdp = xsk_buff_alloc(rx_ring->xsk_pool);
+  if (!xdp) {
+    rx_ring->xsk_starved = true;
+    return -ENOMEM;
+  }
 
+  sg->priv = xdp;
+  sg->pg = NULL;
+  sg->offset = 0;
+  sg->dma_addr = xsk_buff_xdp_get_dma(xdp);
   return 0;
 }
 
+/* This function gives an unused free list buffer back to its AF_XDP pool */
+static void onic_xsk_buf_free(unsigned long qhndl, unsigned long quld,
+                              struct qdma_sw_sg *sg)
+{
+  xsk_buff_free(sg->priv);
+  sg->priv = NULL;
+}
+
+/* This function flushes the XDP work of a NAPI poll */
+static void onic_xdp_flush(struct onic_priv *xpriv, u32 q_no)
+{
+  struct onic_rx_ring *rx_ring = &xpriv->rx_rings[q_no];
+  struct netdev_queue *txq;
+  u16 tx_q_id;
+
+  if (likely(!rx_ring->xdp_flush))
+    return;
+
+  if (rx_ring->xdp_flush & ONIC_XDP_FLUSH_REDIRECT)
+    xdp_do_flush();
+
+  if (rx_ring->xdp_flush & ONIC_XDP_FLUSH_TX) {
+    tx_q_id = q_no % xpriv->netdev->real_num_tx_queues;
+    txq = netdev_get_tx_queue(xpriv->netdev, tx_q_id);
+    __netif_tx_lock(txq, smp_processor_id());
+    qdma_queue_update_pointers(xpriv->dev_handle,
+                               xpriv->base_tx_q_handle + tx_q_id);
+    __netif_tx_unlock(txq);
+  }
+
+  rx_ring->xdp_flush = 0;
+}
+#endif
+
 /* This function creates skb and moves data from dma request to network domain */
 static int onic_rx_deliver(struct onic_priv *xpriv, u32 q_no, unsigned int len,
          unsigned int sgcnt, struct qdma_sw_sg *sgl, void *udd)
 {
   struct net_device *netdev = xpriv->netdev;
+  struct onic_rx_qstats *rxs = &xpriv->rx_qstats[q_no];
   struct sk_buff *skb = NULL;
   struct qdma_sw_sg *c2h_sgl = sgl;
+  u64 *kind;
+#ifdef ONIC_XDP
+  struct bpf_prog *prog = READ_ONCE(xpriv->xdp_prog);
+  struct xdp_buff xdp;
+#endif
+  unsigned int stride = onic_rx_buf_stride(xpriv);
+  unsigned int headroom = xpriv->rx_headroom;
 
   if (!sgcnt) {
     netdev_err(netdev, "%s: SG Count is NULL\n", __func__);
@@ -85,6 +368,53 @@ static int onic_rx_deliver(struct onic_priv *xpriv, u32 q_no, unsigned int len,
     return -EINVAL;
   }
 
+#ifdef ONIC_XDP
+  /* AF_XDP zero-copy buffer, the stack only gets a copy of it */
+  if (c2h_sgl->priv) {
+    struct xdp_buff *xsk_xdp = c2h_sgl->priv;
+
+    if (onic_rx_xsk(xpriv, q_no, prog, len, sgcnt, c2h_sgl) != XDP_PASS)
+      return 0;
+
+    len = xsk_xdp->data_end - xsk_xdp->data;
+    skb = napi_alloc_skb(&xpriv->napi[q_no], len);
+    if (likely(skb)) {
+      skb_copy_to_linear_data(skb, xsk_xdp->data, len);
+      __skb_put(skb, len);
+    }
+    xsk_buff_free(xsk_xdp);
+    if (unlikely(!skb)) {
+      netdev_err(netdev, "%s: napi_alloc_skb() failed\n",
+           __func__);
+      u64_stats_update_begin(&rxs->syncp);
+      rxs->dropped++;
+      u64_stats_update_end(&rxs->syncp);
+      return 0;
+    }
+    kind = &rxs->copybreak;
+    goto deliver;
+  }
+
+  if (prog) {
+    if (onic_rx_xdp(xpriv, q_no, prog, len, sgcnt, c2h_sgl, &xdp) != XDP_PASS)
+      return 0;
+
+    skb = napi_build_skb(xdp.data_hard_start, xdp.frame_sz);
+    if (unlikely(!skb)) {
+      netdev_err(netdev, "%s: napi_build_skb() failed\n",
+           __func__);
+      return -ENOMEM;
+    }
+
+    skb_reserve(skb, xdp.data - xdp.data_hard_start);
+    __skb_put(skb, xdp.data_end - xdp.data);
+    if (xdp.data_meta < xdp.data)
+      skb_metadata_set(skb, xdp.data - xdp.data_meta);
+    kind = &rxs->build_skb;
+    goto deliver;
+  }
+#endif
+
   if (len <= ONIC_RX_COPY_THRES || !(netdev->features & NETIF_F_SG)) {
     skb = napi_alloc_skb(&xpriv->napi[q_no], len);
     if (unlikely(!skb)) {
@@ -97,6 +427,22 @@ static int onic_rx_deliver(struct onic_priv *xpriv, u32 q_no, unsigned int len,
           c2h_sgl->offset, len);
     __skb_put(skb, len);
     put_page(c2h_sgl->pg);
+    kind = &rxs->copybreak;
+  } else if (sgcnt == 1 && headroom + len + ONIC_RX_SHINFO_LEN <= stride) {
+    /* The packet fits in one buffer with room for skb_shared_info, so the
+     * buffer becomes the skb head and its page reference goes with it
+     */
+    skb = napi_build_skb(page_address(c2h_sgl->pg) + c2h_sgl->offset -
+             headroom, stride);
+    if (unlikely(!skb)) {
+      netdev_err(netdev, "%s: napi_build_skb() failed\n",
+           __func__);
+      return -ENOMEM;
+    }
+
+    skb_reserve(skb, headroom);
+    __skb_put(skb, len);
+    kind = &rxs->build_skb;
   } else {
     unsigned int nr_frags = 0;
     unsigned int frag_len;
@@ -134,14 +480,24 @@ static int onic_rx_deliver(struct onic_priv *xpriv, u32 q_no, unsigned int len,
     skb->len = len;
     skb->data_len = len - ONIC_RX_PULL_LEN;
     skb->truesize += skb->data_len;
+    kind = &rxs->frags;
   }
 
+#ifdef ONIC_XDP
+deliver:
+#endif
+  u64_stats_update_begin(&rxs->syncp);
+  rxs->packets++;
+  rxs->bytes += len;
+  (*kind)++;
+  u64_stats_update_end(&rxs->syncp);
+
   skb->protocol = eth_type_trans(skb, netdev);
   skb->ip_summed = CHECKSUM_NONE;
   skb_record_rx_queue(skb, q_no);
 
   skb_mark_napi_id(skb, &xpriv->napi[q_no]);
-  netif_receive_skb(skb);
+  napi_gro_receive(&xpriv->napi[q_no], skb);
 
   return 0;
 }
@@ -187,10 +543,11 @@ static int onic_rx_pkt_process(unsigned long qhndl, unsigned long quld,
       l_sgl = l_sgl->next;
       sgcnt--;
     }
-  }
 
-  xpriv->rx_qstats[q_no].rx_packets++;
-  xpriv->rx_qstats[q_no].rx_bytes += len;
+    u64_stats_update_begin(&xpriv->rx_qstats[q_no].syncp);
+    xpriv->rx_qstats[q_no].dropped++;
+    u64_stats_update_end(&xpriv->rx_qstats[q_no].syncp);
+  }
 
   netdev_dbg(xpriv->netdev,
        "%s: q_no = %u, qhndl = %lu, len = %d processed\n", __func__,
@@ -210,6 +567,7 @@ static int onic_rx_poll(struct napi_struct *napi, int quota)
   unsigned int udd_cnt = 0, pkt_cnt = 0, data_len = 0;
   struct onic_priv *xpriv;
   struct net_device *netdev;
+  bool xsk_more = false;
   int ret;
 
   if (unlikely(!napi)) {
@@ -232,8 +590,20 @@ static int onic_rx_poll(struct napi_struct *napi, int quota)
   queue_id = (int)(napi - xpriv->napi);
   q_handle = (xpriv->base_rx_q_handle + queue_id);
 
+#ifdef ONIC_XDP
+  if (queue_id < QDMA_NET_QUEUE)
+    xpriv->rx_rings[queue_id].xsk_starved = false;
+#endif
+
   /* Call queue service for QDMA Core to service queue */
   ret = qdma_queue_service(xpriv->dev_handle, q_handle, quota, true);
+#ifdef ONIC_XDP
+  if (queue_id < QDMA_NET_QUEUE) {
+    onic_xdp_flush(xpriv, queue_id);
+    if (xpriv->rx_rings[queue_id].xsk_pool)
+      xsk_more = onic_xsk_poll(xpriv, queue_id, quota);
+  }
+#endif
   /* Indicate napi_complete irrespective of ret */
   napi_complete(napi);
   if (!xpriv->pinfo->poll_mode && ret < 0) {
@@ -250,7 +620,13 @@ static int onic_rx_poll(struct napi_struct *napi, int quota)
   // memory-mapped queues do not use this
   if(queue_id < QDMA_NET_QUEUE) qdma_queue_update_pointers(xpriv->dev_handle, q_handle);
 
-  if (xpriv->pinfo->poll_mode || (pkt_cnt >= quota))
+  if (pkt_cnt >= quota && queue_id < QDMA_NET_QUEUE) {
+    u64_stats_update_begin(&xpriv->rx_qstats[queue_id].syncp);
+    xpriv->rx_qstats[queue_id].budget_exhausted++;
+    u64_stats_update_end(&xpriv->rx_qstats[queue_id].syncp);
+  }
+
+  if (xpriv->pinfo->poll_mode || (pkt_cnt >= quota) || xsk_more)
     napi_reschedule(napi);
 
   return 0;
@@ -296,6 +672,7 @@ static int onic_qdma_rx_queue_add(struct onic_priv *xpriv, u32 q_no,
   qconf.cmpl_rng_sz_idx = xpriv->cmpl_rng_sz_idx;
   qconf.desc_rng_sz_idx = xpriv->rx_desc_rng_sz_idx;
   qconf.c2h_buf_sz_idx = xpriv->rx_buf_sz_idx;
+  qconf.c2h_headroom = q_no < QDMA_NET_QUEUE ? xpriv->rx_headroom : 0;
   qconf.cmpl_timer_idx = timer_idx;
   qconf.cmpl_cnt_th_idx = cnt_th_idx;
   qconf.cmpl_trig_mode = TRIG_MODE_COMBO;
@@ -373,10 +750,16 @@ static void onic_qdma_rx_queue_release(struct onic_priv *xpriv, int num_queues)
       }
     }
     if (q_no < QDMA_NET_QUEUE) {
+#ifdef ONIC_XDP
+      if (xdp_rxq_info_is_reg(&xpriv->rx_rings[q_no].xdp_rxq))
+        xdp_rxq_info_unreg(&xpriv->rx_rings[q_no].xdp_rxq);
+#endif
       netif_napi_del(&xpriv->napi[q_no]);
     }
   }
 
+  kfree(xpriv->rx_rings);
+  xpriv->rx_rings = NULL;
   kfree(xpriv->napi);
 }
 
@@ -390,6 +773,13 @@ static int onic_qdma_rx_queue_setup(struct onic_priv *xpriv)
   if (!xpriv->napi)
     return -ENOMEM;
 
+  xpriv->rx_rings = kcalloc(xpriv->netdev->real_num_rx_queues,
+          sizeof(struct onic_rx_ring), GFP_KERNEL);
+  if (!xpriv->rx_rings) {
+    kfree(xpriv->napi);
+    return -ENOMEM;
+  }
+
   for (q_no = 0; q_no < xpriv->netdev->real_num_rx_queues; q_no++) {
     ret = onic_qdma_rx_queue_add(xpriv, q_no, xpriv->rx_timer_idx,
                xpriv->rx_cnt_th_idx, 1);
@@ -401,6 +791,20 @@ static int onic_qdma_rx_queue_setup(struct onic_priv *xpriv)
     }
     netif_napi_add(xpriv->netdev, &xpriv->napi[q_no], onic_rx_poll,
              ONIC_NAPI_WEIGHT);
+#ifdef ONIC_XDP
+    /* XDP_TX and redirected frames give their pages back with put_page() */
+    ret = xdp_rxq_info_reg(&xpriv->rx_rings[q_no].xdp_rxq, xpriv->netdev,
+             q_no, xpriv->napi[q_no].napi_id);
+    if (ret == 0)
+      ret = xdp_rxq_info_reg_mem_model(&xpriv->rx_rings[q_no].xdp_rxq,
+               MEM_TYPE_PAGE_SHARED, NULL);
+    if (ret != 0) {
+      netdev_err(xpriv->netdev,
+           "%s: xdp_rxq_info_reg() failed for queue %d with status %d\n",
+           __func__, q_no, ret);
+      goto release_rx_q;
+    }
+#endif
   }
 
   // Add rx queue for QDMA AXI-MM channels
@@ -469,6 +873,9 @@ static void onic_qdma_tx_queue_release(struct onic_priv *xpriv, int num_queues)
       }
     }
   }
+
+  kfree(xpriv->tx_rings);
+  xpriv->tx_rings = NULL;
 }
 
 /* This function sets up Tx queues */
@@ -479,6 +886,11 @@ static int onic_qdma_tx_queue_setup(struct onic_priv *xpriv)
   unsigned long q_handle = 0;
   struct qdma_queue_conf qconf;
 
+  xpriv->tx_rings = kcalloc(xpriv->netdev->real_num_tx_queues,
+          sizeof(struct onic_tx_ring), GFP_KERNEL);
+  if (!xpriv->tx_rings)
+    return -ENOMEM;
+
   for (q_no = 0; q_no < (xpriv->netdev->real_num_tx_queues + xpriv->pinfo->mm_queues); q_no++) {
     memset(&qconf, 0, sizeof(struct qdma_queue_conf));
     qconf.st = (q_no >= QDMA_NET_QUEUE) ? 0 : 1;
@@ -567,12 +979,13 @@ static int onic_qdma_stop(struct onic_priv *xpriv, unsigned short int txq,
 }
 
 /* This function starts Rx and Tx queues operations */
-static int onic_qdma_start(struct onic_priv *xpriv)
+static int onic_qdma_start(struct onic_priv *xpriv, unsigned short int txq,
+         unsigned short int rxq)
 {
   int ret, q_no;
   char error_str[ONIC_ERROR_STR_BUF_LEN] = { '0' };
 
-  for (q_no = 0; q_no < xpriv->pinfo->active_rx_queues; q_no++) {
+  for (q_no = 0; q_no < rxq; q_no++) {
     ret = qdma_queue_start(xpriv->dev_handle,
               xpriv->base_rx_q_handle + q_no,
               error_str, ONIC_ERROR_STR_BUF_LEN);
@@ -580,12 +993,12 @@ static int onic_qdma_start(struct onic_priv *xpriv)
       netdev_err(xpriv->netdev,
           "%s: qdma_queue_start() failed for Rx queue %d with status %d(%s)\n",
           __func__, q_no, ret, error_str);
-      onic_qdma_stop(xpriv, 0, xpriv->pinfo->active_rx_queues);
+      onic_qdma_stop(xpriv, 0, rxq);
       return ret;
     }
   }
 
-  for (q_no = 0; q_no < xpriv->pinfo->active_tx_queues; q_no++) {
+  for (q_no = 0; q_no < txq; q_no++) {
     ret = qdma_queue_start(xpriv->dev_handle,
               xpriv->base_tx_q_handle + q_no,
               error_str, ONIC_ERROR_STR_BUF_LEN);
@@ -593,7 +1006,7 @@ static int onic_qdma_start(struct onic_priv *xpriv)
       netdev_err(xpriv->netdev,
           "%s: qdma_queue_start() failed for Tx queue %d with status %d(%s)\n",
           __func__, q_no, ret, error_str);
-      onic_qdma_stop(xpriv, xpriv->pinfo->active_tx_queues, 0);
+      onic_qdma_stop(xpriv, txq, 0);
       return ret;
     }
   }
@@ -601,6 +1014,61 @@ static int onic_qdma_start(struct onic_priv *xpriv)
   return 0;
 }
 
+static int onic_tx_done(struct qdma_request *req, unsigned int bytes_done,
+      int err);
+
+/* This function releases the request slots of the TX rings */
+static void onic_tx_rings_free(struct onic_priv *xpriv)
+{
+  int q_no;
+
+  for (q_no = 0; q_no < xpriv->netdev->real_num_tx_queues; q_no++) {
+    kvfree(xpriv->tx_rings[q_no].slots);
+    xpriv->tx_rings[q_no].slots = NULL;
+  }
+}
+
+/* This function allocates the request slots of the TX rings and sets up the
+ * fields that stay the same for every packet. A packet takes at least one
+ * descriptor, so with as many slots as H2C ring entries the slots never limit
+ * the packets in flight before the descriptors do.
+ */
+static int onic_tx_rings_alloc(struct onic_priv *xpriv)
+{
+  struct net_device *netdev = xpriv->netdev;
+  int node = dev_to_node(&xpriv->pcidev->dev);
+  struct onic_tx_ring *ring;
+  struct onic_dma_request *slot;
+  int q_no, i;
+
+  for (q_no = 0; q_no < netdev->real_num_tx_queues; q_no++) {
+    ring = &xpriv->tx_rings[q_no];
+    ring->nr_slots = roundup_pow_of_two(xpriv->pinfo->ring_sz);
+    ring->slots = kvzalloc_node(array_size(ring->nr_slots,
+                                           sizeof(struct onic_dma_request)),
+                                GFP_KERNEL, node);
+    if (!ring->slots) {
+      onic_tx_rings_free(xpriv);
+      return -ENOMEM;
+    }
+    ring->prod = 0;
+    ring->cons = 0;
+    atomic_set(&ring->desc_used, 0);
+
+    for (i = 0, slot = ring->slots; i < ring->nr_slots; i++, slot++) {
+      slot->netdev = netdev;
+      slot->q_id = q_no;
+      slot->qdma.sgl = slot->sgl;
+      slot->qdma.dma_mapped = 1;
+      slot->qdma.check_qstate_disabled = 1;
+      slot->qdma.fp_done = onic_tx_done;
+      slot->qdma.uld_data = (unsigned long)slot;
+    }
+  }
+
+  return 0;
+}
+
 /* This function gets called when interface gets 'UP' request via 'ifconfig up'
  * In this function, Rx and Tx queues are setup and send/receive operations
  * are started
@@ -623,10 +1091,19 @@ int onic_open(struct net_device *netdev)
 
   onic_init_cdev(xpriv->onic_cdev_ptr, xpriv->onic_cdev_ptr->no_mm_queues);
 
-  ret = onic_qdma_start(xpriv);
+  ret = onic_tx_rings_alloc(xpriv);
+  if (ret != 0) {
+    netdev_err(netdev, "%s: onic_tx_rings_alloc() failed with status %d\n",
+         __func__, ret);
+    return ret;
+  }
+
+  ret = onic_qdma_start(xpriv, xpriv->pinfo->active_tx_queues,
+             xpriv->pinfo->active_rx_queues);
   if (ret != 0) {
     netdev_err(netdev, "%s: onic_qdma_start() failed with status %d\n",
          __func__, ret);
+    onic_tx_rings_free(xpriv);
     goto release_queues;
   }
 
@@ -637,6 +1114,9 @@ int onic_open(struct net_device *netdev)
     for (q_no = 0; q_no < xpriv->netdev->real_num_rx_queues; q_no++)
       napi_schedule(&xpriv->napi[q_no]);
 
+  for (q_no = 0; q_no < xpriv->netdev->real_num_tx_queues; q_no++)
+    netdev_tx_reset_queue(netdev_get_tx_queue(netdev, q_no));
+
   netif_tx_start_all_queues(netdev);
   netif_carrier_on(netdev);
 
@@ -681,10 +1161,228 @@ static int onic_stop(struct net_device *netdev)
     netdev_err(netdev, "%s: onic_qdma_stop() failed with status %d\n",
          __func__, ret);
 
+  /* stopped H2C queues have completed all of their requests */
+  onic_tx_rings_free(xpriv);
+
   netdev_info(netdev, "%s: device close done\n", __func__);
   return ret;
 }
 
+/* Apply ring sizes, interrupt moderation and buffer layout to a stopped
+ * network C2H queue
+ */
+static int onic_qdma_config_rxq(struct onic_priv *xpriv, int q_no,
+                                u8 desc_rng_sz_idx, u8 cmpl_rng_sz_idx,
+                                u8 timer_idx, u8 cnt_th_idx, u8 buf_sz_idx,
+                                u16 headroom, char *error_str)
+{
+  struct qdma_queue_conf qconf;
+  int ret;
+
+  ret = qdma_queue_get_config(xpriv->dev_handle,
+            xpriv->base_rx_q_handle + q_no, &qconf,
+            error_str, ONIC_ERROR_STR_BUF_LEN);
+  if (ret != 0)
+    return ret;
+
+  qconf.desc_rng_sz_idx = desc_rng_sz_idx;
+  qconf.cmpl_rng_sz_idx = cmpl_rng_sz_idx;
+  qconf.cmpl_timer_idx = timer_idx;
+  qconf.cmpl_cnt_th_idx = cnt_th_idx;
+  /* AF_XDP queues keep the buffer size of their pool */
+  if (!qconf.fp_c2h_buf_alloc) {
+    qconf.c2h_buf_sz_idx = buf_sz_idx;
+    qconf.c2h_headroom = headroom;
+  }
+  return qdma_queue_config(xpriv->dev_handle,
+         xpriv->base_rx_q_handle + q_no, &qconf,
+         error_str, ONIC_ERROR_STR_BUF_LEN);
+}
+
+/* Apply the ring size to a stopped network H2C queue */
+static int onic_qdma_config_txq(struct onic_priv *xpriv, int q_no,
+                                u8 desc_rng_sz_idx, char *error_str)
+{
+  struct qdma_queue_conf qconf;
+  int ret;
+
+  ret = qdma_queue_get_config(xpriv->dev_handle,
+            xpriv->base_tx_q_handle + q_no, &qconf,
+            error_str, ONIC_ERROR_STR_BUF_LEN);
+  if (ret != 0)
+    return ret;
+
+  qconf.desc_rng_sz_idx = desc_rng_sz_idx;
+  return qdma_queue_config(xpriv->dev_handle,
+         xpriv->base_tx_q_handle + q_no, &qconf,
+         error_str, ONIC_ERROR_STR_BUF_LEN);
+}
+
+/* This function reconfigures the ring sizes, the interrupt moderation and
+ * the C2H buffer layout of the network queues, indexes refer to the global
+ * CSR tables. Running queues are stopped and restarted around it, the
+ * memory-mapped queues of the character device are left alone.
+ */
+int onic_qdma_reconfig(struct onic_priv *xpriv, u8 rx_rng_sz_idx,
+                       u8 tx_rng_sz_idx, u8 timer_idx, u8 cnt_th_idx,
+                       u8 buf_sz_idx, u16 headroom)
+{
+  struct net_device *netdev = xpriv->netdev;
+  char error_str[ONIC_ERROR_STR_BUF_LEN] = { '0' };
+  bool running = netif_running(netdev);
+  struct global_csr_conf csr_conf;
+  int ret = 0, err, q_no;
+
+  ret = qdma_global_csr_get(xpriv->dev_handle, 0,
+          QDMA_GLOBAL_CSR_ARRAY_SZ, &csr_conf);
+  if (ret != 0) {
+    netdev_err(netdev, "%s: qdma_global_csr_get() failed with status %d\n",
+         __func__, ret);
+    return -EINVAL;
+  }
+
+  if (running) {
+    netif_tx_stop_all_queues(netdev);
+    netif_carrier_off(netdev);
+
+    for (q_no = 0; q_no < netdev->real_num_rx_queues; q_no++)
+      napi_disable(&xpriv->napi[q_no]);
+
+    ret = onic_qdma_stop(xpriv, netdev->real_num_tx_queues,
+             netdev->real_num_rx_queues);
+    if (ret != 0)
+      netdev_err(netdev, "%s: onic_qdma_stop() failed with status %d\n",
+           __func__, ret);
+    onic_tx_rings_free(xpriv);
+  }
+
+  /* stopped queues are back in the enabled state and take a new config */
+  for (q_no = 0; q_no < netdev->real_num_rx_queues; q_no++) {
+    ret = onic_qdma_config_rxq(xpriv, q_no, rx_rng_sz_idx, rx_rng_sz_idx,
+             timer_idx, cnt_th_idx, buf_sz_idx, headroom,
+             error_str);
+    if (ret != 0) {
+      netdev_err(netdev, "%s: failed to configure Rx queue %d with status %d(%s)\n",
+           __func__, q_no, ret, error_str);
+      goto rollback_rx;
+    }
+  }
+
+  for (q_no = 0; q_no < netdev->real_num_tx_queues; q_no++) {
+    ret = onic_qdma_config_txq(xpriv, q_no, tx_rng_sz_idx, error_str);
+    if (ret != 0) {
+      netdev_err(netdev, "%s: failed to configure Tx queue %d with status %d(%s)\n",
+           __func__, q_no, ret, error_str);
+      goto rollback_tx;
+    }
+  }
+
+  xpriv->rx_desc_rng_sz_idx = rx_rng_sz_idx;
+  xpriv->cmpl_rng_sz_idx = rx_rng_sz_idx;
+  xpriv->tx_desc_rng_sz_idx = tx_rng_sz_idx;
+  xpriv->rx_timer_idx = timer_idx;
+  xpriv->rx_cnt_th_idx = cnt_th_idx;
+  xpriv->rx_buf_sz_idx = buf_sz_idx;
+  xpriv->rx_buf_sz = csr_conf.c2h_buf_sz[buf_sz_idx];
+  xpriv->rx_headroom = headroom;
+  /* onic_tx_ring_room() works on the H2C ring size */
+  xpriv->pinfo->ring_sz = csr_conf.ring_sz[tx_rng_sz_idx];
+  goto restart;
+
+  /* put the queues configured so far back on the indexes in xpriv, which
+   * the Tx rings and onic_tx_ring_room() are still sized from
+   */
+rollback_tx:
+  for (; q_no >= 0; q_no--) {
+    if (onic_qdma_config_txq(xpriv, q_no, xpriv->tx_desc_rng_sz_idx,
+             error_str) != 0)
+      netdev_err(netdev, "%s: failed to restore Tx queue %d(%s)\n",
+           __func__, q_no, error_str);
+  }
+  q_no = netdev->real_num_rx_queues - 1;
+rollback_rx:
+  for (; q_no >= 0; q_no--) {
+    if (onic_qdma_config_rxq(xpriv, q_no, xpriv->rx_desc_rng_sz_idx,
+             xpriv->cmpl_rng_sz_idx, xpriv->rx_timer_idx,
+             xpriv->rx_cnt_th_idx, xpriv->rx_buf_sz_idx,
+             xpriv->rx_headroom, error_str) != 0)
+      netdev_err(netdev, "%s: failed to restore Rx queue %d(%s)\n",
+           __func__, q_no, error_str);
+  }
+
+restart:
+  if (!running)
+    return ret;
+
+  err = onic_tx_rings_alloc(xpriv);
+  if (err == 0) {
+    err = onic_qdma_start(xpriv, netdev->real_num_tx_queues,
+             netdev->real_num_rx_queues);
+    if (err != 0)
+      onic_tx_rings_free(xpriv);
+  }
+
+  /* NAPI is enabled even on failure, onic_stop() disables it again */
+  for (q_no = 0; q_no < netdev->real_num_rx_queues; q_no++)
+    napi_enable(&xpriv->napi[q_no]);
+
+  if (err != 0) {
+    netdev_err(netdev, "%s: failed to restart queues with status %d\n",
+         __func__, err);
+    return err;
+  }
+
+  if (xpriv->pinfo->poll_mode)
+    for (q_no = 0; q_no < netdev->real_num_rx_queues; q_no++)
+      napi_schedule(&xpriv->napi[q_no]);
+
+  for (q_no = 0; q_no < netdev->real_num_tx_queues; q_no++)
+    netdev_tx_reset_queue(netdev_get_tx_queue(netdev, q_no));
+
+  netif_tx_start_all_queues(netdev);
+  netif_carrier_on(netdev);
+
+  return ret;
+}
+
+/* This function changes the interrupt moderation of the network C2H queues,
+ * running queues are updated in place through their completion control
+ */
+int onic_qdma_set_coalesce(struct onic_priv *xpriv, u8 timer_idx,
+                           u8 cnt_th_idx)
+{
+  struct net_device *netdev = xpriv->netdev;
+  struct qdma_cmpl_ctrl cctrl;
+  int ret, q_no;
+
+  if (!netif_running(netdev))
+    return onic_qdma_reconfig(xpriv, xpriv->rx_desc_rng_sz_idx,
+             xpriv->tx_desc_rng_sz_idx, timer_idx,
+             cnt_th_idx, xpriv->rx_buf_sz_idx,
+             xpriv->rx_headroom);
+
+  for (q_no = 0; q_no < netdev->real_num_rx_queues; q_no++) {
+    ret = qdma_queue_cmpl_ctrl(xpriv->dev_handle,
+             xpriv->base_rx_q_handle + q_no, &cctrl, false);
+    if (ret == 0) {
+      cctrl.timer_idx = timer_idx;
+      cctrl.cnt_th_idx = cnt_th_idx;
+      ret = qdma_queue_cmpl_ctrl(xpriv->dev_handle,
+               xpriv->base_rx_q_handle + q_no, &cctrl, true);
+    }
+    if (ret != 0) {
+      netdev_err(netdev, "%s: qdma_queue_cmpl_ctrl() failed for Rx queue %d with status %d\n",
+           __func__, q_no, ret);
+      return ret;
+    }
+  }
+
+  xpriv->rx_timer_idx = timer_idx;
+  xpriv->rx_cnt_th_idx = cnt_th_idx;
+
+  return 0;
+}
+
 /* This function free skb allocated memory */
 static int onic_unmap_free_pkt_data(struct qdma_request *req)
 {
@@ -746,11 +1444,30 @@ static int onic_unmap_free_pkt_data(struct qdma_request *req)
   }
 
   dev_consume_skb_irq(skb);
-  kmem_cache_free(xpriv->dma_req, onic_req);
+  onic_req->skb = NULL;
 
   return 0;
 }
 
+/* Check that the ring of a TX queue has descs descriptors and slots request
+ * slots free
+ */
+static inline bool onic_tx_ring_room(struct onic_priv *xpriv, u16 q_id,
+                                     int descs, u32 slots)
+{
+  struct onic_tx_ring *ring = &xpriv->tx_rings[q_id];
+
+  /* libqdma keeps one entry of its ring_sz - 1 descriptors unused */
+  return xpriv->pinfo->ring_sz - 2 - atomic_read(&ring->desc_used) >= descs &&
+         ring->nr_slots - (ring->prod - READ_ONCE(ring->cons)) >= slots;
+}
+
+/* Number of H2C descriptors for a buffer, libqdma splits buffers at PAGE_SIZE */
+static inline u16 onic_tx_desc_cnt(unsigned int len)
+{
+  return len ? DIV_ROUND_UP(len, PAGE_SIZE) : 1;
+}
+
 /* This function is called by QDMA core when one or multiple packet
  * transmission is completed.
  * This function frees skb associated with the transmitted packets.
@@ -758,11 +1475,59 @@ static int onic_unmap_free_pkt_data(struct qdma_request *req)
 static int onic_tx_done(struct qdma_request *req, unsigned int bytes_done,
       int err)
 {
+  struct onic_dma_request *onic_req;
+  struct onic_priv *xpriv;
+  struct onic_tx_ring *ring;
+  struct netdev_queue *txq;
+  unsigned int len;
+  u16 q_id, desc_cnt;
   int ret = 0;
 
-  ret = onic_unmap_free_pkt_data(req);
-  if (ret != 0)
-    pr_err("%s: onic_unmap_free_pkt_data() failed\n", __func__);
+  onic_req = (struct onic_dma_request *)req->uld_data;
+  if (unlikely(!onic_req ||
+               (!onic_req->skb && !onic_req->xdpf && !onic_req->xsk_pool))) {
+    pr_err("%s: onic_req is NULL\n", __func__);
+    return -EINVAL;
+  }
+  xpriv = netdev_priv(onic_req->netdev);
+  q_id = onic_req->q_id;
+  desc_cnt = onic_req->desc_cnt;
+  txq = netdev_get_tx_queue(xpriv->netdev, q_id);
+
+#ifdef ONIC_XDP
+  if (onic_req->xsk_pool) {
+    /* UMEM frames stay mapped, completions go back in submission order; the
+     * pool is taken from the slot, the ring may have dropped it already
+     */
+    xsk_tx_completed(onic_req->xsk_pool, 1);
+    onic_req->xsk_pool = NULL;
+  } else if (onic_req->xdpf) {
+    /* XDP frames are not accounted to BQL */
+    dma_unmap_single(xpriv->netdev->dev.parent, onic_req->sgl[0].dma_addr,
+         onic_req->sgl[0].len, DMA_TO_DEVICE);
+    xdp_return_frame(onic_req->xdpf);
+    onic_req->xdpf = NULL;
+  } else
+#endif
+  {
+    len = onic_req->skb->len;
+    ret = onic_unmap_free_pkt_data(req);
+    if (ret != 0)
+      pr_err("%s: onic_unmap_free_pkt_data() failed\n", __func__);
+    netdev_tx_completed_queue(txq, 1, len);
+  }
+
+  /* completions of a queue are serialized, so the slot is the oldest one */
+  ring = &xpriv->tx_rings[q_id];
+  WRITE_ONCE(ring->cons, ring->cons + 1);
+  atomic_sub(desc_cnt, &ring->desc_used);
+
+  /* pairs with the barrier after stopping the queue in onic_start_xmit() */
+  smp_mb();
+  if (unlikely(netif_tx_queue_stopped(txq)) &&
+      onic_tx_ring_room(xpriv, q_id, ONIC_TX_WAKE_THRES,
+                        ONIC_TX_SLOTS_WAKE_THRES(ring)))
+    netif_tx_wake_queue(txq);
 
   pr_debug("%s: bytes_done = %d, error = %d\n",
      __func__, bytes_done, err);
@@ -770,6 +1535,267 @@ static int onic_tx_done(struct qdma_request *req, unsigned int bytes_done,
   return 0;
 }
 
+#ifdef ONIC_XDP
+/* This function queues an XDP frame on a TX ring, the caller holds the lock
+ * of the TX queue and flushes the PIDX when xmit_more is set
+ */
+static int onic_xdp_xmit_frame(struct onic_priv *xpriv, u16 q_id,
+                               struct xdp_frame *xdpf, bool xmit_more)
+{
+  struct net_device *netdev = xpriv->netdev;
+  struct onic_tx_ring *ring = &xpriv->tx_rings[q_id];
+  struct onic_tx_qstats *txs = &xpriv->tx_qstats[q_id];
+  struct onic_dma_request *onic_req;
+  struct qdma_request *qdma_req;
+  struct qdma_sw_sg *qdma_sgl;
+  unsigned int len = xdpf->len;
+  u16 desc_cnt;
+  int count;
+
+  if (unlikely(!ring->slots))
+    return -ENETDOWN;
+
+  /* the stack stopped the queue on a nearly full ring, leave the rest to it */
+  desc_cnt = onic_tx_desc_cnt(max_t(unsigned int, len, ETH_ZLEN));
+  if (unlikely(netif_xmit_stopped(netdev_get_tx_queue(netdev, q_id)) ||
+               !onic_tx_ring_room(xpriv, q_id,
+                                  desc_cnt + ONIC_TX_STOP_THRES, 1))) {
+    u64_stats_update_begin(&txs->syncp);
+    txs->ring_full++;
+    u64_stats_update_end(&txs->syncp);
+    return -ENOSPC;
+  }
+
+  /* minimum Ethernet packet length is 60 */
+  if (len < ETH_ZLEN) {
+    if (unlikely(xdpf->frame_sz - xdpf->headroom - sizeof(*xdpf) -
+                 ONIC_RX_SHINFO_LEN < ETH_ZLEN))
+      return -EINVAL;
+    memset(xdpf->data + len, 0, ETH_ZLEN - len);
+    len = ETH_ZLEN;
+  }
+
+  onic_req = &ring->slots[ring->prod & (ring->nr_slots - 1)];
+  qdma_req = &onic_req->qdma;
+  qdma_sgl = &onic_req->sgl[0];
+
+  qdma_sgl->dma_addr = dma_map_single(netdev->dev.parent, xdpf->data, len,
+              DMA_TO_DEVICE);
+  if (unlikely(dma_mapping_error(netdev->dev.parent, qdma_sgl->dma_addr)))
+    return -EFAULT;
+
+  onic_req->skb = NULL;
+  onic_req->xdpf = xdpf;
+  onic_req->xsk_pool = NULL;
+  onic_req->desc_cnt = desc_cnt;
+
+  /* libqdma expects its per-request state to start zeroed */
+  memset(qdma_req->opaque, 0, sizeof(qdma_req->opaque));
+  qdma_sgl->len = len;
+  qdma_sgl->next = NULL;
+  qdma_req->sgcnt = 1;
+  qdma_req->count = len;
+  qdma_req->xmit_more = xmit_more;
+
+  ring->prod++;
+  atomic_add(desc_cnt, &ring->desc_used);
+  count = qdma_queue_packet_write(xpriv->dev_handle,
+          xpriv->base_tx_q_handle + q_id, qdma_req);
+  if (unlikely(count < 0)) {
+    /* the request never reached the queue, its slot is the newest one */
+    ring->prod--;
+    atomic_sub(desc_cnt, &ring->desc_used);
+    dma_unmap_single(netdev->dev.parent, qdma_sgl->dma_addr, len,
+         DMA_TO_DEVICE);
+    onic_req->xdpf = NULL;
+    return count;
+  }
+
+  u64_stats_update_begin(&txs->syncp);
+  txs->packets++;
+  txs->bytes += len;
+  u64_stats_update_end(&txs->syncp);
+
+  return 0;
+}
+
+/* This function transmits frames redirected to the device by XDP */
+static int onic_xdp_xmit(struct net_device *netdev, int n,
+                         struct xdp_frame **frames, u32 flags)
+{
+  struct onic_priv *xpriv = netdev_priv(netdev);
+  struct netdev_queue *txq;
+  int nxmit = 0;
+  u16 q_id;
+
+  if (unlikely(flags & ~XDP_XMIT_FLAGS_MASK))
+    return -EINVAL;
+
+  if (unlikely(!netif_carrier_ok(netdev)))
+    return -ENETDOWN;
+
+  q_id = smp_processor_id() % netdev->real_num_tx_queues;
+  txq = netdev_get_tx_queue(netdev, q_id);
+
+  __netif_tx_lock(txq, smp_processor_id());
+  while (nxmit < n) {
+    if (onic_xdp_xmit_frame(xpriv, q_id, frames[nxmit], true) != 0)
+      break;
+    nxmit++;
+  }
+  if (flags & XDP_XMIT_FLUSH)
+    qdma_queue_update_pointers(xpriv->dev_handle,
+                               xpriv->base_tx_q_handle + q_id);
+  __netif_tx_unlock(txq);
+
+  return nxmit;
+}
+
+/* This function moves AF_XDP TX descriptors of a queue pair to its H2C
+ * ring, it returns true if descriptors were left for the next poll
+ */
+static bool onic_xsk_xmit(struct onic_priv *xpriv, u16 q_id, int budget)
+{
+  struct xsk_buff_pool *pool = xpriv->rx_rings[q_id].xsk_pool;
+  struct net_device *netdev = xpriv->netdev;
+  struct netdev_queue *txq = netdev_get_tx_queue(netdev, q_id);
+  struct onic_tx_ring *ring = &xpriv->tx_rings[q_id];
+  struct onic_tx_qstats *txs = &xpriv->tx_qstats[q_id];
+  struct onic_dma_request *onic_req;
+  struct qdma_request *qdma_req;
+  struct qdma_sw_sg *qdma_sgl;
+  unsigned int packets = 0, bytes = 0;
+  struct xdp_desc desc;
+  bool more = true;
+  int count;
+
+  __netif_tx_lock(txq, smp_processor_id());
+  while (packets < budget) {
+    /* the stack stopped the queue on a nearly full ring, leave the rest
+     * to it; a UMEM frame never spans more than one descriptor
+     */
+    if (!ring->slots || netif_xmit_stopped(txq) ||
+        !onic_tx_ring_room(xpriv, q_id, 1 + ONIC_TX_STOP_THRES, 1))
+      break;
+
+    if (!xsk_tx_peek_desc(pool, &desc)) {
+      more = false;
+      break;
+    }
+
+    /* minimum Ethernet packet length is 60, the padding comes from the
+     * UMEM of the socket
+     */
+    desc.len = max_t(u32, desc.len, ETH_ZLEN);
+
+    onic_req = &ring->slots[ring->prod & (ring->nr_slots - 1)];
+    qdma_req = &onic_req->qdma;
+    qdma_sgl = &onic_req->sgl[0];
+
+    onic_req->skb = NULL;
+    onic_req->xdpf = NULL;
+    onic_req->xsk_pool = pool;
+    onic_req->desc_cnt = 1;
+
+    /* libqdma expects its per-request state to start zeroed */
+    memset(qdma_req->opaque, 0, sizeof(qdma_req->opaque));
+    qdma_sgl->dma_addr = xsk_buff_raw_get_dma(pool, desc.addr);
+    xsk_buff_raw_dma_sync_for_device(pool, qdma_sgl->dma_addr, desc.len);
+    qdma_sgl->len = desc.len;
+    qdma_sgl->next = NULL;
+    qdma_req->sgcnt = 1;
+    qdma_req->count = desc.len;
+    qdma_req->xmit_more = true;
+
+    ring->prod++;
+    atomic_inc(&ring->desc_used);
+    count = qdma_queue_packet_write(xpriv->dev_handle,
+            xpriv->base_tx_q_handle + q_id, qdma_req);
+    if (unlikely(count < 0)) {
+      netdev_err(netdev,
+           "%s: qdma_queue_packet_write() failed, err = %d\n",
+           __func__, count);
+      /* only fails on invalid requests, nothing else is left to
+       * complete the descriptor
+       */
+      ring->prod--;
+      atomic_dec(&ring->desc_used);
+      onic_req->xsk_pool = NULL;
+      xsk_tx_completed(pool, 1);
+      u64_stats_update_begin(&txs->syncp);
+      txs->dropped++;
+      u64_stats_update_end(&txs->syncp);
+      continue;
+    }
+
+    packets++;
+    bytes += desc.len;
+  }
+
+  if (packets) {
+    qdma_queue_update_pointers(xpriv->dev_handle,
+                               xpriv->base_tx_q_handle + q_id);
+    xsk_tx_release(pool);
+
+    u64_stats_update_begin(&txs->syncp);
+    txs->packets += packets;
+    txs->bytes += bytes;
+    u64_stats_update_end(&txs->syncp);
+  }
+  __netif_tx_unlock(txq);
+
+  /* a full ring is left for the socket to kick again */
+  return more && packets >= budget;
+}
+
+/* This function does the AF_XDP work of a NAPI poll: TX of the queue pair
+ * and the wakeup flags of the socket
+ */
+static bool onic_xsk_poll(struct onic_priv *xpriv, u16 q_id, int budget)
+{
+  struct onic_rx_ring *rx_ring = &xpriv->rx_rings[q_id];
+  struct xsk_buff_pool *pool = rx_ring->xsk_pool;
+  bool more;
+
+  more = onic_xsk_xmit(xpriv, q_id, budget);
+
+  if (xsk_uses_need_wakeup(pool)) {
+    if (rx_ring->xsk_starved)
+      xsk_set_rx_need_wakeup(pool);
+    else
+      xsk_clear_rx_need_wakeup(pool);
+
+    if (more)
+      xsk_clear_tx_need_wakeup(pool);
+    else
+      xsk_set_tx_need_wakeup(pool);
+  }
+
+  return more;
+}
+
+/* This function kicks the NAPI context of an AF_XDP queue pair */
+static int onic_xsk_wakeup(struct net_device *netdev, u32 q_id, u32 flags)
+{
+  struct onic_priv *xpriv = netdev_priv(netdev);
+
+  if (unlikely(!netif_running(netdev) || !netif_carrier_ok(netdev)))
+    return -ENETDOWN;
+
+  if (q_id >= netdev->real_num_rx_queues ||
+      !READ_ONCE(xpriv->rx_rings[q_id].xsk_pool))
+    return -EINVAL;
+
+  if (!napi_if_scheduled_mark_missed(&xpriv->napi[q_id])) {
+    local_bh_disable();
+    napi_schedule(&xpriv->napi[q_id]);
+    local_bh_enable();
+  }
+
+  return 0;
+}
+#endif
+
 /* This function is called from networking stack in order to send packet */
 static int onic_start_xmit(struct sk_buff *skb, struct net_device *netdev)
 {
@@ -781,6 +1807,12 @@ static int onic_start_xmit(struct sk_buff *skb, struct net_device *netdev)
   struct qdma_request *qdma_req;
   struct qdma_sw_sg *qdma_sgl;
   skb_frag_t *frag;
+  struct onic_tx_ring *ring;
+  struct onic_tx_qstats *txs;
+  struct netdev_queue *txq;
+  unsigned int len;
+  u16 desc_cnt;
+  bool xmit_more;
 
   xpriv = netdev_priv(netdev);
   if (unlikely(!xpriv)) {
@@ -801,14 +1833,6 @@ static int onic_start_xmit(struct sk_buff *skb, struct net_device *netdev)
     return -EINVAL;
   }
 
-  /* minimum Ethernet packet length is 60 */
-  ret = skb_put_padto(skb, ETH_ZLEN);
-  if (unlikely(ret != 0)) {
-    netdev_err(netdev, "%s: skb_put_padto failed with status %d\n", __func__, ret);
-    dev_kfree_skb_any(skb);
-    return -EINVAL;
-  }
-
   q_id = skb_get_queue_mapping(skb);
 
   if (unlikely(q_id >= netdev->real_num_tx_queues)) {
@@ -821,20 +1845,63 @@ static int onic_start_xmit(struct sk_buff *skb, struct net_device *netdev)
   if(q_id >= QDMA_NET_QUEUE) return 0; // mm queue does not need to do this
 
   q_handle = xpriv->base_tx_q_handle + q_id;
+  ring = &xpriv->tx_rings[q_id];
+  txs = &xpriv->tx_qstats[q_id];
+  txq = netdev_get_tx_queue(netdev, q_id);
 
-  onic_req = kmem_cache_zalloc(xpriv->dma_req, GFP_ATOMIC);
-  if (unlikely(!onic_req)) {
-    netdev_err(netdev, "%s: onic_req allocation failed\n",
-         __func__);
-    return -ENOMEM;
+  desc_cnt = onic_tx_desc_cnt(skb_headlen(skb));
+  nb_frags = skb_shinfo(skb)->nr_frags;
+  for (frag_index = 0; frag_index < nb_frags; frag_index++)
+    desc_cnt += onic_tx_desc_cnt(skb_frag_size(&skb_shinfo(skb)->frags[frag_index]));
+
+  /* The queue is stopped before the ring fills up, so this is only hit
+   * when a packet needs more descriptors than ONIC_TX_STOP_THRES
+   */
+  if (unlikely(!onic_tx_ring_room(xpriv, q_id, desc_cnt, 1))) {
+    netif_tx_stop_queue(txq);
+    /* pairs with the barrier in onic_tx_done() */
+    smp_mb();
+    if (!onic_tx_ring_room(xpriv, q_id, desc_cnt, 1)) {
+      qdma_queue_update_pointers(xpriv->dev_handle, q_handle);
+      u64_stats_update_begin(&txs->syncp);
+      txs->ring_full++;
+      u64_stats_update_end(&txs->syncp);
+      return NETDEV_TX_BUSY;
+    }
+    netif_tx_start_queue(txq);
   }
+
+  /* The PIDX doorbell is written once at the end of a burst, the last
+   * packet flushes it even if the packet itself is dropped
+   */
+  xmit_more = onic_xmit_more(skb) && !netif_xmit_stopped(txq);
+
+  /* minimum Ethernet packet length is 60 */
+  ret = skb_put_padto(skb, ETH_ZLEN);
+  if (unlikely(ret != 0)) {
+    netdev_err(netdev, "%s: skb_put_padto failed with status %d\n", __func__, ret);
+    u64_stats_update_begin(&txs->syncp);
+    txs->dropped++;
+    u64_stats_update_end(&txs->syncp);
+    if (!xmit_more)
+      qdma_queue_update_pointers(xpriv->dev_handle, q_handle);
+    return -EINVAL;
+  }
+  len = skb->len;
+
+  /* The constant fields of the slot are set up in onic_tx_rings_alloc() */
+  onic_req = &ring->slots[ring->prod & (ring->nr_slots - 1)];
   qdma_req = &onic_req->qdma;
   qdma_sgl = &onic_req->sgl[0];
 
   onic_req->skb = skb;
-  onic_req->netdev = netdev;
+  onic_req->xdpf = NULL;
+  onic_req->xsk_pool = NULL;
+  onic_req->desc_cnt = desc_cnt;
 
-  qdma_req->sgl = qdma_sgl;
+  /* libqdma expects its per-request state to start zeroed */
+  memset(qdma_req->opaque, 0, sizeof(qdma_req->opaque));
+  qdma_req->sgcnt = 0;
 
   qdma_sgl->len = skb_headlen(skb);
   qdma_req->count = qdma_sgl->len;
@@ -850,7 +1917,6 @@ static int onic_start_xmit(struct sk_buff *skb, struct net_device *netdev)
 
   qdma_sgl->next = NULL;
   qdma_req->sgcnt++;
-  nb_frags = skb_shinfo(skb)->nr_frags;
   /* DMA mapping for fragments data */
   for (frag_index = 0; frag_index < nb_frags; frag_index++) {
     qdma_sgl->next = (qdma_sgl + 1);
@@ -877,32 +1943,55 @@ static int onic_start_xmit(struct sk_buff *skb, struct net_device *netdev)
     qdma_req->sgcnt++;
   }
 
-  qdma_req->dma_mapped = 1;
-  qdma_req->check_qstate_disabled = 1;
-  qdma_req->fp_done = onic_tx_done;
-  qdma_req->uld_data = (unsigned long)onic_req;
+  /* Stop the queue ahead of a full ring, before the doorbell decision */
+  ring->prod++;
+  atomic_add(desc_cnt, &ring->desc_used);
+  if (unlikely(!onic_tx_ring_room(xpriv, q_id, ONIC_TX_STOP_THRES, 1))) {
+    netif_tx_stop_queue(txq);
+    /* pairs with the barrier in onic_tx_done() */
+    smp_mb();
+    if (onic_tx_ring_room(xpriv, q_id, ONIC_TX_WAKE_THRES,
+                          ONIC_TX_SLOTS_WAKE_THRES(ring))) {
+      netif_tx_start_queue(txq);
+    } else {
+      u64_stats_update_begin(&txs->syncp);
+      txs->stopped++;
+      u64_stats_update_end(&txs->syncp);
+    }
+  }
+  /* BQL, the doorbell is also rung when the queue got stopped */
+  xmit_more = !__netdev_tx_sent_queue(txq, len, xmit_more);
+  qdma_req->xmit_more = xmit_more;
 
   count = qdma_queue_packet_write(xpriv->dev_handle, q_handle, qdma_req);
   if (unlikely(count < 0)) {
     netdev_err(netdev,
          "%s: qdma_queue_packet_write() failed, err = %d\n",
          __func__, count);
+    /* the request never reached the queue, its slot is the newest one */
+    ring->prod--;
+    atomic_sub(desc_cnt, &ring->desc_used);
+    netdev_tx_completed_queue(txq, 1, len);
     ret = count;
     goto free_packet_data;
   }
 
-  xpriv->tx_qstats[q_id].tx_packets++;
-  xpriv->tx_qstats[q_id].tx_bytes += skb->len;
+  u64_stats_update_begin(&txs->syncp);
+  txs->packets++;
+  txs->bytes += len;
+  u64_stats_update_end(&txs->syncp);
 
   return NETDEV_TX_OK;
 
 free_packet_data:
-  if (onic_unmap_free_pkt_data(qdma_req) != 0) {
+  if (onic_unmap_free_pkt_data(qdma_req) != 0)
     netdev_err(netdev, "%s: onic_unmap_free_pkt_data() failed\n",
          __func__);
-    kmem_cache_free(xpriv->dma_req, onic_req);
-  }
-  xpriv->tx_qstats[q_id].tx_dropped++;
+  u64_stats_update_begin(&txs->syncp);
+  txs->dropped++;
+  u64_stats_update_end(&txs->syncp);
+  if (!xmit_more)
+    qdma_queue_update_pointers(xpriv->dev_handle, q_handle);
   return ret;
 }
 
@@ -931,6 +2020,18 @@ static int onic_do_ioctl(struct net_device *netdev, struct ifreq *ifr, int cmd)
 
 static int onic_change_mtu(struct net_device *netdev, int mtu)
 {
+#ifdef ONIC_XDP
+  struct onic_priv *xpriv = netdev_priv(netdev);
+
+  /* XDP programs see single-buffer frames only, onic_xdp_setup() sized the
+   * C2H buffers for the MTU at attach time
+   */
+  if (xpriv->xdp_prog && mtu + ETH_HLEN + VLAN_HLEN > xpriv->rx_buf_sz) {
+    netdev_err(netdev, "MTU %d does not fit the XDP receive buffers\n", mtu);
+    return -EINVAL;
+  }
+#endif
+
   netdev_info(netdev, "Requestd MTU = %d", mtu);
   return 0;
 }
@@ -940,6 +2041,10 @@ static void onic_get_stats64(struct net_device *netdev,
 {
   u32 q_num = 0;
   struct onic_priv *xpriv;
+  struct onic_tx_qstats *txs;
+  struct onic_rx_qstats *rxs;
+  u64 packets, bytes, dropped;
+  unsigned int start;
 
   if (!netdev) {
     pr_err("%s: netdev is NULL\n", __func__);
@@ -954,13 +2059,31 @@ static void onic_get_stats64(struct net_device *netdev,
 
   if ((xpriv->tx_qstats != NULL) && (xpriv->rx_qstats != NULL)) {
     for (q_num = 0; q_num < netdev->real_num_tx_queues; q_num++) {
-      stats->tx_bytes += xpriv->tx_qstats[q_num].tx_bytes;
-      stats->tx_packets += xpriv->tx_qstats[q_num].tx_packets;
+      txs = &xpriv->tx_qstats[q_num];
+      do {
+        start = u64_stats_fetch_begin(&txs->syncp);
+        packets = txs->packets;
+        bytes = txs->bytes;
+        dropped = txs->dropped;
+      } while (u64_stats_fetch_retry(&txs->syncp, start));
+
+      stats->tx_bytes += bytes;
+      stats->tx_packets += packets;
+      stats->tx_dropped += dropped;
     }
 
     for (q_num = 0; q_num < netdev->real_num_rx_queues; q_num++) {
-      stats->rx_bytes += xpriv->rx_qstats[q_num].rx_bytes;
-      stats->rx_packets += xpriv->rx_qstats[q_num].rx_packets;
+      rxs = &xpriv->rx_qstats[q_num];
+      do {
+        start = u64_stats_fetch_begin(&rxs->syncp);
+        packets = rxs->packets;
+        bytes = rxs->bytes;
+        dropped = rxs->dropped;
+      } while (u64_stats_fetch_retry(&rxs->syncp, start));
+
+      stats->rx_bytes += bytes;
+      stats->rx_packets += packets;
+      stats->rx_dropped += dropped;
     }
   }
 }
@@ -1060,9 +2183,20 @@ static int onic_qdma_csr_index_setup(struct onic_priv *xpriv)
     return index;
   }
   xpriv->rx_buf_sz_idx = index;
+  xpriv->rx_buf_sz = xpriv->pinfo->c2h_buf_sz;
   return 0;
 }
 
+/* Forward user interrupts (ERNIC and compute logic) to the character device */
+static void onic_user_isr(unsigned long dev_hndl, unsigned long uld)
+{
+  struct onic_priv *xpriv = (struct onic_priv *)uld;
+  struct onic_cdev *onic_cdev_ptr = READ_ONCE(xpriv->onic_cdev_ptr);
+
+  if (onic_cdev_ptr)
+    onic_cdev_user_isr(onic_cdev_ptr);
+}
+
 /* Configure QDMA Device, Global CSR Registers */
 static int onic_qdma_setup(struct onic_priv *xpriv)
 {
@@ -1081,6 +2215,8 @@ static int onic_qdma_setup(struct onic_priv *xpriv)
   xpriv->qdma_dev_conf.qsets_max = xpriv->pinfo->queue_max;
   xpriv->qdma_dev_conf.qsets_base = xpriv->pinfo->queue_base;
   xpriv->qdma_dev_conf.pdev = xpriv->pcidev;
+  xpriv->qdma_dev_conf.uld = (unsigned long)xpriv;
+  xpriv->qdma_dev_conf.fp_user_isr_handler = onic_user_isr;
   if (xpriv->pinfo->poll_mode)
     xpriv->qdma_dev_conf.qdma_drv_mode = POLL_MODE;
   else
@@ -1202,6 +2338,33 @@ rx_not_aligned:
   return -EBUSY;
 }
 
+/* This function writes xpriv->rss_indir to the indirection table of the shell */
+void onic_write_rss_indir(struct onic_priv *xpriv)
+{
+  int i;
+
+  for (i = 0; i < ONIC_RSS_INDIR_SIZE; i++) {
+    u32 val = xpriv->rss_indir[i] & 0x0000FFFF;
+    u32 offset = QDMA_FUNC_OFFSET_INDIR_TABLE(xpriv->pinfo->port_id, i);
+    writel(val, xpriv->bar_base + offset);
+  }
+}
+
+/* This function writes xpriv->rss_key to the shell, the first key byte is
+ * the most significant byte of the first register
+ */
+void onic_write_rss_key(struct onic_priv *xpriv)
+{
+  int i;
+
+  for (i = 0; i < ONIC_RSS_KEY_SIZE / 4; i++) {
+    u8 *key = &xpriv->rss_key[i * 4];
+    u32 val = ((u32)key[0] << 24) | (key[1] << 16) | (key[2] << 8) | key[3];
+    u32 offset = QDMA_FUNC_OFFSET_HASH_KEY(xpriv->pinfo->port_id, i);
+    writel(val, xpriv->bar_base + offset);
+  }
+}
+
 static void onic_init_reta(struct onic_priv *xpriv)
 {
   u32 val;
@@ -1214,13 +2377,14 @@ static void onic_init_reta(struct onic_priv *xpriv)
   writel(val, xpriv->bar_base +
          QDMA_FUNC_OFFSET_QCONF(xpriv->pinfo->port_id));
 
-  /* initialize indirection table */
-  for (i = 0; i < 128; i++) {
-    u32 val = (i % xpriv->netdev->real_num_rx_queues) & 0x0000FFFF;
-    u32 offset = QDMA_FUNC_OFFSET_INDIR_TABLE(xpriv->pinfo->port_id, i);
-    writel(val, xpriv->bar_base + offset);
-  }
+  /* initialize indirection table and hash key, ethtool -X changes them */
+  for (i = 0; i < ONIC_RSS_INDIR_SIZE; i++)
+    xpriv->rss_indir[i] = ethtool_rxfh_indir_default(i,
+                            xpriv->netdev->real_num_rx_queues);
+  onic_write_rss_indir(xpriv);
 
+  netdev_rss_key_fill(xpriv->rss_key, ONIC_RSS_KEY_SIZE);
+  onic_write_rss_key(xpriv);
 }
 
 static int onic_config_platform(struct onic_platform_info **pinfo_ref, u8 qdma_bar,
@@ -1258,6 +2422,298 @@ static int onic_config_platform(struct onic_platform_info **pinfo_ref, u8 qdma_b
   return 0;
 }
 
+#ifdef ONIC_XDP
+/* This function finds the smallest C2H buffer size of the global CSR table
+ * that holds an MTU sized frame with XDP headroom and tailroom in a page
+ */
+static int onic_xdp_buf_sz_idx(struct onic_priv *xpriv,
+                               struct global_csr_conf *csr_conf)
+{
+  unsigned int frame_len = xpriv->netdev->mtu + ETH_HLEN + VLAN_HLEN;
+  unsigned int buf_sz, stride;
+  int i, index = -1;
+
+  for (i = 0; i < QDMA_GLOBAL_CSR_ARRAY_SZ; i++) {
+    buf_sz = csr_conf->c2h_buf_sz[i];
+    if (buf_sz < frame_len)
+      continue;
+
+    stride = roundup_pow_of_two(buf_sz + XDP_PACKET_HEADROOM);
+    if (stride > PAGE_SIZE ||
+        XDP_PACKET_HEADROOM + buf_sz + ONIC_RX_SHINFO_LEN > stride)
+      continue;
+
+    if (index < 0 || buf_sz < csr_conf->c2h_buf_sz[index])
+      index = i;
+  }
+
+  return index;
+}
+
+/* This function attaches or detaches an XDP program. The C2H buffers of the
+ * network queues get XDP_PACKET_HEADROOM while a program is attached, which
+ * restarts the queues of a running interface.
+ */
+static int onic_xdp_setup(struct onic_priv *xpriv, struct bpf_prog *prog,
+                          struct netlink_ext_ack *extack)
+{
+  struct global_csr_conf csr_conf;
+  struct bpf_prog *old_prog;
+  int index, ret;
+
+  ret = qdma_global_csr_get(xpriv->dev_handle, 0,
+          QDMA_GLOBAL_CSR_ARRAY_SZ, &csr_conf);
+  if (ret < 0) {
+    netdev_err(xpriv->netdev,
+         "%s: qdma_global_csr_get() failed with status %d\n",
+         __func__, ret);
+    return ret;
+  }
+
+  if (prog && !xpriv->xdp_prog) {
+    index = onic_xdp_buf_sz_idx(xpriv, &csr_conf);
+    if (index < 0) {
+      NL_SET_ERR_MSG_MOD(extack, "MTU too large for an XDP receive buffer");
+      return -EINVAL;
+    }
+
+    ret = onic_qdma_reconfig(xpriv, xpriv->rx_desc_rng_sz_idx,
+             xpriv->tx_desc_rng_sz_idx, xpriv->rx_timer_idx,
+             xpriv->rx_cnt_th_idx, index, XDP_PACKET_HEADROOM);
+    if (ret != 0)
+      return ret;
+  }
+
+  old_prog = xchg(&xpriv->xdp_prog, prog);
+  if (old_prog)
+    bpf_prog_put(old_prog);
+
+  if (!prog && old_prog) {
+    index = onic_arr_find(csr_conf.c2h_buf_sz, QDMA_GLOBAL_CSR_ARRAY_SZ,
+                          xpriv->pinfo->c2h_buf_sz);
+    ret = onic_qdma_reconfig(xpriv, xpriv->rx_desc_rng_sz_idx,
+             xpriv->tx_desc_rng_sz_idx, xpriv->rx_timer_idx,
+             xpriv->rx_cnt_th_idx, index, 0);
+    if (ret != 0)
+      return ret;
+  }
+
+  return 0;
+}
+
+/* This function waits for the AF_XDP frames in flight on a TX queue, the
+ * caller has stopped onic_xsk_xmit() for it. Frames the card does not
+ * complete in time are reclaimed by restarting the H2C queue, so none of
+ * them is still read from the UMEM once its pool is unmapped.
+ */
+static void onic_xsk_tx_drain(struct onic_priv *xpriv, u16 q_id)
+{
+  struct netdev_queue *txq = netdev_get_tx_queue(xpriv->netdev, q_id);
+  struct onic_tx_ring *ring = &xpriv->tx_rings[q_id];
+  unsigned long q_handle = xpriv->base_tx_q_handle + q_id;
+  char error_str[ONIC_ERROR_STR_BUF_LEN] = { '0' };
+  int i, ret;
+  u32 prod;
+
+  if (!ring->slots)
+    return;
+
+  __netif_tx_lock_bh(txq);
+  prod = ring->prod;
+  __netif_tx_unlock_bh(txq);
+
+  /* slots complete in submission order */
+  for (i = 0; i < 1000 && (s32)(prod - READ_ONCE(ring->cons)) > 0; i++)
+    usleep_range(100, 200);
+
+  if ((s32)(prod - READ_ONCE(ring->cons)) <= 0)
+    return;
+
+  netdev_warn(xpriv->netdev, "%s: Tx queue %d did not complete, restarting it\n",
+        __func__, q_id);
+
+  /* qdma_queue_stop() completes every outstanding request with an error
+   * through onic_tx_done(), before it clears the queue context
+   */
+  __netif_tx_lock_bh(txq);
+  netif_tx_stop_queue(txq);
+  __netif_tx_unlock_bh(txq);
+
+  ret = qdma_queue_stop(xpriv->dev_handle, q_handle, error_str,
+            ONIC_ERROR_STR_BUF_LEN);
+  if (ret < 0)
+    netdev_err(xpriv->netdev,
+         "%s: qdma_queue_stop() failed for Tx queue %d with status %d msg: %s\n",
+         __func__, q_id, ret, error_str);
+
+  ret = qdma_queue_start(xpriv->dev_handle, q_handle, error_str,
+            ONIC_ERROR_STR_BUF_LEN);
+  if (ret != 0)
+    netdev_err(xpriv->netdev,
+         "%s: qdma_queue_start() failed for Tx queue %d with status %d(%s)\n",
+         __func__, q_id, ret, error_str);
+
+  netif_tx_wake_queue(txq);
+}
+
+/* This function switches the C2H free list of a queue pair between pages
+ * of libqdma and the buffers of an AF_XDP pool. A running queue pair has
+ * its NAPI context and C2H queue restarted around it, the H2C queue only
+ * completes the AF_XDP frames in flight.
+ */
+static int onic_xsk_queue_setup(struct onic_priv *xpriv, u16 q_no,
+                                struct xsk_buff_pool *pool, u8 buf_sz_idx)
+{
+  struct net_device *netdev = xpriv->netdev;
+  struct onic_rx_ring *rx_ring = &xpriv->rx_rings[q_no];
+  unsigned long q_handle = xpriv->base_rx_q_handle + q_no;
+  char error_str[ONIC_ERROR_STR_BUF_LEN] = { '0' };
+  bool running = netif_running(netdev);
+  struct qdma_queue_conf qconf;
+  int ret, err;
+
+  if (running) {
+    napi_disable(&xpriv->napi[q_no]);
+    onic_xsk_tx_drain(xpriv, q_no);
+    ret = qdma_queue_stop(xpriv->dev_handle, q_handle, error_str,
+              ONIC_ERROR_STR_BUF_LEN);
+    if (ret < 0) {
+      netdev_err(netdev,
+           "%s: qdma_queue_stop() failed for Rx queue %d with status %d msg: %s\n",
+           __func__, q_no, ret, error_str);
+      goto restart;
+    }
+  }
+
+  ret = qdma_queue_get_config(xpriv->dev_handle, q_handle, &qconf,
+            error_str, ONIC_ERROR_STR_BUF_LEN);
+  if (ret == 0) {
+    qconf.c2h_buf_sz_idx = buf_sz_idx;
+    qconf.c2h_headroom = pool ? 0 : xpriv->rx_headroom;
+    qconf.fp_c2h_buf_alloc = pool ? onic_xsk_buf_alloc : NULL;
+    qconf.fp_c2h_buf_free = pool ? onic_xsk_buf_free : NULL;
+    ret = qdma_queue_config(xpriv->dev_handle, q_handle, &qconf,
+              error_str, ONIC_ERROR_STR_BUF_LEN);
+  }
+  if (ret != 0) {
+    netdev_err(netdev, "%s: failed to configure Rx queue %d with status %d(%s)\n",
+         __func__, q_no, ret, error_str);
+    goto restart;
+  }
+
+  xdp_rxq_info_unreg_mem_model(&rx_ring->xdp_rxq);
+  ret = xdp_rxq_info_reg_mem_model(&rx_ring->xdp_rxq,
+          pool ? MEM_TYPE_XSK_BUFF_POOL : MEM_TYPE_PAGE_SHARED,
+          NULL);
+  if (ret != 0)
+    netdev_err(netdev, "%s: xdp_rxq_info_reg_mem_model() failed for queue %d with status %d\n",
+         __func__, q_no, ret);
+  if (pool)
+    xsk_pool_set_rxq_info(pool, &rx_ring->xdp_rxq);
+  WRITE_ONCE(rx_ring->xsk_pool, pool);
+
+restart:
+  if (!running)
+    return ret;
+
+  err = qdma_queue_start(xpriv->dev_handle, q_handle, error_str,
+            ONIC_ERROR_STR_BUF_LEN);
+  if (err != 0) {
+    netdev_err(netdev,
+         "%s: qdma_queue_start() failed for Rx queue %d with status %d(%s)\n",
+         __func__, q_no, err, error_str);
+    ret = ret ? ret : err;
+  }
+
+  napi_enable(&xpriv->napi[q_no]);
+  local_bh_disable();
+  napi_schedule(&xpriv->napi[q_no]);
+  local_bh_enable();
+
+  return ret;
+}
+
+/* This function binds an AF_XDP pool to a queue pair for zero-copy. The C2H
+ * buffer size becomes the largest CSR entry that fits a UMEM frame.
+ */
+static int onic_xsk_enable(struct onic_priv *xpriv, struct xsk_buff_pool *pool,
+                           u16 q_no)
+{
+  unsigned int frame_len = xpriv->netdev->mtu + ETH_HLEN + VLAN_HLEN;
+  unsigned int frame_sz = xsk_pool_get_rx_frame_size(pool);
+  struct global_csr_conf csr_conf;
+  int i, index = -1, ret;
+
+  if (xpriv->rx_rings[q_no].xsk_pool)
+    return -EBUSY;
+
+  ret = qdma_global_csr_get(xpriv->dev_handle, 0,
+          QDMA_GLOBAL_CSR_ARRAY_SZ, &csr_conf);
+  if (ret < 0)
+    return ret;
+
+  for (i = 0; i < QDMA_GLOBAL_CSR_ARRAY_SZ; i++) {
+    if (csr_conf.c2h_buf_sz[i] < frame_len ||
+        csr_conf.c2h_buf_sz[i] > frame_sz)
+      continue;
+    if (index < 0 || csr_conf.c2h_buf_sz[i] > csr_conf.c2h_buf_sz[index])
+      index = i;
+  }
+  if (index < 0) {
+    netdev_err(xpriv->netdev,
+         "%s: no C2H buffer size between MTU frame %u and UMEM frame %u\n",
+         __func__, frame_len, frame_sz);
+    return -EINVAL;
+  }
+
+  ret = xsk_pool_dma_map(pool, &xpriv->pcidev->dev, 0);
+  if (ret != 0)
+    return ret;
+
+  ret = onic_xsk_queue_setup(xpriv, q_no, pool, index);
+  if (ret != 0)
+    xsk_pool_dma_unmap(pool, 0);
+
+  return ret;
+}
+
+/* This function gives a queue pair back to the stack */
+static int onic_xsk_disable(struct onic_priv *xpriv, u16 q_no)
+{
+  struct xsk_buff_pool *pool = xpriv->rx_rings[q_no].xsk_pool;
+  int ret;
+
+  if (!pool)
+    return -EINVAL;
+
+  ret = onic_xsk_queue_setup(xpriv, q_no, NULL, xpriv->rx_buf_sz_idx);
+  if (ret != 0)
+    return ret;
+
+  xsk_pool_dma_unmap(pool, 0);
+  return 0;
+}
+
+static int onic_bpf(struct net_device *netdev, struct netdev_bpf *bpf)
+{
+  struct onic_priv *xpriv = netdev_priv(netdev);
+
+  switch (bpf->command) {
+  case XDP_SETUP_PROG:
+    return onic_xdp_setup(xpriv, bpf->prog, bpf->extack);
+  case XDP_SETUP_XSK_POOL:
+    if (bpf->xsk.queue_id >= netdev->real_num_rx_queues ||
+        bpf->xsk.queue_id >= netdev->real_num_tx_queues)
+      return -EINVAL;
+    return bpf->xsk.pool ?
+           onic_xsk_enable(xpriv, bpf->xsk.pool, bpf->xsk.queue_id) :
+           onic_xsk_disable(xpriv, bpf->xsk.queue_id);
+  default:
+    return -EINVAL;
+  }
+}
+#endif
+
 /* Network Device Operations */
 static const struct net_device_ops onic_netdev_ops = {
   .ndo_open = onic_open,
@@ -1266,7 +2722,12 @@ static const struct net_device_ops onic_netdev_ops = {
   .ndo_set_mac_address = onic_set_mac_address,
   .ndo_do_ioctl = onic_do_ioctl,
   .ndo_change_mtu = onic_change_mtu,
-  .ndo_get_stats64 = onic_get_stats64
+  .ndo_get_stats64 = onic_get_stats64,
+#ifdef ONIC_XDP
+  .ndo_bpf = onic_bpf,
+  .ndo_xdp_xmit = onic_xdp_xmit,
+  .ndo_xsk_wakeup = onic_xsk_wakeup,
+#endif
 };
 
 extern void onic_set_ethtool_ops(struct net_device *netdev);
@@ -1311,6 +2772,11 @@ static int onic_pci_probe(struct pci_dev *pdev,
   pci_set_drvdata(pdev, netdev);
   netdev->netdev_ops = &onic_netdev_ops;
   onic_set_ethtool_ops(netdev);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+  netdev->xdp_features = NETDEV_XDP_ACT_BASIC | NETDEV_XDP_ACT_REDIRECT |
+                         NETDEV_XDP_ACT_NDO_XMIT |
+                         NETDEV_XDP_ACT_XSK_ZEROCOPY;
+#endif
 
   snprintf(dev_name, IFNAMSIZ, "onic%ds%df%d",
      pdev->bus->number,
@@ -1354,13 +2820,6 @@ static int onic_pci_probe(struct pci_dev *pdev,
     netif_set_real_num_rx_queues(xpriv->netdev, xpriv->nb_queues);
   }
 
-  xpriv->dma_req = KMEM_CACHE(onic_dma_request, 0);
-  if (!xpriv->dma_req) {
-    dev_err(&pdev->dev, "%s: Cache alloc failed", __func__);
-    ret = -ENOMEM;
-    goto exit;
-  }
-
   ret = onic_stats_alloc(xpriv);
   if (ret != 0) {
     netdev_err(netdev,
@@ -1373,7 +2832,7 @@ static int onic_pci_probe(struct pci_dev *pdev,
   if (ret != 0) {
     dev_err(&pdev->dev, "%s: onic_qdma_setup() failed with status %d\n",
       __func__, ret);
-    goto destroy_kmem_cache;
+    goto exit;
   }
 
   /* Map the User BAR */
@@ -1442,8 +2901,6 @@ destroy_cdev:
   onic_destroy_cdev(xpriv->onic_cdev_ptr);
 close_qdma_device:
   qdma_device_close(pdev, xpriv->dev_handle);
-destroy_kmem_cache:
-  kmem_cache_destroy(xpriv->dma_req);
 exit:
   kfree(xpriv->pinfo);
   free_netdev(netdev);
@@ -1482,7 +2939,6 @@ static void onic_pci_remove(struct pci_dev *pdev)
   if (xpriv->bar_base)
     iounmap(xpriv->bar_base);
   qdma_device_close(pdev, xpriv->dev_handle);
-  kmem_cache_destroy(xpriv->dma_req);
   kfree(xpriv->pinfo);
   free_netdev(netdev);
 }
@@ -253,4 +253,12 @@
 #define CMAC_ADPT_OFFSET_RX_PKT_DROP(i)			(CMAC_ADPT_OFFSET(i) + 0x14)
 #define CMAC_ADPT_OFFSET_RX_PKT_ERROR(i)		(CMAC_ADPT_OFFSET(i) + 0x18)
 
+/***** RecoNIC user logic registers *****/
+#define RN_RDMA_OFFSET					0x40000
+#define RN_RDMA_OFFSET_INTEN				(RN_RDMA_OFFSET + 0x20180)
+#define RN_RDMA_OFFSET_INTSTS				(RN_RDMA_OFFSET + 0x20184)
+#define     RN_RDMA_INTSTS_CQ_MASK			BIT(4)
+#define     RN_RDMA_INTSTS_RQ_MASK			BIT(6)
+#define     RN_RDMA_INTSTS_ERR_MASK			0xAF
+
 #endif